@@ -9,41 +9,102 @@
 
 #include <imgui.h>
 
+#include <deque>
+#include <unordered_map>
+
 std::string getNodeErrorInfo(BehaviorTree::Node *node)
 {
     std::string info = node->getName();
-    if (node->hasLuaDebugInfo())
+    const std::string sourceLocation = node->getLuaSourceLocation();
+    if (!sourceLocation.empty())
     {
-        const lua_Debug &debugInfo = node->getLuaDebugInfo();
-        std::vector<std::string> pathSplitted = su::split(debugInfo.source, "/");
-        if (!pathSplitted.empty())
+        info += "@" + sourceLocation;
+        if (BehaviorTree::Node::getLuaDebugInfoMode() == BehaviorTree::Node::LuaDebugInfoMode::FULL)
         {
-            info += "@" + pathSplitted.back() + ":" + std::to_string(debugInfo.currentline);
+            const lua_Debug &debugInfo = node->getLuaDebugInfo();
+            if (debugInfo.name != nullptr)
+            {
+                info += std::string(" (in ") + debugInfo.name + ")";
+            }
         }
     }
     return info;
 }
 
+#ifndef DIBIDAB_NO_BEHAVIOR_TREE_DEBUG_INFO
+static BehaviorTree::Node::LuaDebugInfoMode luaDebugInfoMode = BehaviorTree::Node::LuaDebugInfoMode::CALL_SITE;
+#else
+static BehaviorTree::Node::LuaDebugInfoMode luaDebugInfoMode = BehaviorTree::Node::LuaDebugInfoMode::OFF;
+#endif
+
+// The Lua sources that nodes were created from. A deque, so that c_str() stays valid.
+static std::deque<std::string> luaSources;
+// `lua_Debug::source` pointers seen before, so that a new node usually only needs a lookup and a compare.
+static std::unordered_map<const char *, int> luaSourceIndexByPointer;
+
+static int internLuaSource(const char *source)
+{
+    auto it = luaSourceIndexByPointer.find(source);
+    if (it != luaSourceIndexByPointer.end() && luaSources[it->second] == source)
+    {
+        return it->second;
+    }
+    // New pointer, or the old one was reused by another (reloaded) script:
+    int index = 0;
+    while (index < luaSources.size() && luaSources[index] != source)
+    {
+        index++;
+    }
+    if (index == luaSources.size())
+    {
+        luaSources.emplace_back(source);
+    }
+    luaSourceIndexByPointer[source] = index;
+    return index;
+}
+
 BehaviorTree::Node::Node() :
     parent(nullptr),
     bEntered(false),
     bAborted(false),
-    luaDebugInfo(),
-    bHasLuaDebugInfo(false)
+    traceTarget(nullptr),
+    traceNodeId(0),
+    luaSourceIndex(-1),
+    luaLine(0)
 {
+#ifndef DIBIDAB_NO_BEHAVIOR_TREE_DEBUG_INFO
+    if (luaDebugInfoMode == LuaDebugInfoMode::OFF)
+    {
+        return;
+    }
     lua_State *luaState = luau::getLuaState().lua_state();
-    if (lua_getstack(luaState, 1, &luaDebugInfo))
+    lua_Debug debugInfo;
+    if (!lua_getstack(luaState, 1, &debugInfo))
+    {
+        return;
+    }
+    if (luaDebugInfoMode == LuaDebugInfoMode::FULL)
     {
-        if (lua_getinfo(luaState, "nSl", &luaDebugInfo))
+        if (lua_getinfo(luaState, "nSl", &debugInfo))
         {
-            bHasLuaDebugInfo = true;
+            luaDebugInfo = std::make_unique<lua_Debug>(debugInfo);
+            luaSourceIndex = internLuaSource(debugInfo.source);
+            luaLine = debugInfo.currentline;
         }
     }
+    // Skip "n", finding the name of the function is the expensive part:
+    else if (lua_getinfo(luaState, "Sl", &debugInfo))
+    {
+        luaSourceIndex = internLuaSource(debugInfo.source);
+        luaLine = debugInfo.currentline;
+    }
+#endif
 }
 
 void BehaviorTree::Node::enter()
 {
     bEntered = true;
+    trace(BehaviorTreeTrace::EventType::ENTER);
 #ifndef NDEBUG
     if (parent && !parent->isEntered())
     {
@@ -65,6 +126,7 @@ void BehaviorTree::Node::abort()
     }
 #endif
     bAborted = true;
+    trace(BehaviorTreeTrace::EventType::ABORT);
 }
 
 void BehaviorTree::Node::finish(BehaviorTree::Node::Result result)
@@ -88,6 +150,7 @@ void BehaviorTree::Node::finish(BehaviorTree::Node::Result result)
     bFinishedAtLeastOnce = true;
     lastResult = result;
 #endif
+    trace(BehaviorTreeTrace::EventType::FINISH, result);
     if (parent != nullptr)
     {
         parent->onChildFinished(this, result);
@@ -120,14 +183,48 @@ BehaviorTree::Node *BehaviorTree::Node::setDescription(const char *inDescription
     return this;
 }
 
+void BehaviorTree::Node::setLuaDebugInfoMode(LuaDebugInfoMode mode)
+{
+#ifndef DIBIDAB_NO_BEHAVIOR_TREE_DEBUG_INFO
+    luaDebugInfoMode = mode;
+#endif
+}
+
+BehaviorTree::Node::LuaDebugInfoMode BehaviorTree::Node::getLuaDebugInfoMode()
+{
+    return luaDebugInfoMode;
+}
+
 bool BehaviorTree::Node::hasLuaDebugInfo() const
 {
-    return bHasLuaDebugInfo;
+    return luaSourceIndex >= 0;
+}
+
+std::string BehaviorTree::Node::getLuaSourceLocation() const
+{
+    if (!hasLuaDebugInfo())
+    {
+        return "";
+    }
+    const std::string &source = luaSources[luaSourceIndex];
+    const std::size_t lastSlash = source.find_last_of('/');
+    return (lastSlash == std::string::npos ? source : source.substr(lastSlash + 1)) + ":" + std::to_string(luaLine);
 }
 
 const lua_Debug &BehaviorTree::Node::getLuaDebugInfo() const
 {
-    return luaDebugInfo;
+    if (!luaDebugInfo)
+    {
+        luaDebugInfo = std::make_unique<lua_Debug>();
+        if (hasLuaDebugInfo())
+        {
+            const std::string &source = luaSources[luaSourceIndex];
+            luaDebugInfo->source = source.c_str();
+            strncpy(luaDebugInfo->short_src, source.c_str(), LUA_IDSIZE - 1);
+            luaDebugInfo->currentline = luaLine;
+        }
+    }
+    return *luaDebugInfo;
 }
 
 #ifndef NDEBUG
@@ -149,6 +246,31 @@ void BehaviorTree::Node::registerAsParent(BehaviorTree::Node *child)
         throw gu_err("Child already has a parent: " + getNodeErrorInfo(child));
     }
     child->parent = this;
+    if (traceTarget != nullptr)
+    {
+        child->setTraceTarget(traceTarget);
+    }
+}
+
+void BehaviorTree::Node::setTraceTarget(BehaviorTreeTrace::Target *target)
+{
+    traceTarget = target;
+    traceNodeId = target->numNodes++;
+
+    if (CompositeNode *composite = dynamic_cast<CompositeNode *>(this))
+    {
+        for (Node *child : composite->getChildren())
+        {
+            child->setTraceTarget(target);
+        }
+    }
+    else if (DecoratorNode *decorator = dynamic_cast<DecoratorNode *>(this))
+    {
+        if (Node *child = decorator->getChild())
+        {
+            child->setTraceTarget(target);
+        }
+    }
 }
 
 void BehaviorTree::CompositeNode::finish(BehaviorTree::Node::Result result)
@@ -767,6 +889,12 @@ BehaviorTree::WaitNode *BehaviorTree::WaitNode::finishAfter(const float inSecond
     return this;
 }
 
+BehaviorTree::WaitNode *BehaviorTree::WaitNode::setDuration(const float inSeconds)
+{
+    seconds = inSeconds;
+    return this;
+}
+
 void BehaviorTree::WaitNode::enter()
 {
     Node::enter();
@@ -848,6 +976,7 @@ void BehaviorTree::WaitNode::drawDebugInfo() const
 }
 
 BehaviorTree::ComponentObserverNode::ComponentObserverNode() :
+    observingId(0),
     bUseSafetyDelay(true),
     fulfilledNodeIndex(INVALID_CHILD_INDEX),
     unfulfilledNodeIndex(INVALID_CHILD_INDEX),
@@ -859,12 +988,15 @@ BehaviorTree::ComponentObserverNode::ComponentObserverNode() :
 void BehaviorTree::ComponentObserverNode::enter()
 {
     BehaviorTree::CompositeNode::enter();
+    startObserving();
     enterChild();
 }
 
 void BehaviorTree::ComponentObserverNode::abort()
 {
     BehaviorTree::CompositeNode::abort();
+    // The branch that is running will be aborted anyway, changes do not matter anymore:
+    stopObserving();
     if (currentNodeIndex != INVALID_CHILD_INDEX)
     {
         getChildren().at(currentNodeIndex)->abort();
@@ -878,12 +1010,14 @@ void BehaviorTree::ComponentObserverNode::abort()
 void BehaviorTree::ComponentObserverNode::finish(BehaviorTree::Node::Result result)
 {
     currentNodeIndex = INVALID_CHILD_INDEX;
+    // stop before Node::finish(), the parent might enter this node again.
+    stopObserving();
     Node::finish(result);
 }
 
 BehaviorTree::ComponentObserverNode *BehaviorTree::ComponentObserverNode::withoutSafetyDelay()
 {
-    if (!observerHandles.empty())
+    if (!observedConditions.empty())
     {
         throw gu_err("Safety delay can only be disabled before observers are added: " + getNodeErrorInfo(this));
     }
@@ -938,40 +1072,37 @@ const char *BehaviorTree::ComponentObserverNode::getName() const
 void BehaviorTree::ComponentObserverNode::drawDebugInfo() const
 {
     Node::drawDebugInfo();
-    // TODO/WARNING: this debug info relies heavily on the implementation details.
 
-    for (int i = 0; i < observerHandles.size() / 2; i++)
+    for (int i = 0; i < observedConditions.size(); i++)
     {
         if (i > 0)
         {
             ImGui::TextDisabled(" | ");
             ImGui::SameLine();
         }
-        const ObserverHandle& observerHandle = observerHandles[i * 2];
-        const entt::entity entity = observerHandle.handle.getEntity();
+        const ObservedCondition &condition = observedConditions[i];
 
-        if (!observerHandle.engine->entities.valid(entity))
+        if (!condition.engine->entities.valid(condition.entity))
         {
-            ImGui::Text("Invalid entity #%d", int(entity));
+            ImGui::Text("Invalid entity #%d", int(condition.entity));
             continue;
         }
-        const bool bCurrentValue = conditions[i];
+        const bool bHasComponent = condition.componentUtils->entityHasComponent(condition.entity,
+            condition.engine->entities);
 
-        bool bTmpValue = bCurrentValue;
+        // conditions are only updated while entered:
+        bool bTmpValue = isEntered() ? bool(conditions[i]) : (bHasComponent ? condition.presentValue : condition.absentValue);
         ImGui::Checkbox("", &bTmpValue);
         ImGui::SameLine();
 
-        const bool bHasComponent = observerHandle.componentUtils->entityHasComponent(entity,
-            observerHandle.engine->entities);
-
-        if (const char *entityName = observerHandle.engine->getName(entity))
+        if (const char *entityName = condition.engine->getName(condition.entity))
         {
-            ImGui::Text("#%d %s ", int(entity), entityName);
+            ImGui::Text("#%d %s ", int(condition.entity), entityName);
             ImGui::SameLine();
         }
-        ImGui::TextDisabled(bCurrentValue == bHasComponent ? "has " : "excludes ");
+        ImGui::TextDisabled(condition.presentValue ? "has " : "excludes ");
         ImGui::SameLine();
-        ImGui::Text("%s", observerHandle.componentUtils->structInfo->name);
+        ImGui::Text("%s", condition.componentUtils->structInfo->name);
         ImGui::SameLine();
     }
 }
@@ -1017,50 +1148,87 @@ void BehaviorTree::ComponentObserverNode::observe(EntityEngine *engine, entt::en
         throw gu_err("Invalid entity was given: " + getNodeErrorInfo(this));
     }
 #endif
-    // TODO: Only register callbacks on enter. Remove callbacks when leaving or in destructor
-    EntityObserver *observer = componentUtils->getEntityObserver(engine->entities);
-    const int conditionIndex = int(conditions.size());
+    ObservedCondition &condition = observedConditions.emplace_back();
+    condition.engine = engine;
+    condition.entity = entity;
+    condition.componentUtils = componentUtils;
+    condition.presentValue = presentValue;
+    condition.absentValue = absentValue;
+    conditions.push_back(absentValue);
+}
 
-    std::function<void()> onConstructCallback = [this, engine, entity, conditionIndex, presentValue]
-    {
-        conditions[conditionIndex] = presentValue;
-        onConditionsChanged(engine, entity);
-    };
+void BehaviorTree::ComponentObserverNode::startObserving()
+{
+    observingId++;
+    observerHandles.reserve(observedConditions.size() * 2ul);
 
-    EntityObserver::Handle onConstructHandle = observer->onConstruct(entity,
-        bUseSafetyDelay ? [this, engine, onConstructCallback, conditionIndex]
+    for (int i = 0; i < observedConditions.size(); i++)
+    {
+        const ObservedCondition &condition = observedConditions[i];
+        if (!condition.engine->entities.valid(condition.entity))
         {
-            observerHandles[conditionIndex * 2ul].latestConditionChangedDelay =
-                engine->getTimeOuts()->nextUpdate += onConstructCallback;
+            conditions[i] = condition.absentValue;
+            continue;
         }
-        :
-        onConstructCallback
-    );
+        // Components might have changed while not entered, so sample them again:
+        conditions[i] = condition.componentUtils->entityHasComponent(condition.entity, condition.engine->entities)
+            ? condition.presentValue : condition.absentValue;
+
+        EntityObserver *observer = condition.componentUtils->getEntityObserver(condition.engine->entities);
+        observerHandles.push_back({
+            observer,
+            observer->onConstruct(condition.entity, [this, i]
+            {
+                onObservedComponentChanged(i, true);
+            })
+        });
+        observerHandles.push_back({
+            observer,
+            observer->onDestroy(condition.entity, [this, i]
+            {
+                onObservedComponentChanged(i, false);
+            })
+        });
+    }
+    bFulFilled = allConditionsFulfilled();
+}
 
-    std::function<void()> onDestroyCallback = [this, engine, entity, conditionIndex, absentValue]
+void BehaviorTree::ComponentObserverNode::stopObserving()
+{
+    if (observerHandles.empty())
     {
-        conditions[conditionIndex] = absentValue;
-        onConditionsChanged(engine, entity);
-    };
+        return;
+    }
+    observingId++;
+    for (ObserverHandle &observerHandle : observerHandles)
+    {
+        observerHandle.observer->unregister(observerHandle.handle);
+    }
+    observerHandles.clear();
+}
+
+void BehaviorTree::ComponentObserverNode::onObservedComponentChanged(int conditionIndex, bool bConstructed)
+{
+    ObservedCondition &condition = observedConditions[conditionIndex];
+    const bool bNewValue = bConstructed ? condition.presentValue : condition.absentValue;
 
-    EntityObserver::Handle onDestroyHandle = observer->onDestroy(entity,
-        bUseSafetyDelay ? [this, engine, onDestroyCallback, conditionIndex]
+    if (!bUseSafetyDelay)
+    {
+        conditions[conditionIndex] = bNewValue;
+        onConditionsChanged();
+        return;
+    }
+    // Replaces an earlier change of this frame, only the latest one matters:
+    condition.latestConditionChangedDelay = condition.engine->getTimeOuts()->nextUpdate +=
+        [this, conditionIndex, bNewValue, observedId = observingId]
+    {
+        if (observedId != observingId)
         {
-            observerHandles[conditionIndex * 2ul + 1ul].latestConditionChangedDelay =
-                engine->getTimeOuts()->nextUpdate += onDestroyCallback;
+            return; // stopped observing in the meantime, and might have sampled the components again since then.
         }
-        :
-        onDestroyCallback
-    );
-
-    observerHandles.push_back({
-        engine, componentUtils, onConstructHandle
-    });
-    observerHandles.push_back({
-        engine, componentUtils, onDestroyHandle
-    });
-    conditions.push_back(componentUtils->entityHasComponent(entity, engine->entities) ? presentValue : absentValue);
-    bFulFilled = allConditionsFulfilled();
+        conditions[conditionIndex] = bNewValue;
+        onConditionsChanged();
+    };
 }
 
 bool BehaviorTree::ComponentObserverNode::allConditionsFulfilled() const
@@ -1074,7 +1242,7 @@ bool BehaviorTree::ComponentObserverNode::allConditionsFulfilled() const
     }
     return true;
 }
-void BehaviorTree::ComponentObserverNode::onConditionsChanged(EntityEngine *engine, entt::entity entity)
+void BehaviorTree::ComponentObserverNode::onConditionsChanged()
 {
     bool bNewFulfilled = allConditionsFulfilled();
 
@@ -1121,17 +1289,123 @@ void BehaviorTree::ComponentObserverNode::enterChild()
 
 BehaviorTree::ComponentObserverNode::~ComponentObserverNode()
 {
-    for (ObserverHandle &observerHandle : observerHandles)
+    if (observerHandles.empty() || observedConditions.front().engine->isDestructing())
+    {
+        // getEntityObserver() will crash because the registry's context variables are destroyed already.
+        // Unregistering is not needed because the callbacks will be destroyed anyway.
+        return;
+    }
+    stopObserving();
+}
+
+BehaviorTree::WaitForEventNode::WaitForEventNode() :
+    engine(nullptr),
+    emitterEntity(entt::null),
+    timeoutSeconds(-1.0f)
+{}
+
+BehaviorTree::WaitForEventNode *BehaviorTree::WaitForEventNode::listen(EntityEngine *inEngine,
+    const entt::entity inEmitterEntity, const char *inEventName)
+{
+    if (isEntered())
+    {
+        throw gu_err("Cannot edit while entered: " + getNodeErrorInfo(this));
+    }
+    if (inEngine == nullptr)
     {
-        if (observerHandle.engine->isDestructing())
+        throw gu_err("Engine is a nullptr!\n" + getNodeErrorInfo(this));
+    }
+    if (inEmitterEntity == entt::null && timeoutSeconds >= 0.0f)
+    {
+        throw gu_err("A timeout can only be used when listening to an entity: " + getNodeErrorInfo(this));
+    }
+    engine = inEngine;
+    emitterEntity = inEmitterEntity;
+    eventName = inEventName;
+    return this;
+}
+
+BehaviorTree::WaitForEventNode *BehaviorTree::WaitForEventNode::timeout(const float seconds)
+{
+    if (isEntered())
+    {
+        throw gu_err("Cannot edit while entered: " + getNodeErrorInfo(this));
+    }
+    if (engine != nullptr && emitterEntity == entt::null && seconds >= 0.0f)
+    {
+        throw gu_err("A timeout can only be used when listening to an entity: " + getNodeErrorInfo(this));
+    }
+    timeoutSeconds = seconds;
+    return this;
+}
+
+void BehaviorTree::WaitForEventNode::enter()
+{
+    Node::enter();
+    if (engine == nullptr)
+    {
+        throw gu_err("No event to wait for was given: " + getNodeErrorInfo(this));
+    }
+    EventEmitter *emitter = &engine->events;
+    if (emitterEntity != entt::null)
+    {
+        if (!engine->entities.valid(emitterEntity))
         {
-            // getEntityObserver() will crash because the registry's context variables are destroyed already.
-            // Unregistering is not needed because the callbacks will be destroyed anyway.
-            continue;
+            throw gu_err("Entity #" + std::to_string(int(emitterEntity)) + " is not valid!\n" + getNodeErrorInfo(this));
+        }
+        emitter = &engine->entities.get_or_assign<EventEmitter>(emitterEntity);
+    }
+    eventListener = emitter->onNative(eventName.c_str(), [&]()
+    {
+        finish(Node::Result::SUCCESS);
+    });
+    if (timeoutSeconds >= 0.0f)
+    {
+        onTimeout = engine->getTimeOuts()->unsafeCallAfter(timeoutSeconds, emitterEntity, [&]()
+        {
+            finish(Node::Result::FAILURE);
+        });
+    }
+}
+
+void BehaviorTree::WaitForEventNode::abort()
+{
+    Node::abort();
+    finish(Node::Result::ABORTED);
+}
+
+void BehaviorTree::WaitForEventNode::finish(BehaviorTree::Node::Result result)
+{
+    eventListener.reset();
+    onTimeout.reset();
+    Node::finish(result);
+}
+
+const char *BehaviorTree::WaitForEventNode::getName() const
+{
+    return "WaitForEvent";
+}
+
+void BehaviorTree::WaitForEventNode::drawDebugInfo() const
+{
+    Node::drawDebugInfo();
+    ImGui::Text("%s", eventName.c_str());
+    if (engine != nullptr && emitterEntity != entt::null)
+    {
+        ImGui::SameLine();
+        if (const char *emitterName = engine->entities.valid(emitterEntity) ? engine->getName(emitterEntity) : nullptr)
+        {
+            ImGui::TextDisabled("from #%d %s", int(emitterEntity), emitterName);
+        }
+        else
+        {
+            ImGui::TextDisabled("from #%d", int(emitterEntity));
         }
-        observerHandle.componentUtils
-            ->getEntityObserver(observerHandle.engine->entities)
-            ->unregister(observerHandle.handle);
+    }
+    if (timeoutSeconds >= 0.0f)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(timeout: %.2fs)", timeoutSeconds);
     }
 }
 
@@ -1311,6 +1585,57 @@ BehaviorTree::Node *BehaviorTree::getRootNode() const
     return rootNode.get();
 }
 
+void BehaviorTree::setTrace(BehaviorTreeTrace *trace, entt::entity entity)
+{
+    if (!rootNode)
+    {
+        throw gu_err("Cannot trace a BehaviorTree without rootNode!");
+    }
+    if (traceTarget)
+    {
+        throw gu_err("A trace was already set!");
+    }
+    traceTarget = std::make_shared<BehaviorTreeTrace::Target>();
+    traceTarget->trace = trace;
+    traceTarget->entity = entity;
+    rootNode->setTraceTarget(traceTarget.get());
+}
+
+BehaviorTree::Node *BehaviorTree::findTracedNodeInSubtree(Node *node, uint32_t traceNodeId)
+{
+    if (node->traceNodeId == traceNodeId)
+    {
+        return node;
+    }
+    if (BehaviorTree::CompositeNode *composite = dynamic_cast<BehaviorTree::CompositeNode *>(node))
+    {
+        for (BehaviorTree::Node *child : composite->getChildren())
+        {
+            if (BehaviorTree::Node *found = findTracedNodeInSubtree(child, traceNodeId))
+            {
+                return found;
+            }
+        }
+    }
+    else if (BehaviorTree::DecoratorNode *decorator = dynamic_cast<BehaviorTree::DecoratorNode *>(node))
+    {
+        if (BehaviorTree::Node *child = decorator->getChild())
+        {
+            return findTracedNodeInSubtree(child, traceNodeId);
+        }
+    }
+    return nullptr;
+}
+
+BehaviorTree::Node *BehaviorTree::findTracedNode(uint32_t traceNodeId) const
+{
+    if (!rootNode || !traceTarget)
+    {
+        return nullptr;
+    }
+    return findTracedNodeInSubtree(rootNode.get(), traceNodeId);
+}
+
 void BehaviorTree::addToLuaEnvironment(sol::state *lua)
 {
     lua->new_enum(
@@ -1320,6 +1645,14 @@ void BehaviorTree::addToLuaEnvironment(sol::state *lua)
         "ABORTED", BehaviorTree::Node::Result::ABORTED
     );
 
+    lua->new_enum(
+        "BTDebugInfoMode",
+        "OFF", BehaviorTree::Node::LuaDebugInfoMode::OFF,
+        "CALL_SITE", BehaviorTree::Node::LuaDebugInfoMode::CALL_SITE,
+        "FULL", BehaviorTree::Node::LuaDebugInfoMode::FULL
+    );
+    (*lua)["setBehaviorTreeDebugInfoMode"] = &BehaviorTree::Node::setLuaDebugInfoMode;
+
     // ------------------------ Abstract Node classes: -------------------------- //
 
     sol::usertype<BehaviorTree::Node> nodeType = lua->new_usertype<BehaviorTree::Node>(
@@ -1457,11 +1790,42 @@ void BehaviorTree::addToLuaEnvironment(sol::state *lua)
         {
             node.finishAfter(seconds, waitingEntity, currentEnv.env.value().get<EntityEngine *>(EntityEngine::LUA_ENV_PTR_NAME));
             return node;
+        },
+        "setDuration", [] (BehaviorTree::WaitNode &node, float seconds)
+            -> BehaviorTree::WaitNode & // Important! Explicitly saying it returns a reference to this node to prevent segfaults.
+        {
+            node.setDuration(seconds);
+            return node;
         }
     );
 
     // ------------------------ Event-based Node classes: -------------------------- //
 
+    sol::usertype<BehaviorTree::WaitForEventNode> waitForEventNodeType = lua->new_usertype<BehaviorTree::WaitForEventNode>(
+        "BTWaitForEventNode",
+        sol::factories([] ()
+        {
+            return new BehaviorTree::WaitForEventNode();
+        }),
+        sol::base_classes,
+        sol::bases<BehaviorTree::Node, BehaviorTree::LeafNode>(),
+
+        "listen", [] (BehaviorTree::WaitForEventNode &node, const char *eventName, sol::optional<entt::entity> emitterEntity,
+            const sol::this_environment &currentEnv)
+            -> BehaviorTree::WaitForEventNode & // Important! Explicitly saying it returns a reference to this node to prevent segfaults.
+        {
+            node.listen(currentEnv.env.value().get<EntityEngine *>(EntityEngine::LUA_ENV_PTR_NAME),
+                emitterEntity.value_or(entt::null), eventName);
+            return node;
+        },
+        "timeout", [] (BehaviorTree::WaitForEventNode &node, float seconds)
+            -> BehaviorTree::WaitForEventNode & // Important! Explicitly saying it returns a reference to this node to prevent segfaults.
+        {
+            node.timeout(seconds);
+            return node;
+        }
+    );
+
     sol::usertype<BehaviorTree::ComponentObserverNode> componentObserverNodeType = lua->new_usertype<BehaviorTree::ComponentObserverNode>(
         "BTComponentObserverNode",
         sol::factories([] ()
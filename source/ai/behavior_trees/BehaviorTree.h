@@ -2,6 +2,8 @@
 #ifndef GAME_BEHAVIORTREE_H
 #define GAME_BEHAVIORTREE_H
 
+#include "BehaviorTreeTrace.h"
+
 #include "../../ecs/EntityEngine.h"
 
 #include "../../luau.h"
@@ -47,8 +49,35 @@ class BehaviorTree
 
         Node *setDescription(const char *description);
 
+        /**
+         * How much Lua debug info is captured when a node is created:
+         * - OFF: nothing.
+         * - CALL_SITE (default): only an index of the (interned) Lua source and the line. Cheap.
+         * - FULL: the complete lua_Debug, including the name of the calling function.
+         * Define DIBIDAB_NO_BEHAVIOR_TREE_DEBUG_INFO to never capture anything (e.g. for production builds).
+         */
+        enum class LuaDebugInfoMode
+        {
+            OFF,
+            CALL_SITE,
+            FULL
+        };
+
+        static void setLuaDebugInfoMode(LuaDebugInfoMode mode);
+
+        static LuaDebugInfoMode getLuaDebugInfoMode();
+
         bool hasLuaDebugInfo() const;
 
+        /**
+         * Returns "file.lua:line", or an empty string if there's no debug info.
+         */
+        std::string getLuaSourceLocation() const;
+
+        /**
+         * Unless the node was created in FULL mode, only `source`, `short_src` and `currentline` are set.
+         * These are resolved on the first call.
+         */
         const lua_Debug &getLuaDebugInfo() const;
 
         virtual const char *getName() const = 0;
@@ -70,20 +99,39 @@ class BehaviorTree
         virtual void onChildFinished(Node *child, Result result) {};
 
       private:
+        // also assigns an id to the node and its descendants.
+        void setTraceTarget(BehaviorTreeTrace::Target *target);
+
+        void trace(BehaviorTreeTrace::EventType type, Result result = Result::SUCCESS) const
+        {
+            if (traceTarget != nullptr)
+            {
+                traceTarget->trace->record(traceTarget->entity, traceNodeId, type, uint8_t(result));
+            }
+        }
+
         Node *parent;
         bool bEntered;
         bool bAborted;
 
+        BehaviorTreeTrace::Target *traceTarget;
+        uint32_t traceNodeId;
+
         std::string description;
 
-        lua_Debug luaDebugInfo;
-        bool bHasLuaDebugInfo;
+        // index into the interned Lua sources, -1 if no debug info was captured.
+        int luaSourceIndex;
+        int luaLine;
+        // only set for FULL mode, or by getLuaDebugInfo().
+        mutable std::unique_ptr<lua_Debug> luaDebugInfo;
 
 #ifndef NDEBUG
         Result lastResult;
         bool bFinishedAtLeastOnce = false;
 #endif
         friend class BehaviorTreeInspector;
+        friend class CompiledBehaviorTree;
+        friend class BehaviorTree;
     };
 
     struct CompositeNode : public Node
@@ -285,6 +333,12 @@ class BehaviorTree
 
         WaitNode *finishAfter(float seconds, entt::entity waitingEntity, EntityEngine *engine);
 
+        /**
+         * Only sets the duration, without an entity to wait for. Only useful for trees that will be compiled
+         * (see CompiledBehaviorTree), those use the entity of the instance.
+         */
+        WaitNode *setDuration(float seconds);
+
         void enter() override;
 
         void abort() override;
@@ -312,6 +366,7 @@ class BehaviorTree
 #ifndef NDEBUG
         float timeStarted;
 #endif
+        friend class CompiledBehaviorTree;
     };
 
     // ------------------------ Event-based Node classes: -------------------------- //
@@ -367,24 +422,44 @@ class BehaviorTree
         void observe(EntityEngine *engine, entt::entity entity, const ComponentUtils *componentUtils, bool presentValue,
             bool absentValue);
 
+        // Observers are only registered while entered, so that dormant branches do not react to components changing.
+        void startObserving();
+
+        void stopObserving();
+
+        void onObservedComponentChanged(int conditionIndex, bool bConstructed);
+
         bool allConditionsFulfilled() const;
 
-        void onConditionsChanged(EntityEngine *engine, entt::entity entity);
+        void onConditionsChanged();
 
         int getChildIndexToEnter() const;
 
         void enterChild();
 
-        struct ObserverHandle
+        struct ObservedCondition
         {
             EntityEngine *engine = nullptr;
+            entt::entity entity = entt::null;
             const ComponentUtils *componentUtils = nullptr;
-            EntityObserver::Handle handle;
+            bool presentValue = true;
+            bool absentValue = false;
             delegate_method latestConditionChangedDelay;
         };
 
+        struct ObserverHandle
+        {
+            EntityObserver *observer;
+            EntityObserver::Handle handle;
+        };
+
+        std::vector<ObservedCondition> observedConditions;
+        // only filled while entered:
         std::vector<ObserverHandle> observerHandles;
+        // only up to date while entered:
         std::vector<bool> conditions;
+        // increased when observing starts or stops, so that delayed condition changes from before can be ignored.
+        uint observingId;
         bool bUseSafetyDelay;
         int fulfilledNodeIndex;
         int unfulfilledNodeIndex;
@@ -394,6 +469,44 @@ class BehaviorTree
         friend class BehaviorTreeInspector;
     };
 
+    /**
+     * Finishes with SUCCESS once the event is emitted, or with FAILURE if the timeout (if any) passes first.
+     * Only listens while entered, and without any Lua involved.
+     */
+    struct WaitForEventNode : public LeafNode
+    {
+        WaitForEventNode();
+
+        /**
+         * Pass entt::null as emitterEntity to listen to the events of the engine itself (`engine.events`).
+         */
+        WaitForEventNode *listen(EntityEngine *engine, entt::entity emitterEntity, const char *eventName);
+
+        /**
+         * The timer runs on the emitter entity, so this cannot be used for events of the engine itself (throws).
+         */
+        WaitForEventNode *timeout(float seconds);
+
+        void enter() override;
+
+        void abort() override;
+
+        void finish(Result result) override;
+
+        const char *getName() const override;
+
+        void drawDebugInfo() const override;
+
+      private:
+        EntityEngine *engine;
+        entt::entity emitterEntity;
+        std::string eventName;
+        float timeoutSeconds;
+
+        EventEmitter::ListenerHandle eventListener;
+        delegate_method onTimeout;
+    };
+
     // ------------------------ Customization Node classes: -------------------------- //
 
     struct LuaLeafNode : public LeafNode
@@ -448,8 +561,22 @@ class BehaviorTree
 
     Node *getRootNode() const;
 
+    /**
+     * Records the enter/finish/abort events of all nodes in the trace (also of nodes that are added later on).
+     * Call after setting the root node.
+     */
+    void setTrace(BehaviorTreeTrace *trace, entt::entity entity);
+
+    // returns nullptr if not found, or if the tree is not traced.
+    Node *findTracedNode(uint32_t traceNodeId) const;
+
   private:
 
+    static Node *findTracedNodeInSubtree(Node *node, uint32_t traceNodeId);
+
+    // shared with copies of this BehaviorTree, just like the rootNode. Declared first, so it's deleted after the nodes.
+    std::shared_ptr<BehaviorTreeTrace::Target> traceTarget;
+
     // Note: this is a shared pointer, so it only gets deleted when BehaviorTree is truly deleted and not copied.
     std::shared_ptr<Node> rootNode;
 
@@ -38,7 +38,16 @@ bool BehaviorTreeInspector::drawGUI()
             }
             if (ImGui::BeginTabItem(tabName.c_str(), &bOpen))
             {
-                if (BehaviorTree::Node *root = tree.getRootNode())
+                if (std::shared_ptr<CompiledBehaviorTree::Instance> compiledTree = brain.compiledBehaviorTree)
+                {
+                    ImGui::PushFont(ImGui::GetIO().Fonts->Fonts.back()); // small default font
+                    ImGui::Columns(3);
+                    ImGui::SetColumnWidth(1, 96.0f);
+                    drawCompiledNode(*compiledTree, 0, 0u);
+                    ImGui::Columns(1);
+                    ImGui::PopFont();
+                }
+                else if (BehaviorTree::Node *root = tree.getRootNode())
                 {
                     ImGui::PushFont(ImGui::GetIO().Fonts->Fonts.back()); // small default font
                     ImGui::Columns(3);
@@ -98,13 +107,8 @@ void BehaviorTreeInspector::drawNode(BehaviorTree::Node *node, uint depth)
 
     if (node->hasLuaDebugInfo())
     {
-        const lua_Debug &debugInfo = node->getLuaDebugInfo();
-        std::vector<std::string> pathSplitted = su::split(debugInfo.source, "/");
-        if (!pathSplitted.empty())
-        {
-            ImGui::SameLine();
-            ImGui::TextDisabled("%s:%d", pathSplitted.back().c_str(), debugInfo.currentline);
-        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", node->getLuaSourceLocation().c_str());
     }
     ImGui::NextColumn();
     ImGui::AlignTextToFramePadding();
@@ -161,3 +165,100 @@ void BehaviorTreeInspector::drawNode(BehaviorTree::Node *node, uint depth)
     }
     ImGui::PopID();
 }
+
+void BehaviorTreeInspector::drawCompiledNode(const CompiledBehaviorTree::Instance &instance, uint16 nodeIndex, uint depth)
+{
+    const CompiledBehaviorTree &tree = instance.getTree();
+    const CompiledBehaviorTree::NodeDefinition &definition = tree.getNodes()[nodeIndex];
+
+    ImGui::PushID(nodeIndex);
+    ImGui::AlignTextToFramePadding();
+
+    ImGuiTreeNodeFlags nodeFlags = 0;
+    if (definition.numChildren == 0)
+    {
+        nodeFlags |= ImGuiTreeNodeFlags_Leaf;
+    }
+    if (depth < 4)
+    {
+        nodeFlags |= ImGuiTreeNodeFlags_DefaultOpen;
+    }
+    if (instance.isEntered(nodeIndex))
+    {
+        nodeFlags |= ImGuiTreeNodeFlags_Selected;
+    }
+
+    bool bNodeOpen = ImGui::TreeNodeEx(tree.getNodeName(nodeIndex), nodeFlags);
+
+    if (const char *sourceLocation = tree.getSourceLocation(nodeIndex))
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", sourceLocation);
+    }
+    ImGui::NextColumn();
+    ImGui::AlignTextToFramePadding();
+
+    if (instance.isEntered(nodeIndex))
+    {
+        if (instance.isAborted(nodeIndex))
+        {
+            ImGui::SameLine();
+            ImGui::Text("[ABORTING...]");
+        }
+    }
+#ifndef NDEBUG
+    else if (instance.hasFinishedAtLeastOnce(nodeIndex))
+    {
+        switch (instance.getLastResult(nodeIndex))
+        {
+            case BehaviorTree::Node::Result::SUCCESS:
+                ImGui::TextDisabled("[SUCCESS]");
+                break;
+            case BehaviorTree::Node::Result::FAILURE:
+                ImGui::TextDisabled("[FAILURE]");
+                break;
+            case BehaviorTree::Node::Result::ABORTED:
+                ImGui::TextDisabled("[ABORTED]");
+                break;
+        }
+    }
+#endif
+
+    ImGui::NextColumn();
+    ImGui::AlignTextToFramePadding();
+    if (const char *description = tree.getDescription(nodeIndex))
+    {
+        ImGui::TextDisabled("%s", description);
+        ImGui::SameLine();
+    }
+    if (definition.type == CompiledBehaviorTree::NodeType::WAIT)
+    {
+        const float seconds = tree.getWaitSeconds(nodeIndex);
+        if (seconds >= 0.0f)
+        {
+            ImGui::Text("%.2fs", seconds);
+        }
+        else
+        {
+            ImGui::TextDisabled("Until abort");
+        }
+    }
+#ifndef NDEBUG
+    else if (definition.type == CompiledBehaviorTree::NodeType::REPEATER)
+    {
+        ImGui::Text("%dx", instance.getTimesRepeated(nodeIndex));
+    }
+#endif
+
+    ImGui::NextColumn();
+
+    if (bNodeOpen)
+    {
+        for (uint16 i = 0; i < definition.numChildren; i++)
+        {
+            drawCompiledNode(instance, definition.firstChild + i, depth + 1u);
+        }
+        ImGui::TreePop();
+    }
+    ImGui::PopID();
+}
@@ -2,7 +2,7 @@
 #ifndef GAME_BEHAVIORTREEINSPECTOR_H
 #define GAME_BEHAVIORTREEINSPECTOR_H
 
-#include "BehaviorTree.h"
+#include "CompiledBehaviorTree.h"
 
 class EntityEngine;
 
@@ -17,6 +17,8 @@ class BehaviorTreeInspector
 
     void drawNode(BehaviorTree::Node *node, uint depth);
 
+    void drawCompiledNode(const CompiledBehaviorTree::Instance &instance, uint16 nodeIndex, uint depth);
+
     EntityEngine *engine;
     entt::entity entity;
 };
@@ -0,0 +1,173 @@
+
+#include "BehaviorTreeTrace.h"
+#include "BehaviorTree.h"
+#include "CompiledBehaviorTree.h"
+
+#include "../../generated/Brain.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+
+std::string getNodeErrorInfo(BehaviorTree::Node *node);
+
+static uint64_t getTraceNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BehaviorTreeTrace::setEnabled(bool inEnabled, uint32_t capacity)
+{
+    bEnabled = inEnabled;
+    if (!bEnabled)
+    {
+        return;
+    }
+    uint32_t powerOfTwoCapacity = 1;
+    while (powerOfTwoCapacity < capacity)
+    {
+        powerOfTwoCapacity <<= 1u;
+    }
+    events.clear();
+    events.resize(powerOfTwoCapacity);
+    events.shrink_to_fit();
+    numRecorded = 0;
+    startTime = getTraceNanoseconds();
+}
+
+std::vector<BehaviorTreeTrace::Event> BehaviorTreeTrace::getEvents() const
+{
+    std::vector<Event> ordered;
+    if (events.empty())
+    {
+        return ordered;
+    }
+    const uint64_t numAvailable = std::min<uint64_t>(numRecorded, events.size());
+    ordered.reserve(numAvailable);
+    for (uint64_t i = numRecorded - numAvailable; i < numRecorded; i++)
+    {
+        ordered.push_back(events[i & (events.size() - 1u)]);
+    }
+    return ordered;
+}
+
+void BehaviorTreeTrace::recordEnabled(entt::entity entity, uint32_t nodeId, EventType type, uint8_t result)
+{
+    Event &event = events[numRecorded++ & (events.size() - 1u)];
+    event.nanoseconds = getTraceNanoseconds() - startTime;
+    event.entity = entity;
+    event.nodeId = nodeId;
+    event.type = type;
+    event.result = result;
+}
+
+static std::string getTracedNodeInfo(EntityEngine &engine, entt::entity entity, uint32_t nodeId)
+{
+    const Brain *brain = engine.entities.valid(entity) ? engine.entities.try_get<Brain>(entity) : nullptr;
+    if (brain == nullptr)
+    {
+        return "?";
+    }
+    if (brain->compiledBehaviorTree)
+    {
+        const CompiledBehaviorTree &tree = brain->compiledBehaviorTree->getTree();
+        if (nodeId >= tree.getNodes().size())
+        {
+            return "?";
+        }
+        std::string info = tree.getNodeName(nodeId);
+        if (const char *sourceLocation = tree.getSourceLocation(nodeId))
+        {
+            info += "@";
+            info += sourceLocation;
+        }
+        return info;
+    }
+    if (BehaviorTree::Node *node = brain->behaviorTree.findTracedNode(nodeId))
+    {
+        return getNodeErrorInfo(node);
+    }
+    return "?";
+}
+
+bool BehaviorTreeTrace::dump(const char *path, EntityEngine &engine) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    const std::vector<Event> orderedEvents = getEvents();
+
+    struct NodeCounts
+    {
+        int enters = 0;
+        int aborts = 0;
+    };
+    std::map<std::pair<entt::entity, uint32_t>, NodeCounts> countsPerNode;
+    for (const Event &event : orderedEvents)
+    {
+        NodeCounts &counts = countsPerNode[{ event.entity, event.nodeId }];
+        if (event.type == EventType::ENTER)
+        {
+            counts.enters++;
+        }
+        else if (event.type == EventType::ABORT)
+        {
+            counts.aborts++;
+        }
+    }
+    std::vector<std::pair<std::pair<entt::entity, uint32_t>, NodeCounts>> mostEntered(countsPerNode.begin(), countsPerNode.end());
+    std::sort(mostEntered.begin(), mostEntered.end(), [] (const auto &a, const auto &b)
+    {
+        return a.second.enters + a.second.aborts > b.second.enters + b.second.aborts;
+    });
+    if (mostEntered.size() > 32)
+    {
+        mostEntered.resize(32);
+    }
+
+    file << "# " << orderedEvents.size() << " events";
+    if (numRecorded > orderedEvents.size())
+    {
+        file << " (" << numRecorded - orderedEvents.size() << " older events were overwritten)";
+    }
+    file << "\n# Most entered/aborted nodes: enters aborts entity node\n";
+    for (auto &[entityAndNode, counts] : mostEntered)
+    {
+        file << "# " << counts.enters << ' ' << counts.aborts << " #" << int(entityAndNode.first) << ' '
+            << getTracedNodeInfo(engine, entityAndNode.first, entityAndNode.second) << '\n';
+    }
+
+    file << "# microseconds entity event node\n";
+    for (const Event &event : orderedEvents)
+    {
+        file << event.nanoseconds / 1000 << " #" << int(event.entity) << ' ';
+        switch (event.type)
+        {
+            case EventType::ENTER:
+                file << "ENTER";
+                break;
+            case EventType::FINISH:
+                switch (BehaviorTree::Node::Result(event.result))
+                {
+                    case BehaviorTree::Node::Result::SUCCESS:
+                        file << "SUCCESS";
+                        break;
+                    case BehaviorTree::Node::Result::FAILURE:
+                        file << "FAILURE";
+                        break;
+                    case BehaviorTree::Node::Result::ABORTED:
+                        file << "ABORTED";
+                        break;
+                }
+                break;
+            case EventType::ABORT:
+                file << "ABORT";
+                break;
+        }
+        file << ' ' << event.nodeId << ' ' << getTracedNodeInfo(engine, event.entity, event.nodeId) << '\n';
+    }
+    return bool(file);
+}
@@ -0,0 +1,92 @@
+
+#ifndef GAME_BEHAVIORTREETRACE_H
+#define GAME_BEHAVIORTREETRACE_H
+
+#include "../../../external/entt/src/entt/entity/registry.hpp"
+
+#include <cstdint>
+#include <vector>
+
+class EntityEngine;
+
+/**
+ * Ring buffer of behavior tree events (enter/finish/abort) of all brains in one EntityEngine.
+ * Works in release builds too. Recording does nothing but a branch while disabled.
+ *
+ * Useful to find subtrees that thrash (entered and aborted over and over again).
+ */
+class BehaviorTreeTrace
+{
+  public:
+
+    enum class EventType : uint8_t
+    {
+        ENTER,
+        FINISH,
+        ABORT
+    };
+
+    struct Event
+    {
+        // since the trace was enabled.
+        uint64_t nanoseconds;
+        entt::entity entity;
+        // depth-first index for BehaviorTree nodes, node index for CompiledBehaviorTrees.
+        uint32_t nodeId;
+        EventType type;
+        // BehaviorTree::Node::Result, only for FINISH events.
+        uint8_t result;
+    };
+
+    /**
+     * Given to every node of a traced BehaviorTree.
+     */
+    struct Target
+    {
+        BehaviorTreeTrace *trace;
+        entt::entity entity;
+        uint32_t numNodes = 0;
+    };
+
+    /**
+     * Capacity is rounded up to a power of two. Enabling again clears the buffer.
+     */
+    void setEnabled(bool bEnabled, uint32_t capacity = 1u << 16u);
+
+    bool isEnabled() const
+    {
+        return bEnabled;
+    }
+
+    void record(entt::entity entity, uint32_t nodeId, EventType type, uint8_t result = 0)
+    {
+        if (bEnabled)
+        {
+            recordEnabled(entity, nodeId, type, result);
+        }
+    }
+
+    /**
+     * Oldest event first.
+     */
+    std::vector<Event> getEvents() const;
+
+    /**
+     * Writes a summary of the most entered/aborted nodes, followed by all events as text.
+     * Nodes are resolved to names if the entity still has the same brain.
+     * Returns false if the file could not be written.
+     */
+    bool dump(const char *path, EntityEngine &engine) const;
+
+  private:
+
+    void recordEnabled(entt::entity entity, uint32_t nodeId, EventType type, uint8_t result);
+
+    bool bEnabled = false;
+    std::vector<Event> events;
+    uint64_t numRecorded = 0;
+    uint64_t startTime = 0;
+};
+
+
+#endif //GAME_BEHAVIORTREETRACE_H
@@ -0,0 +1,590 @@
+
+#include "CompiledBehaviorTree.h"
+
+#include "../../ecs/systems/TimeOutSystem.h"
+
+#include <queue>
+
+std::string getNodeErrorInfo(BehaviorTree::Node *node);
+
+std::shared_ptr<const CompiledBehaviorTree> CompiledBehaviorTree::compile(const BehaviorTree::Node *root)
+{
+    if (root == nullptr)
+    {
+        throw gu_err("Cannot compile a behavior tree without root node");
+    }
+    auto tree = std::make_shared<CompiledBehaviorTree>();
+
+    // Breadth first, so that the children of each node end up next to each other:
+    struct ToVisit
+    {
+        const BehaviorTree::Node *node;
+        uint16 nodeIndex, parentIndex;
+    };
+    std::queue<ToVisit> toVisit;
+    toVisit.push({ root, 0, NO_NODE });
+    tree->nodes.emplace_back();
+
+    while (!toVisit.empty())
+    {
+        const auto [node, nodeIndex, parentIndex] = toVisit.front();
+        toVisit.pop();
+
+        NodeDefinition &definition = tree->nodes[nodeIndex];
+        definition.parent = parentIndex;
+
+        std::vector<const BehaviorTree::Node *> children;
+
+        if (auto composite = dynamic_cast<const BehaviorTree::CompositeNode *>(node))
+        {
+            if (dynamic_cast<const BehaviorTree::SequenceNode *>(node))
+                definition.type = NodeType::SEQUENCE;
+            else if (dynamic_cast<const BehaviorTree::SelectorNode *>(node))
+                definition.type = NodeType::SELECTOR;
+            else if (dynamic_cast<const BehaviorTree::ParallelNode *>(node))
+                definition.type = NodeType::PARALLEL;
+            else
+                throw gu_err("Node cannot be compiled: " + getNodeErrorInfo((BehaviorTree::Node *) node));
+
+            children.assign(composite->getChildren().begin(), composite->getChildren().end());
+        }
+        else if (auto decorator = dynamic_cast<const BehaviorTree::DecoratorNode *>(node))
+        {
+            if (dynamic_cast<const BehaviorTree::InverterNode *>(node))
+                definition.type = NodeType::INVERTER;
+            else if (dynamic_cast<const BehaviorTree::SucceederNode *>(node))
+                definition.type = NodeType::SUCCEEDER;
+            else if (dynamic_cast<const BehaviorTree::RepeaterNode *>(node))
+                definition.type = NodeType::REPEATER;
+            else
+                throw gu_err("Node cannot be compiled: " + getNodeErrorInfo((BehaviorTree::Node *) node));
+
+            if (decorator->getChild() == nullptr)
+                throw gu_err("Decorator has no child: " + getNodeErrorInfo((BehaviorTree::Node *) node));
+            children.push_back(decorator->getChild());
+        }
+        else if (auto wait = dynamic_cast<const BehaviorTree::WaitNode *>(node))
+        {
+            definition.type = NodeType::WAIT;
+            definition.dataIndex = uint16(tree->waitSeconds.size());
+            tree->waitSeconds.push_back(wait->seconds);
+        }
+        else if (auto luaLeaf = dynamic_cast<const BehaviorTree::LuaLeafNode *>(node))
+        {
+            definition.type = NodeType::LUA_LEAF;
+            definition.dataIndex = uint16(tree->luaLeafFunctions.size());
+            tree->luaLeafFunctions.push_back({ luaLeaf->luaEnterFunction, luaLeaf->luaAbortFunction });
+        }
+        else
+        {
+            throw gu_err("Node cannot be compiled: " + getNodeErrorInfo((BehaviorTree::Node *) node));
+        }
+
+        if (!node->description.empty())
+        {
+            definition.description = tree->addString(node->description);
+        }
+        if (node->hasLuaDebugInfo())
+        {
+            definition.sourceLocation = tree->addString(node->getLuaSourceLocation());
+        }
+
+        if (!children.empty())
+        {
+            if (tree->nodes.size() + children.size() >= NO_NODE)
+            {
+                throw gu_err("Behavior tree has too many nodes to compile");
+            }
+            // `definition` might be invalidated by emplace_back():
+            tree->nodes[nodeIndex].firstChild = uint16(tree->nodes.size());
+            tree->nodes[nodeIndex].numChildren = uint16(children.size());
+
+            for (const BehaviorTree::Node *child : children)
+            {
+                toVisit.push({ child, uint16(tree->nodes.size()), nodeIndex });
+                tree->nodes.emplace_back();
+            }
+        }
+    }
+    tree->nodes.shrink_to_fit();
+    tree->stringPool.shrink_to_fit();
+    return tree;
+}
+
+const std::vector<CompiledBehaviorTree::NodeDefinition> &CompiledBehaviorTree::getNodes() const
+{
+    return nodes;
+}
+
+const char *CompiledBehaviorTree::getNodeName(uint16 nodeIndex) const
+{
+    switch (nodes.at(nodeIndex).type)
+    {
+        case NodeType::SEQUENCE: return "Sequence";
+        case NodeType::SELECTOR: return "Selector";
+        case NodeType::PARALLEL: return "Parallel";
+        case NodeType::INVERTER: return "Inverter";
+        case NodeType::SUCCEEDER: return "Succeeder";
+        case NodeType::REPEATER: return "Repeater";
+        case NodeType::WAIT: return "Wait";
+        case NodeType::LUA_LEAF: return "LuaLeaf";
+    }
+    return "?";
+}
+
+const char *CompiledBehaviorTree::getDescription(uint16 nodeIndex) const
+{
+    const int offset = nodes.at(nodeIndex).description;
+    return offset >= 0 ? &stringPool[offset] : nullptr;
+}
+
+const char *CompiledBehaviorTree::getSourceLocation(uint16 nodeIndex) const
+{
+    const int offset = nodes.at(nodeIndex).sourceLocation;
+    return offset >= 0 ? &stringPool[offset] : nullptr;
+}
+
+float CompiledBehaviorTree::getWaitSeconds(uint16 nodeIndex) const
+{
+    const NodeDefinition &definition = nodes.at(nodeIndex);
+    return definition.type == NodeType::WAIT ? waitSeconds[definition.dataIndex] : -1.0f;
+}
+
+int CompiledBehaviorTree::addString(const std::string &str)
+{
+    const int offset = int(stringPool.size());
+    stringPool.insert(stringPool.end(), str.begin(), str.end());
+    stringPool.push_back('\0');
+    return offset;
+}
+
+void CompiledBehaviorTree::LeafHandle::finish(Result result) const
+{
+    std::shared_ptr<Instance> lockedInstance = instance.lock();
+    if (!lockedInstance || !isEntered())
+    {
+        return; // the node was aborted (or the entity destroyed) while the Lua code was still busy.
+    }
+    lockedInstance->finish(nodeIndex, result);
+}
+
+entt::entity CompiledBehaviorTree::LeafHandle::getEntity() const
+{
+    std::shared_ptr<Instance> lockedInstance = instance.lock();
+    return lockedInstance ? lockedInstance->getEntity() : entt::null;
+}
+
+bool CompiledBehaviorTree::LeafHandle::isEntered() const
+{
+    std::shared_ptr<Instance> lockedInstance = instance.lock();
+    return lockedInstance && lockedInstance->isEntered(nodeIndex) && lockedInstance->states[nodeIndex].entryId == entryId;
+}
+
+CompiledBehaviorTree::Instance::Instance(std::shared_ptr<const CompiledBehaviorTree> inTree, EntityEngine *engine,
+    entt::entity entity) :
+    tree(std::move(inTree)),
+    engine(engine),
+    entity(entity)
+{
+    states.resize(tree->nodes.size());
+    waitTimers.resize(tree->waitSeconds.size());
+}
+
+const CompiledBehaviorTree &CompiledBehaviorTree::Instance::getTree() const
+{
+    return *tree;
+}
+
+entt::entity CompiledBehaviorTree::Instance::getEntity() const
+{
+    return entity;
+}
+
+void CompiledBehaviorTree::Instance::enterRoot()
+{
+    if (!tree->nodes.empty())
+    {
+        std::shared_ptr<Instance> keepAlive = shared_from_this();
+        enter(0);
+    }
+}
+
+void CompiledBehaviorTree::Instance::setTrace(BehaviorTreeTrace *inTrace)
+{
+    trace = inTrace;
+}
+
+bool CompiledBehaviorTree::Instance::isEntered(uint16 nodeIndex) const
+{
+    return states.at(nodeIndex).flags & ENTERED;
+}
+
+bool CompiledBehaviorTree::Instance::isAborted(uint16 nodeIndex) const
+{
+    return states.at(nodeIndex).flags & ABORTED;
+}
+
+#ifndef NDEBUG
+bool CompiledBehaviorTree::Instance::hasFinishedAtLeastOnce(uint16 nodeIndex) const
+{
+    return states.at(nodeIndex).flags & FINISHED_AT_LEAST_ONCE;
+}
+
+CompiledBehaviorTree::Result CompiledBehaviorTree::Instance::getLastResult(uint16 nodeIndex) const
+{
+    return states.at(nodeIndex).lastResult;
+}
+
+int CompiledBehaviorTree::Instance::getTimesRepeated(uint16 nodeIndex) const
+{
+    return tree->nodes.at(nodeIndex).type == NodeType::REPEATER ? states[nodeIndex].cursor : 0;
+}
+#endif
+
+void CompiledBehaviorTree::Instance::enter(uint16 nodeIndex)
+{
+    const NodeDefinition &definition = tree->nodes[nodeIndex];
+    NodeState &state = states[nodeIndex];
+
+    if (state.flags & ENTERED)
+    {
+        throw gu_err("Already entered: " + getNodeErrorInfo(nodeIndex));
+    }
+#ifndef NDEBUG
+    if (definition.parent != NO_NODE && !isEntered(definition.parent))
+    {
+        throw gu_err("Cannot enter a child whose parent was not entered!");
+    }
+#endif
+    state.flags |= ENTERED;
+    state.entryId++;
+    state.cursor = 0;
+    if (trace != nullptr)
+    {
+        trace->record(entity, nodeIndex, BehaviorTreeTrace::EventType::ENTER);
+    }
+
+    switch (definition.type)
+    {
+        case NodeType::SEQUENCE:
+        case NodeType::SELECTOR:
+        case NodeType::INVERTER:
+        case NodeType::SUCCEEDER:
+        case NodeType::REPEATER:
+            if (definition.numChildren == 0)
+            {
+                finish(nodeIndex, Result::SUCCESS);
+            }
+            else
+            {
+                enter(definition.firstChild);
+            }
+            break;
+        case NodeType::PARALLEL:
+            if (definition.numChildren == 0)
+            {
+                finish(nodeIndex, Result::SUCCESS);
+                break;
+            }
+            for (uint16 i = 0; i < definition.numChildren; i++)
+            {
+                enter(definition.firstChild + i);
+            }
+            break;
+        case NodeType::WAIT:
+        {
+            const float seconds = tree->waitSeconds[definition.dataIndex];
+            if (seconds >= 0.0f)
+            {
+                if (!engine->entities.valid(entity))
+                {
+                    throw gu_err("Entity #" + std::to_string(int(entity)) + " is not valid!\n" + getNodeErrorInfo(nodeIndex));
+                }
+                waitTimers[definition.dataIndex] = engine->getTimeOuts()->unsafeCallAfter(seconds, entity, [this, nodeIndex]
+                {
+                    std::shared_ptr<Instance> keepAlive = shared_from_this();
+                    finish(nodeIndex, Result::SUCCESS);
+                });
+            }
+            break;
+        }
+        case NodeType::LUA_LEAF:
+        {
+            const LuaLeafFunctions &functions = tree->luaLeafFunctions[definition.dataIndex];
+            if (!functions.enter.valid())
+            {
+                std::cerr << "LuaLeafNode::enter failed because no enter function was set! " << getNodeErrorInfo(nodeIndex) << std::endl;
+                finish(nodeIndex, Result::FAILURE);
+                break;
+            }
+            // keep this instance alive, in case the Lua function destroys the entity:
+            std::shared_ptr<Instance> keepAlive = shared_from_this();
+
+            state.flags |= IN_ENTER_FUNCTION;
+            sol::protected_function_result result = functions.enter(createLeafHandle(nodeIndex));
+
+            if (!result.valid())
+            {
+                std::cerr << "LuaLeafNode::enter failed for: " << getNodeErrorInfo(nodeIndex) << "\n" << result.get<sol::error>().what() << std::endl;
+
+                if (isEntered(nodeIndex))
+                {
+                    // note: will be ignored in case we're aborted and because IN_ENTER_FUNCTION is still set!
+                    finish(nodeIndex, Result::FAILURE);
+                }
+            }
+            states[nodeIndex].flags &= ~IN_ENTER_FUNCTION;
+
+            if (isAborted(nodeIndex))
+            {
+                finishLeafAborted(nodeIndex);
+            }
+            break;
+        }
+    }
+}
+
+void CompiledBehaviorTree::Instance::abort(uint16 nodeIndex)
+{
+    const NodeDefinition &definition = tree->nodes[nodeIndex];
+    NodeState &state = states[nodeIndex];
+#ifndef NDEBUG
+    if (!(state.flags & ENTERED))
+    {
+        throw gu_err("Cannot abort a non-entered Node: " + getNodeErrorInfo(nodeIndex));
+    }
+    if (state.flags & ABORTED)
+    {
+        throw gu_err("Cannot abort a Node again: " + getNodeErrorInfo(nodeIndex));
+    }
+#endif
+    state.flags |= ABORTED;
+    if (trace != nullptr)
+    {
+        trace->record(entity, nodeIndex, BehaviorTreeTrace::EventType::ABORT);
+    }
+
+    switch (definition.type)
+    {
+        case NodeType::SEQUENCE:
+        case NodeType::SELECTOR:
+            abort(definition.firstChild + state.cursor);
+            break;
+        case NodeType::PARALLEL:
+            for (uint16 i = 0; i < definition.numChildren; i++)
+            {
+                if (isEntered(definition.firstChild + i))
+                {
+                    abort(definition.firstChild + i);
+                }
+            }
+            break;
+        case NodeType::INVERTER:
+        case NodeType::SUCCEEDER:
+        case NodeType::REPEATER:
+            if (isEntered(definition.firstChild))
+            {
+                abort(definition.firstChild);
+            }
+            else
+            {
+                finish(nodeIndex, Result::ABORTED);
+            }
+            break;
+        case NodeType::WAIT:
+            finish(nodeIndex, Result::ABORTED);
+            break;
+        case NodeType::LUA_LEAF:
+            if (!(state.flags & IN_ENTER_FUNCTION))
+            {
+                finishLeafAborted(nodeIndex);
+            }
+            break;
+    }
+}
+
+void CompiledBehaviorTree::Instance::finish(uint16 nodeIndex, Result result)
+{
+    const NodeDefinition &definition = tree->nodes[nodeIndex];
+    NodeState &state = states[nodeIndex];
+
+    if (definition.type == NodeType::LUA_LEAF && (state.flags & IN_ENTER_FUNCTION) && (state.flags & ABORTED))
+    {
+        // ignore this result. We'll abort after the enter function is done ;)
+        return;
+    }
+#ifndef NDEBUG
+    if (!(state.flags & ENTERED))
+    {
+        throw gu_err("Cannot finish a non-entered Node: " + getNodeErrorInfo(nodeIndex));
+    }
+    for (uint16 i = 0; i < definition.numChildren; i++)
+    {
+        if (isEntered(definition.firstChild + i))
+        {
+            throw gu_err(getNodeErrorInfo(nodeIndex) + " wants to finish, but child " + getNodeErrorInfo(definition.firstChild + i) + " is entered!");
+        }
+    }
+#endif
+    if ((state.flags & ABORTED) && result != Result::ABORTED)
+    {
+        throw gu_err("Cannot finish an aborted Node with an result other than ABORTED: " + getNodeErrorInfo(nodeIndex));
+    }
+    if (definition.type == NodeType::WAIT)
+    {
+        waitTimers[definition.dataIndex].reset();
+    }
+    state.flags &= ~(ENTERED | ABORTED);
+    state.flags |= FINISHED_AT_LEAST_ONCE;
+    state.lastResult = result;
+    if (trace != nullptr)
+    {
+        trace->record(entity, nodeIndex, BehaviorTreeTrace::EventType::FINISH, uint8_t(result));
+    }
+
+    if (definition.parent != NO_NODE)
+    {
+        onChildFinished(definition.parent, result);
+    }
+}
+
+void CompiledBehaviorTree::Instance::onChildFinished(uint16 nodeIndex, Result result)
+{
+    const NodeDefinition &definition = tree->nodes[nodeIndex];
+    NodeState &state = states[nodeIndex];
+
+    if (!(state.flags & ENTERED))
+    {
+        throw gu_err("Child finished, but parent (" + getNodeErrorInfo(nodeIndex) + ") was not entered!");
+    }
+
+    switch (definition.type)
+    {
+        case NodeType::SEQUENCE:
+        case NodeType::SELECTOR:
+        {
+            // a Sequence continues on success, a Selector on failure:
+            const Result continueOn = definition.type == NodeType::SEQUENCE ? Result::SUCCESS : Result::FAILURE;
+            if (result != continueOn)
+            {
+                finish(nodeIndex, result);
+            }
+            else if (++state.cursor == definition.numChildren)
+            {
+                finish(nodeIndex, continueOn);
+            }
+            else
+            {
+                enter(definition.firstChild + state.cursor);
+            }
+            break;
+        }
+        case NodeType::PARALLEL:
+            if (++state.cursor == definition.numChildren)
+            {
+                finish(nodeIndex, (state.flags & ABORTED) ? Result::ABORTED : Result::SUCCESS);
+            }
+            break;
+        case NodeType::INVERTER:
+            if (result == Result::ABORTED)
+            {
+                finish(nodeIndex, Result::ABORTED);
+            }
+            else
+            {
+                finish(nodeIndex, result == Result::SUCCESS ? Result::FAILURE : Result::SUCCESS);
+            }
+            break;
+        case NodeType::SUCCEEDER:
+            finish(nodeIndex, result == Result::ABORTED ? Result::ABORTED : Result::SUCCESS);
+            break;
+        case NodeType::REPEATER:
+            switch (result)
+            {
+                case Result::SUCCESS:
+                    state.cursor++;
+                    enter(definition.firstChild);
+                    break;
+                case Result::FAILURE:
+                    finish(nodeIndex, Result::SUCCESS);
+                    break;
+                case Result::ABORTED:
+                    finish(nodeIndex, Result::ABORTED);
+                    break;
+            }
+            break;
+        case NodeType::WAIT:
+        case NodeType::LUA_LEAF:
+            break;
+    }
+}
+
+void CompiledBehaviorTree::Instance::finishLeafAborted(uint16 nodeIndex)
+{
+    const LuaLeafFunctions &functions = tree->luaLeafFunctions[tree->nodes[nodeIndex].dataIndex];
+    if (functions.abort.valid())
+    {
+        std::shared_ptr<Instance> keepAlive = shared_from_this();
+        sol::protected_function_result result = functions.abort(createLeafHandle(nodeIndex));
+
+        if (!result.valid())
+        {
+            std::cerr << "LuaLeafNode::abort failed for: " << getNodeErrorInfo(nodeIndex) << "\n" << result.get<sol::error>().what() << std::endl;
+
+            if (isAborted(nodeIndex))
+            {
+                finish(nodeIndex, Result::ABORTED);
+            }
+        }
+    }
+    else
+    {
+        finish(nodeIndex, Result::ABORTED);
+    }
+}
+
+CompiledBehaviorTree::LeafHandle CompiledBehaviorTree::Instance::createLeafHandle(uint16 nodeIndex)
+{
+    return { weak_from_this(), nodeIndex, states[nodeIndex].entryId };
+}
+
+std::string CompiledBehaviorTree::Instance::getNodeErrorInfo(uint16 nodeIndex) const
+{
+    std::string info = tree->getNodeName(nodeIndex);
+    if (const char *sourceLocation = tree->getSourceLocation(nodeIndex))
+    {
+        info += "@";
+        info += sourceLocation;
+    }
+    return info;
+}
+
+void CompiledBehaviorTree::addToLuaEnvironment(sol::state *lua)
+{
+    lua->new_usertype<CompiledBehaviorTree>(
+        "BTCompiledTree",
+        "getNumNodes", [] (const CompiledBehaviorTree &tree)
+        {
+            return int(tree.nodes.size());
+        }
+    );
+
+    lua->new_usertype<CompiledBehaviorTree::LeafHandle>(
+        "BTCompiledLeaf",
+        "finish", &CompiledBehaviorTree::LeafHandle::finish,
+        "getEntity", &CompiledBehaviorTree::LeafHandle::getEntity,
+        "isEntered", &CompiledBehaviorTree::LeafHandle::isEntered
+    );
+
+    (*lua)["compileBehaviorTree"] = [] (BehaviorTree::Node *root) -> std::shared_ptr<CompiledBehaviorTree>
+    {
+        if (root == nullptr)
+        {
+            throw gu_err("Cannot compile a behavior tree without root node");
+        }
+        // The tree is only borrowed: Lua can still use it, for example to give it to a Brain, or it might be a subtree owned by another node.
+        std::shared_ptr<const CompiledBehaviorTree> compiled = compile(root);
+        // non-const for sol2, Lua can't modify it anyway.
+        return std::const_pointer_cast<CompiledBehaviorTree>(compiled);
+    };
+}
@@ -0,0 +1,180 @@
+
+#ifndef GAME_COMPILEDBEHAVIORTREE_H
+#define GAME_COMPILEDBEHAVIORTREE_H
+
+#include "BehaviorTree.h"
+
+/**
+ * An immutable, flattened copy of a behavior tree that can be shared by all entities that use the same brain.
+ *
+ * The nodes are stored breadth first in one contiguous array, so the children of a node are always next to each other.
+ * Each entity only owns an Instance: a small block of state per node (entered/aborted flags, child cursor, timers).
+ *
+ * Supported nodes: Sequence, Selector, Parallel, Inverter, Succeeder, Repeater, Wait and LuaLeaf.
+ * Lua leaf functions are shared by all instances, so instead of capturing the entity they should use `node:getEntity()`.
+ */
+class CompiledBehaviorTree
+{
+  public:
+
+    using Result = BehaviorTree::Node::Result;
+
+    enum class NodeType : uint8
+    {
+        SEQUENCE,
+        SELECTOR,
+        PARALLEL,
+        INVERTER,
+        SUCCEEDER,
+        REPEATER,
+        WAIT,
+        LUA_LEAF
+    };
+
+    constexpr static uint16 NO_NODE = uint16(-1);
+
+    struct NodeDefinition
+    {
+        NodeType type;
+        uint16 parent = NO_NODE;
+        uint16 firstChild = NO_NODE;
+        uint16 numChildren = 0;
+        // index into waitSeconds or luaLeafFunctions, depending on the type.
+        uint16 dataIndex = NO_NODE;
+        // offsets into the string pool, -1 if not set.
+        int description = -1;
+        int sourceLocation = -1;
+    };
+
+    struct LuaLeafFunctions
+    {
+        sol::function enter, abort;
+    };
+
+    /**
+     * Flattens a tree that was built with BehaviorTree::Node classes.
+     * Throws if the tree contains nodes that are not supported, or if it's too big.
+     * The given tree is not modified.
+     */
+    static std::shared_ptr<const CompiledBehaviorTree> compile(const BehaviorTree::Node *root);
+
+    const std::vector<NodeDefinition> &getNodes() const;
+
+    const char *getNodeName(uint16 nodeIndex) const;
+
+    // returns nullptr if the node has no description/source location.
+    const char *getDescription(uint16 nodeIndex) const;
+
+    const char *getSourceLocation(uint16 nodeIndex) const;
+
+    float getWaitSeconds(uint16 nodeIndex) const;
+
+    class Instance;
+
+    /**
+     * Given to Lua leaf functions instead of a node. Stays safe to use after the node finished or the entity was destroyed.
+     */
+    struct LeafHandle
+    {
+        std::weak_ptr<Instance> instance;
+        uint16 nodeIndex = NO_NODE;
+        uint32 entryId = 0;
+
+        void finish(Result result) const;
+
+        // returns entt::null if the instance does not exist anymore.
+        entt::entity getEntity() const;
+
+        bool isEntered() const;
+    };
+
+    /**
+     * The per-entity state of a compiled tree.
+     */
+    class Instance : public std::enable_shared_from_this<Instance>
+    {
+      public:
+
+        Instance(std::shared_ptr<const CompiledBehaviorTree> tree, EntityEngine *engine, entt::entity entity);
+
+        const CompiledBehaviorTree &getTree() const;
+
+        entt::entity getEntity() const;
+
+        void enterRoot();
+
+        // Records the enter/finish/abort events of this instance. Node ids are node indices.
+        void setTrace(BehaviorTreeTrace *trace);
+
+        bool isEntered(uint16 nodeIndex) const;
+
+        bool isAborted(uint16 nodeIndex) const;
+
+#ifndef NDEBUG
+        bool hasFinishedAtLeastOnce(uint16 nodeIndex) const;
+
+        Result getLastResult(uint16 nodeIndex) const;
+
+        int getTimesRepeated(uint16 nodeIndex) const;
+#endif
+
+      private:
+        friend LeafHandle;
+
+        enum StateFlags : uint8
+        {
+            ENTERED = 1u << 0u,
+            ABORTED = 1u << 1u,
+            IN_ENTER_FUNCTION = 1u << 2u,
+            FINISHED_AT_LEAST_ONCE = 1u << 3u
+        };
+
+        struct NodeState
+        {
+            uint8 flags = 0;
+            Result lastResult = Result::SUCCESS;
+            // current child for Sequence/Selector, finished children for Parallel, repetitions for Repeater.
+            uint16 cursor = 0;
+            // increased on each enter, so that LeafHandles of a previous enter can be ignored.
+            uint32 entryId = 0;
+        };
+
+        void enter(uint16 nodeIndex);
+
+        void abort(uint16 nodeIndex);
+
+        void finish(uint16 nodeIndex, Result result);
+
+        void onChildFinished(uint16 nodeIndex, Result result);
+
+        void finishLeafAborted(uint16 nodeIndex);
+
+        LeafHandle createLeafHandle(uint16 nodeIndex);
+
+        std::string getNodeErrorInfo(uint16 nodeIndex) const;
+
+        std::shared_ptr<const CompiledBehaviorTree> tree;
+        EntityEngine *engine;
+        entt::entity entity;
+
+        std::vector<NodeState> states;
+        std::vector<delegate_method> waitTimers;
+
+        BehaviorTreeTrace *trace = nullptr;
+    };
+
+  private:
+
+    int addString(const std::string &);
+
+    std::vector<NodeDefinition> nodes;
+    std::vector<char> stringPool;
+    std::vector<float> waitSeconds;
+    std::vector<LuaLeafFunctions> luaLeafFunctions;
+
+  public:
+    static void addToLuaEnvironment(sol::state *lua);
+};
+
+
+#endif //GAME_COMPILEDBEHAVIORTREE_H
@@ -0,0 +1,115 @@
+#include "EntityCommandBuffer.h"
+#include "EntityEngine.h"
+
+#include <iostream>
+
+void setComponentFromLua(entt::entity entity, const sol::table &component, entt::registry &reg);
+
+EntityCommandBuffer::EntityCommandBuffer(EntityEngine &engine, entt::registry &registry) :
+    engine(engine),
+    registry(registry)
+{
+}
+
+entt::entity EntityCommandBuffer::create()
+{
+    if (std::this_thread::get_id() != mainThread)
+    {
+        throw gu_err("EntityCommandBuffer::create() can only be called on the main thread, record() a command that creates the entity instead.");
+    }
+    return registry.create();
+}
+
+void EntityCommandBuffer::destroy(entt::entity e)
+{
+    record([this, e]
+    {
+        if (registry.valid(e))
+        {
+            registry.destroy(e);
+        }
+    });
+}
+
+void EntityCommandBuffer::setComponentFromLua(entt::entity e, const sol::table &component)
+{
+    record([this, e, component]
+    {
+        if (registry.valid(e))
+        {
+            ::setComponentFromLua(e, component, registry);
+        }
+    });
+}
+
+void EntityCommandBuffer::applyTemplate(entt::entity e, const std::string &templateName,
+    const sol::optional<sol::table> &arguments, bool bPersistent)
+{
+    // look up the template now, so that a typo results in an error at the line that made it:
+    EntityTemplate *entityTemplate = &engine.getTemplate(templateName);
+    record([this, e, entityTemplate, arguments, bPersistent]
+    {
+        if (registry.valid(e))
+        {
+            engine.applyTemplate(e, *entityTemplate, arguments, bPersistent);
+        }
+    });
+}
+
+void EntityCommandBuffer::record(std::function<void()> command)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    commands.push_back(std::move(command));
+}
+
+void EntityCommandBuffer::flush()
+{
+    if (bFlushing)
+    {
+        return; // commands recorded by commands are played back by the outer flush().
+    }
+    bFlushing = true;
+    struct FlushScope
+    {
+        EntityCommandBuffer *buffer;
+
+        ~FlushScope()
+        {
+            buffer->flushing.clear();
+            buffer->bFlushing = false;
+        }
+    };
+    FlushScope flushScope { this };
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (commands.empty())
+            {
+                break;
+            }
+            flushing.clear();
+            flushing.swap(commands);
+        }
+        for (auto &command : flushing)
+        {
+            // one failing command should not prevent the others (e.g. destroying entities) from being played back.
+            try
+            {
+                command();
+            }
+            catch (std::exception &exc)
+            {
+                std::cerr << "Error while playing back a command of the EntityCommandBuffer:" << std::endl;
+                std::cerr << exc.what() << std::endl;
+            }
+        }
+    }
+}
+
+bool EntityCommandBuffer::empty() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return commands.empty();
+}
@@ -0,0 +1,97 @@
+
+#ifndef GAME_ENTITYCOMMANDBUFFER_H
+#define GAME_ENTITYCOMMANDBUFFER_H
+
+#include "../luau.h"
+
+#include "../../external/entt/src/entt/entity/registry.hpp"
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class EntityEngine;
+
+/**
+ * Records structural changes (destroying entities, adding/removing components, applying templates),
+ * to play them back later, in order. Useful while iterating a view, which would be invalidated by these changes.
+ *
+ * Every EntityEngine has one, which is flushed after each system update.
+ * Recording is thread-safe, so systems that do work on other threads can use it too. Creating entities and flushing is not.
+ */
+class EntityCommandBuffer
+{
+  public:
+
+    EntityCommandBuffer(EntityEngine &engine, entt::registry &registry);
+
+    /**
+     * Creates the entity right away (this does not invalidate component views), without any components.
+     * Only allowed on the thread that constructed the EntityEngine, because the registry is not thread-safe.
+     * Other threads can record() a command that creates the entity instead.
+     */
+    entt::entity create();
+
+    void destroy(entt::entity);
+
+    template<class Component>
+    void assign(entt::entity e, Component component)
+    {
+        record([this, e, component = std::move(component)] () mutable
+        {
+            if (registry.valid(e))
+            {
+                registry.assign_or_replace<Component>(e, std::move(component));
+            }
+        });
+    }
+
+    template<class Component>
+    void remove(entt::entity e)
+    {
+        record([this, e]
+        {
+            if (registry.valid(e))
+            {
+                registry.remove_if_exists<Component>(e);
+            }
+        });
+    }
+
+    /**
+     * `component` should be a component created in Lua, like `Position3d { vec = vec3(1) }`.
+     */
+    void setComponentFromLua(entt::entity, const sol::table &component);
+
+    void applyTemplate(entt::entity, const std::string &templateName, const sol::optional<sol::table> &arguments,
+        bool bPersistent);
+
+    /**
+     * For anything else. The command is responsible for checking whether its entities are still valid.
+     */
+    void record(std::function<void()> command);
+
+    /**
+     * Plays back all commands, including the ones recorded by the commands themselves.
+     * A command that throws is reported to std::cerr, the other commands are still played back.
+     */
+    void flush();
+
+    bool empty() const;
+
+  private:
+
+    EntityEngine &engine;
+    entt::registry &registry;
+
+    std::vector<std::function<void()>> commands;
+    // swapped with `commands` while flushing, to keep the allocation.
+    std::vector<std::function<void()>> flushing;
+    mutable std::mutex mutex;
+    bool bFlushing = false;
+    const std::thread::id mainThread = std::this_thread::get_id();
+};
+
+
+#endif //GAME_ENTITYCOMMANDBUFFER_H
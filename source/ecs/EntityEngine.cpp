@@ -4,11 +4,14 @@
 #include "systems/KeyEventsSystem.h"
 #include "systems/AnimationSystem.h"
 #include "systems/TimeOutSystem.h"
+#include "systems/TransformSystem.h"
+#include "systems/SpatialIndexSystem.h"
 #include "entity_templates/LuaEntityTemplate.h"
 
 #include "../generated/Children.hpp"
 #include "../generated/Position3d.hpp"
 #include "../generated/LuaScripted.hpp"
+#include "../generated/Saving.hpp"
 
 #include <gu/profiler.h>
 #include <utils/string_utils.h>
@@ -27,23 +30,40 @@ TimeOutSystem *EntityEngine::getTimeOuts()
     return timeOutSystem;
 }
 
-EntityTemplate &EntityEngine::getTemplate(std::string name)
+TransformSystem *EntityEngine::getTransforms()
 {
-    try {
-        return getTemplate(hashStringCrossPlatform(name));
-    }
-    catch (_gu_err &)
-    {
+    return transformSystem;
+}
+
+SpatialIndexSystem *EntityEngine::getSpatialIndex()
+{
+    return spatialIndexSystem;
+}
+
+EntityTemplate &EntityEngine::getTemplate(const std::string &name)
+{
+    auto it = entityTemplates.find(hashStringCrossPlatform(name));
+    if (it == entityTemplates.end())
         throw gu_err("No EntityTemplate named " + name + " found");
-    }
+    return *it->second;
 }
 
 EntityTemplate &EntityEngine::getTemplate(int templateHash)
 {
-    auto t = entityTemplates[templateHash];
-    if (!t)
+    auto it = entityTemplates.find(templateHash);
+    if (it == entityTemplates.end())
         throw gu_err("No EntityTemplate found for hash " + std::to_string(templateHash));
-    return *t;
+    return *it->second;
+}
+
+EntityTemplate &EntityEngine::getTemplate(const TemplateHandle &handle)
+{
+    if (handle.cachedVersion != templatesVersion || handle.cachedTemplate == nullptr)
+    {
+        handle.cachedTemplate = &getTemplate(handle.templateHash);
+        handle.cachedVersion = templatesVersion;
+    }
+    return *handle.cachedTemplate;
 }
 
 const std::vector<std::string> &EntityEngine::getTemplateNames() const
@@ -51,15 +71,49 @@ const std::vector<std::string> &EntityEngine::getTemplateNames() const
     return entityTemplateNames;
 }
 
+void EntityEngine::applyTemplate(entt::entity e, EntityTemplate &entityTemplate, const sol::optional<sol::table> &arguments,
+    bool persistent)
+{
+    if (LuaEntityTemplate *luaEntityTemplate = dynamic_cast<LuaEntityTemplate *>(&entityTemplate))
+        luaEntityTemplate->createComponentsWithLuaArguments(e, arguments, persistent);
+    else
+        entityTemplate.createComponents(e, persistent);
+}
+
 entt::entity EntityEngine::getChildByName(entt::entity parent, const char *childName)
 {
-    const Parent *p = entities.try_get<Parent>(parent);
-    if (!p)
-        return entt::null;
-    auto it = p->childrenByName.find(childName);
-    if (it == p->childrenByName.end())
+    return getChildByName(parent, NameSymbol::find(childName ? childName : ""));
+}
+
+entt::entity EntityEngine::getChildByName(entt::entity parent, const NameSymbol &childName) const
+{
+    if (childName.empty())
         return entt::null;
-    return it->second;
+    auto it = childrenByName.find(getChildNameKey(parent, childName));
+    return it == childrenByName.end() ? entt::null : it->second;
+}
+
+entt::entity EntityEngine::getFirstChild(entt::entity parent) const
+{
+    const Parent *p = entities.try_get<Parent>(parent);
+    return p ? p->firstChild : entt::null;
+}
+
+entt::entity EntityEngine::getNextSibling(entt::entity child) const
+{
+    const Child *c = entities.try_get<Child>(child);
+    return c ? c->nextSibling : entt::null;
+}
+
+int EntityEngine::getNumChildren(entt::entity parent) const
+{
+    const Parent *p = entities.try_get<Parent>(parent);
+    return p ? p->numChildren : 0;
+}
+
+uint64 EntityEngine::getChildNameKey(entt::entity parent, const NameSymbol &childName)
+{
+    return (uint64(uint32(parent)) << 32u) | childName.getId();
 }
 
 void EntityEngine::registerLuaEntityTemplate(const char *assetPath)
@@ -71,16 +125,21 @@ void EntityEngine::registerLuaEntityTemplate(const char *assetPath)
     addEntityTemplate(name, new LuaEntityTemplate(assetPath, name.c_str(), this));
 }
 
+// shared by all engines, so that a TemplateHandle cached by one engine is never valid in another.
+static uint32 templatesVersionCounter = 0;
+
 void EntityEngine::addEntityTemplate(const std::string &name, EntityTemplate *t)
 {
     int hash = hashStringCrossPlatform(name);
 
-    bool replace = entityTemplates[hash] != nullptr;
+    EntityTemplate *&et = entityTemplates[hash];
+    bool replace = et != nullptr;
 
-    delete entityTemplates[hash];
-    auto et = entityTemplates[hash] = t;
+    delete et;
+    et = t;
     et->engine = this;
     et->templateHash = hash;
+    templatesVersion = ++templatesVersionCounter;
 
     if (!replace)
         entityTemplateNames.push_back(name);
@@ -101,7 +160,7 @@ bool EntityEngine::isDestructing() const
 }
 
 struct Named {
-    std::string name_dont_change;
+    NameSymbol name_dont_change;
 };
 
 void EntityEngine::initialize()
@@ -112,14 +171,23 @@ void EntityEngine::initialize()
     addSystem(new KeyEventsSystem("key listeners"));
     timeOutSystem = new TimeOutSystem("timeouts");
     addSystem(timeOutSystem);
+    transformSystem = new TransformSystem("transforms");
+    addSystem(transformSystem);
+    // after the transforms, so that children are put in the right cell:
+    spatialIndexSystem = new SpatialIndexSystem("spatial index");
+    addSystem(spatialIndexSystem);
 
     entities.on_construct<Child>().connect<&EntityEngine::onChildCreation>(this);
     entities.on_destroy<Child>().connect<&EntityEngine::onChildDeletion>(this);
+    entities.on_replace<Child>().connect<&EntityEngine::onChildReplacement>(this);
+    ComponentUtils::onFieldsChanged<Child>(entities).connect<&EntityEngine::onChildFieldsChanged>(this);
 
     entities.on_destroy<Parent>().connect<&EntityEngine::onParentDeletion>(this);
 
     entities.on_destroy<Named>().connect<&EntityEngine::onEntityDenaming>(this);
 
+    entities.on_destroy<Persistent>().connect<&PersistentEntities::onDestroyed>();
+
     initializeLuaEnvironment();
 
     std::map<std::string, bool> registered;
@@ -175,12 +243,13 @@ void EntityEngine::initializeLuaEnvironment()
     env["getName"] = [&](entt::entity e) -> sol::optional<std::string>
     {
         if (Named *named = entities.try_get<Named>(e))
-            return named->name_dont_change;
+            return named->name_dont_change.str();
         else return sol::nullopt;
     };
-    env["getByName"] = [&] (const char *name)
+    // accepts a string or a NameSymbol("name"). The latter does not need to be hashed again.
+    env["getByName"] = [&] (const NameSymbolQuery &name)
     {
-        return getByName(name);
+        return getByName(name.symbol);
     };
 
     // PersistentEntityRef
@@ -233,22 +302,79 @@ void EntityEngine::initializeLuaEnvironment()
     {
         return createChild(parentEntity, childName.value_or("").c_str());
     };
-    env["getChild"] = [&](entt::entity parentEntity, const char *childName) -> entt::entity
+    env["getChild"] = [&](entt::entity parentEntity, const NameSymbolQuery &childName) -> entt::entity
+    {
+        return getChildByName(parentEntity, childName.symbol);
+    };
+    env["getNumChildren"] = [&](entt::entity parentEntity)
     {
-        return getChildByName(parentEntity, childName);
+        return getNumChildren(parentEntity);
+    };
+    env["getChildren"] = [&](entt::entity parentEntity)
+    {
+        std::vector<entt::entity> children;
+        children.reserve(getNumChildren(parentEntity));
+        forEachChild(parentEntity, [&] (entt::entity child)
+        {
+            children.push_back(child);
+        });
+        return sol::as_table(children);
     };
-    env["applyTemplate"] = [&](entt::entity extendE, const char *templateName, const sol::optional<sol::table> &extendArgs, sol::optional<bool> persistent)
+    // Lua callbacks may destroy any entity, so the entities are collected first, and skipped if they were destroyed meanwhile:
+    env["forEachChild"] = [&](entt::entity parentEntity, const sol::function &func)
     {
-        auto entityTemplate = &getTemplate(templateName); // could throw error :)
+        std::vector<entt::entity> children;
+        children.reserve(getNumChildren(parentEntity));
+        forEachChild(parentEntity, [&] (entt::entity child)
+        {
+            children.push_back(child);
+        });
+        for (entt::entity child : children)
+            if (entities.valid(child))
+                luau::callFunction(func, child);
+    };
+    env["forEachDescendant"] = [&](entt::entity parentEntity, const sol::function &func)
+    {
+        std::vector<entt::entity> descendants;
+        forEachDescendant(parentEntity, [&] (entt::entity descendant)
+        {
+            descendants.push_back(descendant);
+        });
+        for (entt::entity descendant : descendants)
+            if (entities.valid(descendant))
+                luau::callFunction(func, descendant);
+    };
+    // a template can be passed to Lua functions as name, or as TemplateHandle, which does not need to be hashed again.
+    auto getTemplateFromLua = [&](const sol::object &templateNameOrHandle) -> EntityTemplate &
+    {
+        if (templateNameOrHandle.is<TemplateHandle>())
+            return getTemplate(templateNameOrHandle.as<TemplateHandle &>());
+        return getTemplate(templateNameOrHandle.as<std::string>()); // could throw error :)
+    };
+    env["getTemplate"] = [&](const std::string &templateName)
+    {
+        getTemplate(templateName); // throws error if it does not exist.
+        return TemplateHandle(templateName);
+    };
+    env["applyTemplate"] = [&, getTemplateFromLua](entt::entity extendE, const sol::object &templateNameOrHandle, const sol::optional<sol::table> &extendArgs, sol::optional<bool> persistent)
+    {
+        applyTemplate(extendE, getTemplateFromLua(templateNameOrHandle), extendArgs, persistent.value_or(false));
+    };
 
-        bool makePersistent = persistent.value_or(false);
+    env["createMany"] = [&, getTemplateFromLua](const sol::object &templateNameOrHandle, int count, const sol::optional<sol::table> &args, sol::optional<bool> persistent) -> sol::table
+    {
+        auto entityTemplate = &getTemplateFromLua(templateNameOrHandle);
 
+        std::vector<entt::entity> created;
         if (LuaEntityTemplate *luaEntityTemplate = dynamic_cast<LuaEntityTemplate *>(entityTemplate))
-        {
-            luaEntityTemplate->createComponentsWithLuaArguments(extendE, extendArgs, makePersistent);
-        }
+            luaEntityTemplate->createManyWithLuaArguments(count, args, persistent.value_or(false), created);
         else
-            entityTemplate->createComponents(extendE, makePersistent);
+            entityTemplate->createMany(count, created, persistent.value_or(false));
+
+        sol::table createdTable = sol::table::create(luaEnvironment.lua_state(), int(created.size()), 0);
+        for (int i = 0; i < created.size(); i++)
+            createdTable.raw_set(i + 1, created[i]);
+        return createdTable;
     };
 
     env["onEntityEvent"] = [&](entt::entity entity, const char *eventName, const sol::function &listener)
@@ -262,6 +388,29 @@ void EntityEngine::initializeLuaEnvironment()
         events.on(eventName, listener);
     };
 
+    // same as the functions above, but played back after the current system update. Safe to use while iterating.
+    auto commandsTable = env["commands"].get_or_create<sol::table>();
+    commandsTable["createEntity"] = [&]() -> entt::entity
+    {
+        return commands.create();
+    };
+    commandsTable["destroyEntity"] = [&](entt::entity e)
+    {
+        commands.destroy(e);
+    };
+    commandsTable["setComponent"] = [&](entt::entity entity, const sol::table &component)
+    {
+        commands.setComponentFromLua(entity, component);
+    };
+    commandsTable["applyTemplate"] = [&](entt::entity extendE, const std::string &templateName, const sol::optional<sol::table> &extendArgs, sol::optional<bool> persistent)
+    {
+        commands.applyTemplate(extendE, templateName, extendArgs, persistent.value_or(false));
+    };
+    commandsTable["flush"] = [&]()
+    {
+        commands.flush();
+    };
+
     env["setTimeout"] = [&](entt::entity e, float time, const sol::function &func)
     {
         auto &f = entities.get_or_assign<LuaScripted>(e).timeoutFuncs.emplace_back();
@@ -292,7 +441,9 @@ void EntityEngine::setParent(entt::entity child, entt::entity parent, const char
 {
     Child c;
     c.parent = parent;
-    c.name = childName;
+    c.name = NameSymbol(childName);
+    // Child cannot be replaced, so unlink from the old parent first:
+    entities.remove_if_exists<Child>(child);
     entities.assign<Child>(child, c);
 }
 
@@ -325,6 +476,7 @@ void EntityEngine::update(double deltaTime)
                 sys->updateAccumulator -= customDeltaTime;
             }
         }
+        commands.flush();
     }
     bUpdating = false;
 }
@@ -335,61 +487,146 @@ bool EntityEngine::isUpdating() const
 }
 
 void EntityEngine::onChildCreation(entt::registry &reg, entt::entity entity)
+{
+    linkChild(reg, entity);
+}
+
+void EntityEngine::onChildDeletion(entt::registry &reg, entt::entity entity)
+{
+    unlinkChild(reg, entity);
+}
+
+void EntityEngine::onChildFieldsChanged(entt::registry &reg, entt::entity entity)
+{
+    const Child &child = reg.get<Child>(entity);
+    if (child.parent == child.linkedParent && child.name == child.linkedName)
+        return;
+    unlinkChild(reg, entity);
+    linkChild(reg, entity);
+}
+
+void EntityEngine::linkChild(entt::registry &reg, entt::entity entity)
 {
     Child &child = reg.get<Child>(entity);
+    child.previousSibling = child.nextSibling = entt::null;
+    child.linkedParent = entt::null;
+    child.linkedName = NameSymbol();
+
+    // ComponentUtils::setJsonComponent() assigns a default Child first, it is linked when its fields are set.
+    if (!reg.valid(child.parent))
+        return;
 
     Parent &parent = reg.get_or_assign<Parent>(child.parent);
 
-    parent.children.push_back(entity);
+    // append, so that children stay in the order they were added:
+    if (parent.lastChild == entt::null)
+        parent.firstChild = entity;
+    else
+        reg.get<Child>(parent.lastChild).nextSibling = entity;
+    child.previousSibling = parent.lastChild;
+    parent.lastChild = entity;
+    parent.numChildren++;
+
+    child.linkedParent = child.parent;
+    child.linkedName = child.name;
+
     if (!child.name.empty())
-        parent.childrenByName[child.name] = entity;
+        childrenByName[getChildNameKey(child.parent, child.name)] = entity;
 }
 
-void EntityEngine::onChildDeletion(entt::registry &reg, entt::entity entity)
+void EntityEngine::unlinkChild(entt::registry &reg, entt::entity entity)
 {
     Child &child = reg.get<Child>(entity);
-    Parent &parent = reg.get_or_assign<Parent>(child.parent);
+    const entt::entity linkedParent = child.linkedParent;
+    child.linkedParent = entt::null;
 
-    if (!child.name.empty())
-        parent.childrenByName.erase(child.name);
+    if (linkedParent == entt::null)
+        return;
 
-    for (int i = 0; i < parent.children.size(); i++)
+    // also when the parent is destroyed already, otherwise the entry would stay forever:
+    if (!child.linkedName.empty())
     {
-        if (parent.children[i] != entity)
-            continue;
-
-        parent.children[i] = parent.children.back();
-        parent.children.pop_back();
+        auto it = childrenByName.find(getChildNameKey(linkedParent, child.linkedName));
+        // another child might have been given the same name later on:
+        if (it != childrenByName.end() && it->second == entity)
+            childrenByName.erase(it);
     }
+    child.linkedName = NameSymbol();
+
+    if (!reg.valid(linkedParent))
+        return;
+    Parent &parent = reg.get_or_assign<Parent>(linkedParent);
+
+    (child.previousSibling == entt::null ? parent.firstChild : reg.get<Child>(child.previousSibling).nextSibling) = child.nextSibling;
+    (child.nextSibling == entt::null ? parent.lastChild : reg.get<Child>(child.nextSibling).previousSibling) = child.previousSibling;
+    child.previousSibling = child.nextSibling = entt::null;
+    parent.numChildren--;
 }
 
-void EntityEngine::onParentDeletion(entt::registry &reg, entt::entity entity)
+void EntityEngine::onChildReplacement(entt::registry &, entt::entity entity)
 {
-    Parent &parent = reg.get_or_assign<Parent>(entity);
+    // the sibling links of the old Child would be lost, making it impossible to unlink the entity from its old parent.
+    throw gu_err("The Child component of entity#" + std::to_string(int(entity)) + " cannot be replaced, use setParent() instead.");
+}
 
-    auto tmpChildren(parent.children);
-    parent.children.clear();
+void EntityEngine::onParentDeletion(entt::registry &reg, entt::entity entity)
+{
+    const bool bDeleteChildren = reg.get<Parent>(entity).deleteChildrenOnDeletion;
 
-    if (parent.deleteChildrenOnDeletion)
-        for (auto child : tmpChildren)
+    // each child unlinks itself, so keep taking the first one.
+    // NOTE: not keeping a reference to Parent, because destroying a child (that is a parent itself) might move it.
+    entt::entity child;
+    while ((child = reg.get<Parent>(entity).firstChild) != entt::null)
+    {
+        if (bDeleteChildren)
             reg.destroy(child);
-    else
-        for (auto child : tmpChildren)
+        else
             reg.remove<Child>(child);
+    }
 }
 
 
 vec3 EntityEngine::getPosition(entt::entity e) const
 {
+    // Position3d of a child might be outdated until the TransformSystem is updated, so compute it from its parent:
+    if (const LocalPosition3d *local = entities.try_get<LocalPosition3d>(e))
+    {
+        const Child *child = entities.try_get<Child>(e);
+        if (child && entities.valid(child->parent))
+        {
+            return getPosition(child->parent) + local->vec;
+        }
+    }
     return entities.has<Position3d>(e) ? entities.get<Position3d>(e).vec : vec3(0);
 }
 
 void EntityEngine::setPosition(entt::entity e, const vec3 &pos)
 {
     entities.get_or_assign<Position3d>(e).vec = pos;
+    if (bInitialized)
+    {
+        spatialIndexSystem->markMoved(e);
+    }
+
+    LocalPosition3d *local = entities.try_get<LocalPosition3d>(e);
+    if (local != nullptr)
+    {
+        const Child *child = entities.try_get<Child>(e);
+        local->vec = child && entities.valid(child->parent) ? pos - getPosition(child->parent) : pos;
+    }
+    // only the children of this entity (and its LocalPosition3d) need to follow, for most entities there is nothing to do.
+    if (bInitialized && (local != nullptr || entities.has<Parent>(e)))
+    {
+        transformSystem->markDirty(e);
+    }
 }
 
 entt::entity EntityEngine::getByName(const char *name) const
+{
+    return getByName(NameSymbol::find(name ? name : ""));
+}
+
+entt::entity EntityEngine::getByName(const NameSymbol &name) const
 {
     auto it = namedEntities.find(name);
     if (it == namedEntities.end())
@@ -404,14 +641,15 @@ bool EntityEngine::setName(entt::entity e, const char *name)
         if (strcmp(name, "") == 0)
             throw gu_err("Tried to set name of entity#" + std::to_string(int(e)) + " to empty string! Pass nullptr or nil instead to remove the name.");
 
-        auto claimedBy = getByName(name);
+        NameSymbol symbol(name);
+        auto claimedBy = getByName(symbol);
         if (claimedBy == e)
             return true;
         if (claimedBy == entt::null)
         {
             entities.remove_if_exists<Named>(e);
-            entities.assign<Named>(e, name);
-            namedEntities[name] = e;
+            entities.assign<Named>(e, symbol);
+            namedEntities[symbol] = e;
             return true;
         }
         else return false;
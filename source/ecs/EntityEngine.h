@@ -2,7 +2,9 @@
 #ifndef GAME_ENTITYENGINE_H
 #define GAME_ENTITYENGINE_H
 
+#include "EntityCommandBuffer.h"
 #include "EventEmitter.h"
+#include "NameSymbol.h"
 #include "entity_templates/EntityTemplate.h"
 
 #include "../luau.h"
@@ -18,18 +20,24 @@
 
 class EntitySystem;
 class TimeOutSystem;
+class TransformSystem;
+class SpatialIndexSystem;
 
 class EntityEngine
 {
     bool bInitialized = false, bUpdating = false, bDestructing = false;
 
     TimeOutSystem *timeOutSystem;
+    TransformSystem *transformSystem;
+    SpatialIndexSystem *spatialIndexSystem;
 
   protected:
 
     std::list<EntitySystem *> systems;
     std::map<int, EntityTemplate *> entityTemplates;
     std::vector<std::string> entityTemplateNames;
+    // changed whenever a template is added or replaced, invalidating the TemplateHandles' cache.
+    uint32 templatesVersion = 0;
     std::string templateFolder = "scripts/entities/";
 
     virtual void initializeLuaEnvironment();
@@ -40,6 +48,8 @@ class EntityEngine
     sol::environment luaEnvironment;
     entt::registry entities;
     EventEmitter events;
+    // played back after each system update.
+    EntityCommandBuffer commands { *this, entities };
 
     ivec2 cursorPosition = ivec2(0);
 
@@ -66,20 +76,74 @@ class EntityEngine
 
     TimeOutSystem *getTimeOuts();
 
+    TransformSystem *getTransforms();
+
+    SpatialIndexSystem *getSpatialIndex();
+
     template <class EntityTemplate_>
     EntityTemplate &getTemplate()
     {
         return getTemplate(typename_utils::getTypeName<EntityTemplate_>());
     }
 
-    EntityTemplate &getTemplate(std::string name);
+    EntityTemplate &getTemplate(const std::string &name);
 
     EntityTemplate &getTemplate(int templateHash);
 
+    /**
+     * Only looks up the template if the handle was last used with another engine, or if templates were added since.
+     */
+    EntityTemplate &getTemplate(const TemplateHandle &);
+
     const std::vector<std::string> &getTemplateNames() const;
 
+    /**
+     * Passes `arguments` to the template if it is a LuaEntityTemplate.
+     */
+    void applyTemplate(entt::entity, EntityTemplate &, const sol::optional<sol::table> &arguments, bool persistent=false);
+
     entt::entity getChildByName(entt::entity parent, const char *childName);
 
+    entt::entity getChildByName(entt::entity parent, const NameSymbol &childName) const;
+
+    // returns entt::null if `parent` has no children.
+    entt::entity getFirstChild(entt::entity parent) const;
+
+    // returns entt::null if `child` is the last child.
+    entt::entity getNextSibling(entt::entity child) const;
+
+    int getNumChildren(entt::entity parent) const;
+
+    /**
+     * Calls `func(child)` for each child of `parent`, in the order they were added.
+     * `func` may destroy the child it is given, but no other children of `parent`.
+     */
+    template<class Func>
+    void forEachChild(entt::entity parent, Func &&func) const
+    {
+        entt::entity child = getFirstChild(parent);
+        while (child != entt::null)
+        {
+            const entt::entity next = getNextSibling(child);
+            func(child);
+            child = next;
+        }
+    }
+
+    /**
+     * Depth first: calls `func(descendant)` for a child before the children of that child.
+     * `func` should not destroy entities.
+     */
+    template<class Func>
+    void forEachDescendant(entt::entity parent, Func &&func) const
+    {
+        forEachChild(parent, [&] (entt::entity child)
+        {
+            func(child);
+            forEachDescendant(child, func);
+        });
+    }
+
     template<typename Component>
     Component &getChildComponentByName(entt::entity parent, const char *childName)
     {
@@ -100,6 +164,9 @@ class EntityEngine
 
     entt::entity createChild(entt::entity parent, const char *childName="");
 
+    /**
+     * Also moves the child away from its current parent, if it has one.
+     */
     void setParent(entt::entity child, entt::entity parent, const char *childName="");
 
     // returns false if name is already in use
@@ -107,9 +174,11 @@ class EntityEngine
 
     entt::entity getByName(const char *name) const;
 
+    entt::entity getByName(const NameSymbol &name) const;
+
     const char *getName(entt::entity) const;
 
-    const std::unordered_map<std::string, entt::entity> &getNamedEntities() const { return namedEntities; };
+    const std::unordered_map<NameSymbol, entt::entity> &getNamedEntities() const { return namedEntities; };
 
     template<typename type>
     void emitEntityEvent(entt::entity e, const type &event, const char *customEventName=nullptr)
@@ -150,9 +219,24 @@ class EntityEngine
 
     void onChildDeletion(entt::registry &, entt::entity);
 
+    void onChildReplacement(entt::registry &, entt::entity);
+
+    void onChildFieldsChanged(entt::registry &, entt::entity);
+
+    // adds the child to the children of Child::parent.
+    void linkChild(entt::registry &, entt::entity);
+
+    // removes the child from the children of Child::linkedParent.
+    void unlinkChild(entt::registry &, entt::entity);
+
     void onParentDeletion(entt::registry &, entt::entity);
 
-    std::unordered_map<std::string, entt::entity> namedEntities;
+    static uint64 getChildNameKey(entt::entity parent, const NameSymbol &childName);
+
+    // named children by (parent, name id), to find a child without going through all children.
+    std::unordered_map<uint64, entt::entity> childrenByName;
+
+    std::unordered_map<NameSymbol, entt::entity> namedEntities;
 
     void onEntityDenaming(entt::registry &, entt::entity);
 
@@ -939,7 +939,7 @@ void EntityInspector::drawNamedEntitiesTree(const Camera *cam, DebugLineRenderer
             ImGui::NextColumn();
             if (node_open && isParent)
             {
-                for (auto &[childName, child] : isParent->childrenByName)
+                engine.forEachChild(e, [&] (entt::entity child)
                 {
                     std::string childNameStr;
                     if (auto globalName = engine.getName(child))
@@ -947,9 +947,10 @@ void EntityInspector::drawNamedEntitiesTree(const Camera *cam, DebugLineRenderer
                         childNameStr = globalName;
                         childNameStr += " ";
                     }
-                    childNameStr += "[child '" + childName + "']";
+                    const std::string &childName = engine.entities.get<Child>(child).name.str();
+                    childNameStr += childName.empty() ? "[child]" : "[child '" + childName + "']";
                     funcs::showEntity(childNameStr, child, engine);
-                }
+                });
                 ImGui::TreePop();
             }
             ImGui::PopID();
@@ -957,7 +958,7 @@ void EntityInspector::drawNamedEntitiesTree(const Camera *cam, DebugLineRenderer
     };
 
     for (auto &[name, e] : engine.getNamedEntities())
-        funcs::showEntity(name, e, engine);
+        funcs::showEntity(name.str(), e, engine);
 
     ImGui::Columns(1);
 }
@@ -1,4 +1,3 @@
-
 #include "EntityObserver.h"
 
 #include <utils/gu_error.h>
@@ -9,81 +8,195 @@ entt::entity EntityObserver::Handle::getEntity() const
 }
 
 EntityObserver::Handle::Handle(
-    const std::shared_ptr<EntityObserver::Callback> &callback,
-    bool bOnConstruct,
+    uint32_t callbackIndex,
+    uint32_t generation,
     entt::entity e
 ) :
-    callback(callback),
-    bOnConstruct(bOnConstruct),
+    callbackIndex(callbackIndex),
+    generation(generation),
     entity(e)
 {
 }
 
 EntityObserver::Handle EntityObserver::onConstruct(entt::entity e, std::function<void()> callback)
 {
-    std::list<std::shared_ptr<Callback>> *callbacks = getOrCreateOnConstructCallbacks(registry, e);
-    callbacks->push_back(std::make_shared<Callback>(Callback { std::move(callback) }));
-    return {
-        callbacks->back(),
-        true,
-        e
-    };
+    return add(*getOrCreateOnConstructCallbacks(registry, e), std::move(callback), true, e);
 }
 
 EntityObserver::Handle EntityObserver::onDestroy(entt::entity e, std::function<void()> callback)
 {
-    std::list<std::shared_ptr<Callback>> *callbacks = getOrCreateOnDestroyCallbacks(registry, e);
-    callbacks->push_back(std::make_shared<Callback>(Callback { std::move(callback) }));
-    return {
-        callbacks->back(),
-        false,
-        e
-    };
+    return add(*getOrCreateOnDestroyCallbacks(registry, e), std::move(callback), false, e);
 }
 
 void EntityObserver::unregister(EntityObserver::Handle &handle)
 {
-    std::list<std::shared_ptr<Callback>> *callbacks = (handle.bOnConstruct ? tryGetOnConstructCallbacks : tryGetOnDestroyCallbacks)(
-        registry, handle.entity
-    );
-    if (callbacks)
+    if (handle.callbackIndex >= callbacks.size())
     {
-        callbacks->remove_if([&] (const std::shared_ptr<EntityObserver::Callback> &callback)
-        {
-            return callback.get() == handle.callback.get();
-        });
-        handle.callback->bUnregistered = true;
+        return;
+    }
+    Callback &callback = callbacks[handle.callbackIndex];
+    if (callback.generation != handle.generation || callback.bUnregistered)
+    {
+        return; // unregistered already, or the entity was destroyed.
+    }
+    callback.bUnregistered = true;
+    callback.generation++;
+
+    if (dispatchDepth > 0)
+    {
+        // the callback might be the one being called, or the next one in the list.
+        callbacksToRelease.push_back(handle.callbackIndex);
+    }
+    else
+    {
+        release(handle.callbackIndex);
     }
 }
 
 void EntityObserver::onComponentConstructed(entt::registry &, entt::entity entity)
 {
-    if (std::list<std::shared_ptr<EntityObserver::Callback>> *callbacks = tryGetOnConstructCallbacks(registry, entity))
+    if (CallbackList *list = tryGetOnConstructCallbacks(registry, entity))
     {
-        callCallbacks(*callbacks, entity);
+        callCallbacks(*list, entity);
     }
 }
 
 void EntityObserver::onComponentDestroyed(entt::registry &, entt::entity entity)
 {
-    if (std::list<std::shared_ptr<EntityObserver::Callback>> *callbacks = tryGetOnDestroyCallbacks(registry, entity))
+    if (CallbackList *list = tryGetOnDestroyCallbacks(registry, entity))
     {
-        callCallbacks(*callbacks, entity);
+        callCallbacks(*list, entity);
     }
 }
 
-void EntityObserver::callCallbacks(std::list<std::shared_ptr<Callback>> &callbacks, entt::entity entity)
+EntityObserver::Handle EntityObserver::add(CallbackList &list, std::function<void()> &&function, bool bOnConstruct,
+    entt::entity e)
 {
-    std::list<std::shared_ptr<EntityObserver::Callback>> callbacksCopy = callbacks;
-    for (std::shared_ptr<EntityObserver::Callback> &callback : callbacksCopy)
+    uint32_t callbackIndex;
+    if (freeCallbacks.empty())
+    {
+        callbackIndex = uint32_t(callbacks.size());
+        callbacks.emplace_back();
+    }
+    else
     {
-        if (!callback->bUnregistered)
+        callbackIndex = freeCallbacks.back();
+        freeCallbacks.pop_back();
+    }
+    Callback &callback = callbacks[callbackIndex];
+    callback.function = std::move(function);
+    callback.entity = e;
+    callback.bOnConstruct = bOnConstruct;
+    callback.bLinked = true;
+    callback.previous = list.last;
+    callback.next = NO_CALLBACK;
+
+    if (list.last == NO_CALLBACK)
+    {
+        list.first = callbackIndex;
+    }
+    else
+    {
+        callbacks[list.last].next = callbackIndex;
+    }
+    list.last = callbackIndex;
+
+    return { callbackIndex, callback.generation, e };
+}
+
+void EntityObserver::release(uint32_t callbackIndex)
+{
+    Callback &callback = callbacks[callbackIndex];
+    if (callback.bLinked)
+    {
+        if (CallbackList *list = (callback.bOnConstruct ? tryGetOnConstructCallbacks : tryGetOnDestroyCallbacks)(registry, callback.entity))
         {
-            callback->function();
+            (callback.previous == NO_CALLBACK ? list->first : callbacks[callback.previous].next) = callback.next;
+            (callback.next == NO_CALLBACK ? list->last : callbacks[callback.next].previous) = callback.previous;
+        }
+    }
+    callback.function = nullptr;
+    callback.previous = callback.next = NO_CALLBACK;
+    callback.bLinked = false;
+    callback.bUnregistered = false;
+    freeCallbacks.push_back(callbackIndex);
+}
+
+void EntityObserver::freeAll(CallbackList &list)
+{
+    uint32_t callbackIndex = list.first;
+    while (callbackIndex != NO_CALLBACK)
+    {
+        Callback &callback = callbacks[callbackIndex];
+        const uint32_t next = callback.next;
+
+        // the list itself is being destroyed, so no need to unlink. `next` stays intact for a dispatch that is going on.
+        callback.bLinked = false;
+        if (!callback.bUnregistered)
+        {
+            callback.bUnregistered = true;
+            callback.generation++;
+            if (dispatchDepth > 0)
+            {
+                callbacksToRelease.push_back(callbackIndex);
+            }
+            else
+            {
+                release(callbackIndex);
+            }
+        }
+        callbackIndex = next;
+    }
+    list.first = list.last = NO_CALLBACK;
+}
+
+void EntityObserver::callCallbacks(const CallbackList &list, entt::entity entity)
+{
+    if (list.first == NO_CALLBACK)
+    {
+        return;
+    }
+    // `list` is not used after calling the first callback, because the component that holds it might be moved by EnTT.
+    uint32_t callbackIndex = list.first;
+    // callbacks added during this dispatch will not be called:
+    const uint32_t lastCallbackIndex = list.last;
+
+    struct DispatchScope
+    {
+        EntityObserver *observer;
+
+        ~DispatchScope()
+        {
+            if (--observer->dispatchDepth == 0)
+            {
+                std::vector<uint32_t> toRelease;
+                toRelease.swap(observer->callbacksToRelease);
+                for (uint32_t index : toRelease)
+                {
+                    observer->release(index);
+                }
+            }
+        }
+    };
+    dispatchDepth++;
+    DispatchScope dispatchScope { this };
+
+    while (true)
+    {
+        // no reference kept, a callback might add other callbacks. The deque does not move the existing ones though.
+        if (!callbacks[callbackIndex].bUnregistered)
+        {
+            callbacks[callbackIndex].function();
+
+            if (entt::registry::version(entity) != registry.current(entity))
+            {
+                throw gu_err("Do not destroy an entity during a callback of the EntityObserver!");
+            }
         }
-        if (entt::registry::version(entity) != registry.current(entity))
+        if (callbackIndex == lastCallbackIndex)
         {
-            throw gu_err("Do not destroy an entity during a callback of the EntityObserver!");
+            break;
         }
+        callbackIndex = callbacks[callbackIndex].next;
     }
 }
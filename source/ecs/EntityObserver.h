@@ -4,21 +4,46 @@
 
 #include "../../external/entt/src/entt/entity/registry.hpp"
 
-#include <list>
-
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * Calls callbacks when a Component is added to/removed from a specific entity.
+ *
+ * The callbacks of all entities are stored in one pool, linked per entity and per event (construct/destroy).
+ * Handles refer to a slot in the pool plus its generation, so unregistering twice or after the entity was destroyed is safe.
+ */
 class EntityObserver
 {
+    constexpr static uint32_t NO_CALLBACK = uint32_t(-1);
+
     struct Callback
     {
         std::function<void()> function;
+        uint32_t previous = NO_CALLBACK;
+        uint32_t next = NO_CALLBACK;
+        // increased when unregistered, invalidating handles to this slot.
+        uint32_t generation = 0;
+        entt::entity entity = entt::null;
+        bool bOnConstruct = false;
+        // false if not (or no longer) part of an entity's CallbackList.
+        bool bLinked = false;
+        // can be true while still linked, if unregistered during a dispatch.
         bool bUnregistered = false;
     };
 
+    struct CallbackList
+    {
+        uint32_t first = NO_CALLBACK;
+        uint32_t last = NO_CALLBACK;
+    };
+
     template<class Component>
     struct Observed
     {
-        std::list<std::shared_ptr<Callback>> onConstructCallbacks;
-        std::list<std::shared_ptr<Callback>> onDestroyCallbacks;
+        CallbackList onConstructCallbacks;
+        CallbackList onDestroyCallbacks;
     };
 
   public:
@@ -30,10 +55,10 @@ class EntityObserver
       private:
         friend EntityObserver;
 
-        Handle(const std::shared_ptr<Callback> &callback, bool bOnConstruct, entt::entity e);
+        Handle(uint32_t callbackIndex, uint32_t generation, entt::entity e);
 
-        const std::shared_ptr<Callback> callback;
-        const bool bOnConstruct;
+        const uint32_t callbackIndex;
+        const uint32_t generation;
         const entt::entity entity;
     };
 
@@ -43,8 +68,9 @@ class EntityObserver
     {
         registry.on_construct<Component>().template connect<&EntityObserver::onComponentConstructed>(this);
         registry.on_destroy<Component>().template connect<&EntityObserver::onComponentDestroyed>(this);
+        registry.on_destroy<Observed<Component>>().template connect<&EntityObserver::onObservedDestroyed<Component>>(this);
 
-        tryGetOnConstructCallbacks = [] (entt::registry &registry, entt::entity e) -> std::list<std::shared_ptr<Callback>> *
+        tryGetOnConstructCallbacks = [] (entt::registry &registry, entt::entity e) -> CallbackList *
         {
             if (Observed<Component> *observed = registry.try_get<Observed<Component>>(e))
             {
@@ -52,7 +78,7 @@ class EntityObserver
             }
             return nullptr;
         };
-        tryGetOnDestroyCallbacks = [] (entt::registry &registry, entt::entity e) -> std::list<std::shared_ptr<Callback>> *
+        tryGetOnDestroyCallbacks = [] (entt::registry &registry, entt::entity e) -> CallbackList *
         {
             if (Observed<Component> *observed = registry.try_get<Observed<Component>>(e))
             {
@@ -84,15 +110,38 @@ class EntityObserver
 
     void onComponentDestroyed(entt::registry &registry, entt::entity e);
 
-    void callCallbacks(std::list<std::shared_ptr<Callback>> &callbacks, entt::entity e);
+    template<class Component>
+    void onObservedDestroyed(entt::registry &registry, entt::entity e)
+    {
+        Observed<Component> &observed = registry.get<Observed<Component>>(e);
+        freeAll(observed.onConstructCallbacks);
+        freeAll(observed.onDestroyCallbacks);
+    }
+
+    Handle add(CallbackList &list, std::function<void()> &&function, bool bOnConstruct, entt::entity e);
+
+    // unlinks the callback and puts its slot back in the pool. Should not be called during a dispatch.
+    void release(uint32_t callbackIndex);
+
+    void freeAll(CallbackList &list);
+
+    void callCallbacks(const CallbackList &list, entt::entity e);
 
     entt::registry &registry;
 
-    std::function<std::list<std::shared_ptr<Callback>> *(entt::registry &, entt::entity)> tryGetOnConstructCallbacks;
-    std::function<std::list<std::shared_ptr<Callback>> *(entt::registry &, entt::entity)> tryGetOnDestroyCallbacks;
+    // a deque, so that a callback that is being called does not move when others are added.
+    std::deque<Callback> callbacks;
+    std::vector<uint32_t> freeCallbacks;
+
+    int dispatchDepth = 0;
+    // unregistered during a dispatch, released afterwards:
+    std::vector<uint32_t> callbacksToRelease;
+
+    CallbackList *(*tryGetOnConstructCallbacks)(entt::registry &, entt::entity);
+    CallbackList *(*tryGetOnDestroyCallbacks)(entt::registry &, entt::entity);
 
-    std::function<std::list<std::shared_ptr<Callback>> *(entt::registry &, entt::entity)> getOrCreateOnConstructCallbacks;
-    std::function<std::list<std::shared_ptr<Callback>> *(entt::registry &, entt::entity)> getOrCreateOnDestroyCallbacks;
+    CallbackList *(*getOrCreateOnConstructCallbacks)(entt::registry &, entt::entity);
+    CallbackList *(*getOrCreateOnDestroyCallbacks)(entt::registry &, entt::entity);
 };
 
 
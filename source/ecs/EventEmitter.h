@@ -1,9 +1,10 @@
-
 #ifndef GAME_EVENTEMITTER_H
 #define GAME_EVENTEMITTER_H
 
 #include <unordered_map>
-#include <list>
+#include <deque>
+#include <memory>
+#include <vector>
 #include <utils/type_name.h>
 #include "../../external/entt/src/entt/core/hashed_string.hpp"
 #include "../luau.h"
@@ -14,19 +15,201 @@ class EventEmitter
 
     using hash_type = entt::hashed_string::hash_type;
 
-    std::unordered_map<hash_type, std::list<sol::function>> eventListeners;
+    constexpr static uint32_t NO_LISTENER = uint32_t(-1);
+
+    struct Listener
+    {
+        std::function<void()> nativeFunction;
+        sol::function luaFunction;
+        uint32_t previous = NO_LISTENER;
+        uint32_t next = NO_LISTENER;
+        // increased when removed, invalidating handles to this slot.
+        uint32_t generation = 0;
+        hash_type eventHash = 0;
+        bool bNative = false;
+        // can be true while still linked, if removed during emit().
+        bool bRemoved = false;
+    };
+
+    struct ListenerList
+    {
+        uint32_t first = NO_LISTENER;
+        uint32_t last = NO_LISTENER;
+    };
+
+    struct EventListeners
+    {
+        ListenerList native, lua;
+    };
+
+    /**
+     * The listeners of all events are stored in one pool, linked per event, like in EntityObserver.
+     * Shared with emit() and the ListenerHandles, because a listener might destroy this EventEmitter (e.g. by destroying its entity),
+     * or EnTT might move it.
+     */
+    struct State
+    {
+        // a deque, so that a listener that is being called does not move when others are added.
+        std::deque<Listener> listeners;
+        std::vector<uint32_t> freeListeners;
+        std::unordered_map<hash_type, EventListeners> eventListeners;
+
+        int emitDepth = 0;
+        // removed during emit(), released afterwards:
+        std::vector<uint32_t> listenersToRelease;
+
+        uint32_t add(hash_type eventHash, bool bNative)
+        {
+            uint32_t index;
+            if (freeListeners.empty())
+            {
+                index = uint32_t(listeners.size());
+                listeners.emplace_back();
+            }
+            else
+            {
+                index = freeListeners.back();
+                freeListeners.pop_back();
+            }
+            Listener &listener = listeners[index];
+            listener.eventHash = eventHash;
+            listener.bNative = bNative;
+            listener.next = NO_LISTENER;
+
+            EventListeners &forEvent = eventListeners[eventHash];
+            ListenerList &list = bNative ? forEvent.native : forEvent.lua;
+            listener.previous = list.last;
+            (list.last == NO_LISTENER ? list.first : listeners[list.last].next) = index;
+            list.last = index;
+            return index;
+        }
+
+        void remove(uint32_t index)
+        {
+            Listener &listener = listeners[index];
+            if (listener.bRemoved)
+                return;
+            listener.bRemoved = true;
+            listener.generation++;
+
+            if (emitDepth > 0)
+                // the listener might be the one being called, or the next one in the list.
+                listenersToRelease.push_back(index);
+            else
+                release(index);
+        }
+
+        // unlinks the listener and puts its slot back in the pool. Should not be called during emit().
+        void release(uint32_t index)
+        {
+            Listener &listener = listeners[index];
+            auto it = eventListeners.find(listener.eventHash);
+            ListenerList &list = listener.bNative ? it->second.native : it->second.lua;
+            (listener.previous == NO_LISTENER ? list.first : listeners[listener.previous].next) = listener.next;
+            (listener.next == NO_LISTENER ? list.last : listeners[listener.next].previous) = listener.previous;
+            if (it->second.native.first == NO_LISTENER && it->second.lua.first == NO_LISTENER)
+                eventListeners.erase(it);
+
+            listener.nativeFunction = nullptr;
+            listener.luaFunction = sol::function();
+            listener.previous = listener.next = NO_LISTENER;
+            listener.bRemoved = false;
+            freeListeners.push_back(index);
+        }
+    };
+
+    std::shared_ptr<State> state;
 
   public:
 
+    /**
+     * Returned by onNative() and onWithHandle(). Removes the listener when destructed or reset.
+     * Stays safe to use after the EventEmitter is destroyed.
+     */
+    struct ListenerHandle
+    {
+        ListenerHandle() = default;
+
+        ListenerHandle(ListenerHandle &&other) :
+            state(std::move(other.state)), listenerIndex(other.listenerIndex), generation(other.generation)
+        {}
+
+        ListenerHandle &operator=(ListenerHandle &&other)
+        {
+            reset();
+            state = std::move(other.state);
+            listenerIndex = other.listenerIndex;
+            generation = other.generation;
+            return *this;
+        }
+
+        void reset()
+        {
+            if (std::shared_ptr<State> lockedState = state.lock())
+            {
+                if (lockedState->listeners[listenerIndex].generation == generation)
+                    lockedState->remove(listenerIndex);
+            }
+            state.reset();
+        }
+
+        ~ListenerHandle()
+        {
+            reset();
+        }
+
+      private:
+        friend EventEmitter;
+
+        std::weak_ptr<State> state;
+        uint32_t listenerIndex = NO_LISTENER;
+        uint32_t generation = 0;
+    };
+
     template<typename type>
     void emit(const type &event, const char *customEventName=nullptr)
     {
+        if (!state)
+            return;
+
         static hash_type typeHash = 0;
         if (typeHash == 0)
             typeHash = entt::hashed_string { typename_utils::getTypeName<type>().c_str() }.value();
 
-        auto &listeners = eventListeners[customEventName ? entt::hashed_string { customEventName }.value() : typeHash];
-        auto it = listeners.begin();
+        const hash_type eventHash = customEventName ? entt::hashed_string { customEventName }.value() : typeHash;
+
+        auto it = state->eventListeners.find(eventHash);
+        if (it == state->eventListeners.end())
+            return;
+
+        // after calling the first listener `this` might be destroyed or moved, so only `emitState` is used.
+        // listeners that are added by a listener will be called from the next emit() on, not from this one.
+        const std::shared_ptr<State> emitState = state;
+        const ListenerList native = it->second.native, lua = it->second.lua;
+
+        struct EmitScope
+        {
+            State &state;
+
+            ~EmitScope()
+            {
+                if (--state.emitDepth == 0)
+                {
+                    std::vector<uint32_t> toRelease;
+                    toRelease.swap(state.listenersToRelease);
+                    for (uint32_t index : toRelease)
+                        state.release(index);
+                }
+            }
+        };
+        emitState->emitDepth++;
+        EmitScope emitScope { *emitState };
+
+        forEachListener(*emitState, native, [&] (uint32_t index)
+        {
+            // not copied, a removed listener is only released after the outermost emit().
+            emitState->listeners[index].nativeFunction();
+        });
 
         bool removeListener = false;
         auto removeCallback = [&] {
@@ -35,36 +218,93 @@ class EventEmitter
 
         // call each listener with the event as argument:
         // also pass a callback function that can be used to remove the listener
-        while (it != listeners.end())
+        forEachListener(*emitState, lua, [&] (uint32_t index)
         {
-            auto &listener = *it;
+            sol::function &function = emitState->listeners[index].luaFunction;
 
             sol::protected_function_result result;
 
             if constexpr (sizeof(type) > 4 && !std::is_same_v<const char *, type>)
-                result = listener(&event, removeCallback);   // TODO: lua function might do stuff that breaks stuff, like it did in LuaScriptsSystem::callUpdateFunc()
+                result = function(&event, removeCallback);   // TODO: lua function might do stuff that breaks stuff, like it did in LuaScriptsSystem::callUpdateFunc()
             else
-                result = listener(event, removeCallback); // copy the value instead of giving a pointer.
-
-            if (!result.valid())
-                throw gu_err(result.get<sol::error>().what());
+                result = function(event, removeCallback); // copy the value instead of giving a pointer.
 
             if (removeListener)
             {
                 removeListener = false;
-                it = listeners.erase(it);
+                emitState->remove(index);
             }
-            else ++it;
-        }
+
+            if (!result.valid())
+                throw gu_err(result.get<sol::error>().what());
+        });
     }
 
     void on(const char *eventName, const sol::function &listener)
     {
-        auto typeHash = entt::hashed_string { eventName }.value();
+        const uint32_t added = add(eventName, false);
+        state->listeners[added].luaFunction = listener;
+    }
+
+    /**
+     * Like on(), but the listener is also removed when the returned handle is destructed or reset.
+     */
+    ListenerHandle onWithHandle(const char *eventName, const sol::function &listener)
+    {
+        const uint32_t added = add(eventName, false);
+        state->listeners[added].luaFunction = listener;
+        return createHandle(added);
+    }
+
+    /**
+     * Adds a C++ listener that does not need Lua at all. Does not receive the event itself.
+     * Native listeners are called before the Lua listeners.
+     */
+    ListenerHandle onNative(const char *eventName, std::function<void()> listener)
+    {
+        const uint32_t added = add(eventName, true);
+        state->listeners[added].nativeFunction = std::move(listener);
+        return createHandle(added);
+    }
+
+  private:
+
+    uint32_t add(const char *eventName, bool bNative)
+    {
+        if (!state)
+            state = std::make_shared<State>();
+        return state->add(entt::hashed_string { eventName }.value(), bNative);
+    }
+
+    ListenerHandle createHandle(uint32_t listenerIndex) const
+    {
+        ListenerHandle handle;
+        handle.state = state;
+        handle.listenerIndex = listenerIndex;
+        handle.generation = state->listeners[listenerIndex].generation;
+        return handle;
+    }
 
-        auto &listeners = eventListeners[typeHash];
+    /**
+     * Calls `function(listenerIndex)` for the listeners that were in `list` when emit() started, except the removed ones.
+     */
+    template<class Function>
+    static void forEachListener(State &state, const ListenerList &list, Function &&function)
+    {
+        if (list.first == NO_LISTENER)
+            return;
 
-        listeners.push_back(listener);
+        uint32_t index = list.first;
+        while (true)
+        {
+            // no reference kept, a listener might add other listeners. The deque does not move the existing ones though.
+            if (!state.listeners[index].bRemoved)
+                function(index);
+
+            if (index == list.last)
+                break;
+            index = state.listeners[index].next;
+        }
     }
 
 };
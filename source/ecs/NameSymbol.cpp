@@ -0,0 +1,94 @@
+#include "NameSymbol.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+NameSymbol::NameSymbol(std::string_view name) : entry(intern(name, true))
+{}
+
+NameSymbol::NameSymbol(const char *name) : NameSymbol(std::string_view(name ? name : ""))
+{}
+
+NameSymbol::NameSymbol(const std::string &name) : NameSymbol(std::string_view(name))
+{}
+
+NameSymbol NameSymbol::find(std::string_view name)
+{
+    return NameSymbol(intern(name, false));
+}
+
+const std::string &NameSymbol::str() const
+{
+    static const std::string emptyString;
+    return entry ? entry->string : emptyString;
+}
+
+const NameSymbol::Entry *NameSymbol::intern(std::string_view name, bool bAdd)
+{
+    if (name.empty())
+    {
+        return nullptr;
+    }
+    // entries are never removed, and a deque does not move them, so the string_views stay valid:
+    static std::deque<Entry> entries;
+    static std::unordered_map<std::string_view, const Entry *> entriesByName;
+    // names might be created by assets that are loaded on another thread.
+    static std::mutex mutex;
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    auto it = entriesByName.find(name);
+    if (it != entriesByName.end())
+    {
+        return it->second;
+    }
+    if (!bAdd)
+    {
+        return nullptr;
+    }
+    Entry &entry = entries.emplace_back();
+    entry.string = name;
+    entry.id = uint32(entries.size());
+    entriesByName[entry.string] = &entry;
+    return &entry;
+}
+
+void to_json(json &j, const NameSymbol &v)
+{
+    j = v.str();
+}
+
+void from_json(const json &j, NameSymbol &v)
+{
+    v = NameSymbol(j.get<std::string>());
+}
+
+NameSymbol sol_lua_get(sol::types<NameSymbol>, lua_State *L, int index, sol::stack::record &tracking)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        tracking.use(1);
+        size_t length = 0;
+        const char *string = lua_tolstring(L, index, &length);
+        return NameSymbol(std::string_view(string, length));
+    }
+    return sol::stack::get<LuaNameSymbol &>(L, index, tracking).symbol;
+}
+
+NameSymbolQuery sol_lua_get(sol::types<NameSymbolQuery>, lua_State *L, int index, sol::stack::record &tracking)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        tracking.use(1);
+        size_t length = 0;
+        const char *string = lua_tolstring(L, index, &length);
+        return { NameSymbol::find(std::string_view(string, length)) };
+    }
+    return { sol::stack::get<LuaNameSymbol &>(L, index, tracking).symbol };
+}
+
+int sol_lua_push(sol::types<NameSymbol>, lua_State *L, const NameSymbol &symbol)
+{
+    return sol::stack::push(L, symbol.str());
+}
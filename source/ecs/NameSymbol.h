@@ -0,0 +1,142 @@
+
+#ifndef GAME_NAMESYMBOL_H
+#define GAME_NAMESYMBOL_H
+
+#include "../luau.h"
+
+#include <math/math_utils.h>
+
+#include <json.hpp>
+
+#include <string>
+#include <string_view>
+
+/**
+ * Interned name, used for entity names (see EntityEngine::setName()) and Child::name.
+ *
+ * Equal names share one string in a global pool that is never freed, so copying and comparing is as cheap as a pointer.
+ * Constructing a NameSymbol hashes the string (once), so keep the symbol around when looking up the same name repeatedly.
+ */
+class NameSymbol
+{
+    struct Entry
+    {
+        std::string string;
+        uint32 id;
+    };
+
+  public:
+
+    NameSymbol() = default;
+
+    explicit NameSymbol(std::string_view name);
+
+    explicit NameSymbol(const char *name);
+
+    explicit NameSymbol(const std::string &name);
+
+    /**
+     * Returns the symbol if `name` was interned before, else an empty symbol. Does not add `name` to the pool.
+     */
+    static NameSymbol find(std::string_view name);
+
+    const std::string &str() const;
+
+    const char *c_str() const
+    {
+        return str().c_str();
+    }
+
+    bool empty() const
+    {
+        return entry == nullptr;
+    }
+
+    /**
+     * Unique per name, 0 for the empty symbol.
+     */
+    uint32 getId() const
+    {
+        return entry ? entry->id : 0;
+    }
+
+    bool operator==(const NameSymbol &other) const
+    {
+        return entry == other.entry;
+    }
+
+    bool operator!=(const NameSymbol &other) const
+    {
+        return entry != other.entry;
+    }
+
+  private:
+
+    explicit NameSymbol(const Entry *entry) : entry(entry)
+    {}
+
+    static const Entry *intern(std::string_view name, bool bAdd);
+
+    const Entry *entry = nullptr;
+};
+
+namespace std
+{
+    template<>
+    struct hash<NameSymbol>
+    {
+        inline size_t operator()(const NameSymbol &symbol) const
+        {
+            return symbol.getId();
+        }
+    };
+}
+
+void to_json(json &j, const NameSymbol &v);
+
+void from_json(const json &j, NameSymbol &v);
+
+/**
+ * What Lua gets when calling NameSymbol("name").
+ * NameSymbols in components are passed to Lua as strings, so that existing scripts keep working.
+ */
+struct LuaNameSymbol
+{
+    NameSymbol symbol;
+};
+
+// Lua can pass either a string or a LuaNameSymbol where C++ expects a NameSymbol:
+
+template<typename Handler>
+bool sol_lua_check(sol::types<NameSymbol>, lua_State *L, int index, Handler &&handler, sol::stack::record &tracking)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        tracking.use(1);
+        return true;
+    }
+    return sol::stack::check<LuaNameSymbol>(L, index, std::forward<Handler>(handler), tracking);
+}
+
+NameSymbol sol_lua_get(sol::types<NameSymbol>, lua_State *L, int index, sol::stack::record &tracking);
+
+int sol_lua_push(sol::types<NameSymbol>, lua_State *L, const NameSymbol &symbol);
+
+/**
+ * For parameters of Lua functions that only look up a name, like getByName().
+ * Unlike NameSymbol, a string that was never interned gives an empty symbol instead of being added to the pool forever.
+ */
+struct NameSymbolQuery
+{
+    NameSymbol symbol;
+};
+
+template<typename Handler>
+bool sol_lua_check(sol::types<NameSymbolQuery>, lua_State *L, int index, Handler &&handler, sol::stack::record &tracking)
+{
+    return sol_lua_check(sol::types<NameSymbol>(), L, index, std::forward<Handler>(handler), tracking);
+}
+
+NameSymbolQuery sol_lua_get(sol::types<NameSymbolQuery>, lua_State *L, int index, sol::stack::record &tracking);
+
+#endif //GAME_NAMESYMBOL_H
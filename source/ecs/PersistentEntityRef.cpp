@@ -3,9 +3,154 @@
 
 #include "../generated/Saving.hpp"
 
+#include <algorithm>
+
+PersistentEntityID PersistentEntities::create(entt::entity e)
+{
+    uint32 index;
+    if (freeSlots.empty())
+    {
+        index = uint32(std::max<size_t>(slots.size(), 1));
+    }
+    else
+    {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    Slot &slot = getSlot(index);
+    slot.entity = e;
+    slot.bFree = false;
+    return (PersistentEntityID(slot.generation) << 32u) | index;
+}
+
+void PersistentEntities::set(PersistentEntityID id, entt::entity e)
+{
+    const uint32 index = uint32(id);
+    if (index == 0)
+    {
+        throw gu_err("Tried to set a persistent entity with id 0");
+    }
+    Slot &slot = getSlot(index);
+    if (slot.bFree)
+    {
+        freeSlots.erase(std::find(freeSlots.begin(), freeSlots.end(), index));
+        slot.bFree = false;
+    }
+    slot.entity = e;
+    slot.generation = uint32(id >> 32u);
+}
+
+bool PersistentEntities::tryGet(PersistentEntityID id, entt::entity &outEntity) const
+{
+    const uint32 index = uint32(id);
+    const uint32 generation = uint32(id >> 32u);
+    outEntity = entt::null;
+
+    if (index == 0 || index >= slots.size())
+    {
+        return false;
+    }
+    const Slot &slot = slots[index];
+    if (slot.bFree || slot.generation != generation)
+    {
+        return generation < slot.generation || slot.bFree; // destroyed.
+    }
+    outEntity = slot.entity;
+    return slot.entity != entt::null;
+}
+
+void PersistentEntities::releaseUnclaimed()
+{
+    for (uint32 index = 1; index < slots.size(); index++)
+    {
+        if (!slots[index].bFree && slots[index].entity == entt::null)
+        {
+            release(index);
+        }
+    }
+}
+
+void PersistentEntities::toJson(json &j) const
+{
+    // generations only, which slots are free follows from the saved entities.
+    j = json::array();
+    for (uint32 index = 1; index < slots.size(); index++)
+    {
+        j.push_back(slots[index].generation);
+    }
+}
+
+void PersistentEntities::loadJson(const json &j)
+{
+    slots.clear();
+    freeSlots.clear();
+    slots.resize(j.size() + 1);
+    for (uint32 index = 1; index < slots.size(); index++)
+    {
+        slots[index].generation = j[index - 1];
+    }
+}
+
+void PersistentEntities::loadLegacyIdCounter(PersistentEntityID idCounter)
+{
+    slots.clear();
+    freeSlots.clear();
+    slots.resize(idCounter + 1);
+}
+
+void PersistentEntities::onDestroyed(entt::registry &reg, entt::entity e)
+{
+    PersistentEntities *persistentEntities = reg.try_ctx<PersistentEntities>();
+    if (persistentEntities == nullptr)
+    {
+        return;
+    }
+    const Persistent &persistent = reg.get<Persistent>(e);
+    const uint32 index = uint32(persistent.persistentId);
+    if (index == 0 || index >= persistentEntities->slots.size())
+    {
+        return;
+    }
+    Slot &slot = persistentEntities->slots[index];
+    if (slot.entity != e || slot.generation != uint32(persistent.persistentId >> 32u))
+    {
+        return;
+    }
+    if (persistent.revive)
+    {
+        slot.entity = entt::null; // reserved until the entity is revived.
+    }
+    else
+    {
+        persistentEntities->release(index);
+    }
+}
+
+PersistentEntities::Slot &PersistentEntities::getSlot(uint32 index)
+{
+    if (index >= slots.size())
+    {
+        const uint32 previousSize = uint32(std::max<size_t>(slots.size(), 1));
+        slots.resize(index + 1);
+        // slots that were skipped can be used by create():
+        for (uint32 skipped = previousSize; skipped < index; skipped++)
+        {
+            release(skipped);
+        }
+    }
+    return slots[index];
+}
+
+void PersistentEntities::release(uint32 index)
+{
+    Slot &slot = slots[index];
+    slot.entity = entt::null;
+    slot.generation++;
+    slot.bFree = true;
+    freeSlots.push_back(index);
+}
+
 PersistentEntityRef::PersistentEntityRef() :
-    resolved(true),
-    entity(entt::null),
     persistentEntityId(0)
 {
 
@@ -28,13 +173,12 @@ void PersistentEntityRef::set(entt::entity e, const entt::registry &reg)
     {
         persistentEntityId = 0;
     }
-    resolved = true;
-    entity = e;
 }
 
 entt::entity PersistentEntityRef::resolve(const entt::registry &reg) const
 {
-    if (resolved || tryResolve(reg, entity))
+    entt::entity entity;
+    if (tryResolve(reg, entity))
     {
         return entity;
     }
@@ -45,21 +189,12 @@ bool PersistentEntityRef::tryResolve(const entt::registry &reg, entt::entity &ou
 {
     if (persistentEntityId == 0)
     {
-        entity = entt::null;
-        resolved = true;
-        outEntity = entity;
+        outEntity = entt::null;
         return true;
     }
     else if (const PersistentEntities *persistentEntities = reg.try_ctx<PersistentEntities>())
     {
-        auto it = persistentEntities->persistentEntityIdMap.find(persistentEntityId);
-        if (it != persistentEntities->persistentEntityIdMap.end())
-        {
-            entity = it->second;
-            resolved = true;
-            outEntity = entity;
-            return true;
-        }
+        return persistentEntities->tryGet(persistentEntityId, outEntity);
     }
     outEntity = entt::null;
     return false;
@@ -88,5 +223,4 @@ void to_json(json &j, const PersistentEntityRef &v)
 void from_json(const json &j, PersistentEntityRef &v)
 {
     v.persistentEntityId = j;
-    v.resolved = false;
 }
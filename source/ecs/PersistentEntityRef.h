@@ -8,14 +8,70 @@
 
 #include <json.hpp>
 
-#include <map>
+#include <vector>
 
+/**
+ * Lower 32 bits: slot index (starting at 1), upper 32 bits: generation of that slot. 0 means no entity.
+ */
 typedef uint64 PersistentEntityID;
 
+/**
+ * Registry context variable that maps PersistentEntityIDs to entities, using a slot table.
+ *
+ * When a persistent entity is destroyed its slot is reused with a higher generation,
+ * so refs to destroyed entities resolve to entt::null, and the table does not grow beyond the number of persistent entities.
+ * Slots of entities that will be revived (Persistent::revive) stay reserved.
+ */
 struct PersistentEntities
 {
-    PersistentEntityID idCounter;
-    std::map<PersistentEntityID, entt::entity> persistentEntityIdMap;
+    PersistentEntityID create(entt::entity);
+
+    /**
+     * For entities that already have an id, like entities loaded from a save.
+     */
+    void set(PersistentEntityID, entt::entity);
+
+    /**
+     * Returns false if the entity is not (yet) loaded.
+     * Returns true and `outEntity` = entt::null if the entity was destroyed (and will not be revived).
+     */
+    bool tryGet(PersistentEntityID, entt::entity &outEntity) const;
+
+    /**
+     * Frees the slots that were not claimed by set() since loadJson(). Call after loading all persistent entities.
+     */
+    void releaseUnclaimed();
+
+    void toJson(json &) const;
+
+    void loadJson(const json &);
+
+    /**
+     * Saves from before the slot table only have the last given id.
+     */
+    void loadLegacyIdCounter(PersistentEntityID idCounter);
+
+    /**
+     * Connected to on_destroy<Persistent> by the EntityEngine.
+     */
+    static void onDestroyed(entt::registry &, entt::entity);
+
+  private:
+
+    struct Slot
+    {
+        entt::entity entity = entt::null;
+        uint32 generation = 0;
+        bool bFree = false;
+    };
+
+    Slot &getSlot(uint32 index);
+
+    void release(uint32 index);
+
+    // index 0 is never used, so that id 0 can mean 'no entity'.
+    std::vector<Slot> slots;
+    std::vector<uint32> freeSlots;
 };
 
 struct PersistentEntityRef
@@ -35,8 +91,6 @@ struct PersistentEntityRef
     bool operator<(const PersistentEntityRef &other) const;
 
   private:
-    mutable bool resolved;
-    mutable entt::entity entity;
     PersistentEntityID persistentEntityId;
 
     friend void to_json(json &j, const PersistentEntityRef &v);
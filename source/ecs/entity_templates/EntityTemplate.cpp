@@ -1,6 +1,8 @@
 #include "EntityTemplate.h"
 #include "../EntityEngine.h"
 
+#include <utils/hashing.h>
+
 const std::string &EntityTemplate::getDescription()
 {
     static const std::string defaultDescription = "";
@@ -13,3 +15,14 @@ entt::entity EntityTemplate::create(bool persistent)
     createComponents(e, persistent);
     return e;
 }
+
+void EntityTemplate::createMany(int count, std::vector<entt::entity> &entitiesOut, bool persistent)
+{
+    entitiesOut.reserve(entitiesOut.size() + std::max(count, 0));
+    for (int i = 0; i < count; i++)
+        entitiesOut.push_back(create(persistent));
+}
+
+TemplateHandle::TemplateHandle(const std::string &templateName) : templateHash(hashStringCrossPlatform(templateName))
+{
+}
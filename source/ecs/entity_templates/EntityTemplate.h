@@ -5,7 +5,9 @@
 
 #include "../../../external/entt/src/entt/entity/registry.hpp"
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 
 class EntityEngine;
@@ -32,11 +34,48 @@ class EntityTemplate
 
     virtual void createComponents(entt::entity, bool persistent=false) = 0;
 
+    /**
+     * Creates `count` entities at once. Templates can override this to do the work that is the same for each entity only once.
+     */
+    virtual void createMany(int count, std::vector<entt::entity> &entitiesOut, bool persistent=false);
+
   protected:
 
     virtual ~EntityTemplate() = default;
 
 };
 
+/**
+ * Refers to an EntityTemplate by the hash of its name. See EntityEngine::getTemplate(const TemplateHandle &).
+ *
+ * The template is cached after the first lookup, until templates are added to or replaced in the engine.
+ * A handle can be used with multiple engines, but switching engines results in a new lookup.
+ */
+struct TemplateHandle
+{
+    TemplateHandle() = default;
+
+    explicit TemplateHandle(const std::string &templateName);
+
+    int getHash() const
+    {
+        return templateHash;
+    }
+
+    bool isSet() const
+    {
+        return templateHash != 0;
+    }
+
+  private:
+    friend class EntityEngine;
+
+    int templateHash = 0;
+
+    mutable EntityTemplate *cachedTemplate = nullptr;
+    // EntityEngine::templatesVersion at the time of caching. Unique for each engine, 0 means nothing is cached.
+    mutable uint32_t cachedVersion = 0;
+};
+
 
 #endif
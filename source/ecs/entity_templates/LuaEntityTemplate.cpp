@@ -2,10 +2,14 @@
 #include "../../game/SaveGame.h"
 #include "LuaEntityTemplate.h"
 #include "../../generated/LuaScripted.hpp"
+#include "../../generated/Children.hpp"
 
 #include <asset_manager/AssetManager.h>
 #include <utils/string_utils.h>
 
+#include <algorithm>
+#include <cstring>
+
 
 LuaEntityTemplate::LuaEntityTemplate(const char *assetName, const char *name, EntityEngine *engine_)
     : script(assetName), name(name),
@@ -65,6 +69,10 @@ LuaEntityTemplate::LuaEntityTemplate(const char *assetName, const char *name, En
         scripted.updateFunc = func;
         scripted.updateFuncScript = script;
     };
+    luaEnvironment["prefab"] = [&](bool bEnabled) {
+        bPrefab = bEnabled;
+        prefabs.clear();
+    };
     luaEnvironment["setOnDestroyCallback"] = [&](entt::entity entity, const sol::safe_function &func) {
 
         LuaScripted &scripted = engine->entities.get_or_assign<LuaScripted>(entity);
@@ -81,6 +89,9 @@ void LuaEntityTemplate::runScript()
     {
         // todo: use same lua_state as 'env' is in
 
+        bPrefab = false;
+        prefabs.clear();
+
         sol::protected_function_result result = luau::getLuaState().safe_script(script->getByteCode().as_string_view(), luaEnvironment);
         if (!result.valid())
             throw gu_err(result.get<sol::error>().what());
@@ -88,6 +99,9 @@ void LuaEntityTemplate::runScript()
         luaCreateComponents = luaEnvironment["create"];
         if (!luaCreateComponents.valid())
             throw gu_err("No create() function found!");
+
+        luaCreateBatch = luaEnvironment.raw_get<sol::optional<sol::safe_function>>("createBatch");
+        luaInitPrefabInstance = luaEnvironment.raw_get<sol::optional<sol::safe_function>>("initPrefabInstance");
     }
     catch (std::exception &e)
     {
@@ -112,14 +126,7 @@ void LuaEntityTemplate::createComponentsWithLuaArguments(entt::entity e, sol::op
 
     try
     {
-        if (arguments.has_value() && defaultArgs.valid())
-        {
-            for (auto &[key, defaultVal] : defaultArgs)
-            {
-                if (!arguments.value()[key].valid())
-                    arguments.value()[key] = defaultVal;
-            }
-        } else arguments = defaultArgs;
+        mergeDefaultArgs(arguments);
 
         LuaScripted& luaScripted = engine->entities.get_or_assign<LuaScripted>(e);
         if (luaScripted.usedTemplate == nullptr)
@@ -147,9 +154,8 @@ void LuaEntityTemplate::createComponentsWithLuaArguments(entt::entity e, sol::op
             }
             else
             {
-                persistentEntityID = ++engine->entities.ctx_or_set<PersistentEntities>().idCounter;
+                persistentEntityID = engine->entities.ctx_or_set<PersistentEntities>().create(e);
             }
-            engine->entities.ctx_or_set<PersistentEntities>().persistentEntityIdMap[persistentEntityID] = e;
 
             auto &p = engine->entities.assign_or_replace<Persistent>(e, persistency);
             if (!previousAppliedTemplate.empty())
@@ -167,18 +173,34 @@ void LuaEntityTemplate::createComponentsWithLuaArguments(entt::entity e, sol::op
 #endif
         }
 
-        sol::protected_function_result result = luaCreateComponents(
-            e,
-            arguments,
-            persistent
+        std::string prefabSignature;
+        if (const Prefab *prefab = findPrefab(arguments, persistent, prefabSignature))
+        {
+            instantiatePrefab(*prefab, e, arguments, persistent, luaScripted.saveData);
+        }
+        else
+        {
+            ComponentSnapshots componentsBefore;
+            if (!prefabSignature.empty())
+                componentsBefore = getComponentsOf(e, engine->entities);
+
+            luau::profiler::Scope profilerScope(name.c_str());
+            sol::protected_function_result result = luaCreateComponents(
+                e,
+                arguments,
+                persistent
 #ifndef DIBIDAB_NO_SAVE_GAME
-            ,
-            luaScripted.saveData
+                ,
+                luaScripted.saveData
 #endif
-        );
-        if (!result.valid())
-            throw gu_err(result.get<sol::error>().what());
-        // NOTE!!: ALL REFERENCES TO COMPONENTS MIGHT BE BROKEN AFTER CALLING createFunc. (EnTT might resize containers)
+            );
+            if (!result.valid())
+                throw gu_err(result.get<sol::error>().what());
+            // NOTE!!: ALL REFERENCES TO COMPONENTS MIGHT BE BROKEN AFTER CALLING createFunc. (EnTT might resize containers)
+
+            if (!prefabSignature.empty() && engine->entities.valid(e))
+                recordPrefab(e, std::move(prefabSignature), componentsBefore);
+        }
 
         if (persistent)
         {
@@ -193,6 +215,176 @@ void LuaEntityTemplate::createComponentsWithLuaArguments(entt::entity e, sol::op
     }
 }
 
+void LuaEntityTemplate::createMany(int count, std::vector<entt::entity> &entitiesOut, bool persistent)
+{
+    createManyWithLuaArguments(count, sol::optional<sol::table>(), persistent, entitiesOut);
+}
+
+void LuaEntityTemplate::createManyWithLuaArguments(int count, sol::optional<sol::table> arguments, bool persistent, std::vector<entt::entity> &entitiesOut)
+{
+    if (count <= 0)
+        return;
+    if (script.hasReloaded())
+        runScript();
+
+    const std::size_t firstIndex = entitiesOut.size();
+    entitiesOut.resize(firstIndex + count);
+    auto batchBegin = entitiesOut.begin() + firstIndex;
+    engine->entities.create(batchBegin, entitiesOut.end());
+
+    try
+    {
+        lua_State *lua = luaEnvironment.lua_state();
+
+        // all entities share the same arguments table, so the defaults are merged (and converted to json) only once:
+        mergeDefaultArgs(arguments);
+
+        json persistentData = json::object();
+        PersistentEntities *persistentEntities = nullptr;
+        if (persistent)
+        {
+            if (bPersistentArgs && arguments.value().valid())
+                jsonFromLuaTable(arguments.value(), persistentData);
+
+            persistentEntities = &engine->entities.ctx_or_set<PersistentEntities>();
+        }
+
+        sol::table entitiesTable = sol::table::create(lua, count, 0);
+
+#ifndef DIBIDAB_NO_SAVE_GAME
+        sol::table saveDatas = sol::table::create(lua, count, 0);
+        sol::table saveDataOfAllEntities = SaveGame::getSaveDataOfAllEntities(!persistent);
+
+        // one random ID for the whole batch, the index within the batch makes it unique for each entity:
+        const std::string batchID = arguments.value()["saveGameEntityID"].get_or<std::string, std::string>(getUniqueID()) + "_";
+#endif
+
+        for (int i = 0; i < count; i++)
+        {
+            const entt::entity e = *(batchBegin + i);
+            entitiesTable.raw_set(i + 1, e);
+
+            LuaScripted &luaScripted = engine->entities.assign<LuaScripted>(e);
+            luaScripted.usedTemplate = this;
+
+#ifndef DIBIDAB_NO_SAVE_GAME
+            const std::string id = batchID + std::to_string(i);
+            luaScripted.saveData = sol::table::create(lua);
+            saveDataOfAllEntities.raw_set(id, luaScripted.saveData);
+            saveDatas.raw_set(i + 1, luaScripted.saveData);
+#endif
+            if (persistent)
+            {
+                const PersistentEntityID persistentEntityID = persistentEntities->create(e);
+
+                auto &p = engine->entities.assign<Persistent>(e, persistency);
+                p.persistentId = persistentEntityID;
+                p.data = persistentData;
+#ifndef DIBIDAB_NO_SAVE_GAME
+                p.data["saveGameEntityID"] = id;
+#endif
+            }
+        }
+
+        std::string prefabSignature;
+        if (const Prefab *prefab = findPrefab(arguments, persistent, prefabSignature))
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const entt::entity e = *(batchBegin + i);
+                if (engine->entities.valid(e))
+                    instantiatePrefab(*prefab, e, arguments, persistent,
+#ifndef DIBIDAB_NO_SAVE_GAME
+                        saveDatas.raw_get<sol::table>(i + 1)
+#else
+                        sol::table()
+#endif
+                    );
+            }
+            prefabSignature.clear();
+        }
+        else if (luaCreateBatch.has_value())
+        {
+            luau::profiler::Scope profilerScope(name.c_str());
+            sol::protected_function_result result = luaCreateBatch.value()(
+                entitiesTable,
+                arguments,
+                persistent
+#ifndef DIBIDAB_NO_SAVE_GAME
+                ,
+                saveDatas
+#endif
+            );
+            if (!result.valid())
+                throw gu_err(result.get<sol::error>().what());
+        }
+        else for (int i = 0; i < count; i++)
+        {
+            const entt::entity e = *(batchBegin + i);
+            if (!engine->entities.valid(e))
+                continue;   // destroyed by the create() of an earlier entity in this batch.
+
+            ComponentSnapshots componentsBefore;
+            if (!prefabSignature.empty())
+                componentsBefore = getComponentsOf(e, engine->entities);
+            {
+                luau::profiler::Scope profilerScope(name.c_str());
+                sol::protected_function_result result = luaCreateComponents(
+                    e,
+                    arguments,
+                    persistent
+#ifndef DIBIDAB_NO_SAVE_GAME
+                    ,
+                    saveDatas.raw_get<sol::table>(i + 1)
+#endif
+                );
+                if (!result.valid())
+                    throw gu_err(result.get<sol::error>().what());
+            }
+
+            if (!prefabSignature.empty() && engine->entities.valid(e))
+            {
+                // the rest of the batch can be copied from this one:
+                recordPrefab(e, std::move(prefabSignature), componentsBefore);
+                prefabSignature.clear();
+
+                if (const Prefab *prefab = findPrefab(arguments, persistent, prefabSignature))
+                {
+                    for (i++; i < count; i++)
+                    {
+                        const entt::entity other = *(batchBegin + i);
+                        if (engine->entities.valid(other))
+                            instantiatePrefab(*prefab, other, arguments, persistent,
+#ifndef DIBIDAB_NO_SAVE_GAME
+                                saveDatas.raw_get<sol::table>(i + 1)
+#else
+                                sol::table()
+#endif
+                            );
+                    }
+                }
+                prefabSignature.clear();
+            }
+        }
+        // NOTE!!: ALL REFERENCES TO COMPONENTS MIGHT BE BROKEN AFTER CALLING createFunc. (EnTT might resize containers)
+
+        if (persistent)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const entt::entity e = *(batchBegin + i);
+                if (auto *p = engine->entities.valid(e) ? engine->entities.try_get<Persistent>(e) : nullptr)
+                    p->spawnPosition = engine->getPosition(e);
+            }
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Error while creating " << count << " entities using " << script.getLoadedAsset()->fullPath << ":" << std::endl;
+        std::cerr << e.what() << std::endl;
+    }
+}
+
 const std::string &LuaEntityTemplate::getDescription()
 {
     if (script.hasReloaded())
@@ -217,6 +409,180 @@ void LuaEntityTemplate::createComponentsWithJsonArguments(entt::entity e, const
     createComponentsWithLuaArguments(e, table, persistent);
 }
 
+void LuaEntityTemplate::mergeDefaultArgs(sol::optional<sol::table> &arguments)
+{
+    if (arguments.has_value() && defaultArgs.valid())
+    {
+        for (auto &[key, defaultVal] : defaultArgs)
+        {
+            if (!arguments.value()[key].valid())
+                arguments.value()[key] = defaultVal;
+        }
+    } else arguments = defaultArgs;
+}
+
+// so that templates with arguments that differ for every entity (like a position) do not keep on recording prefabs:
+constexpr int MAX_PREFABS_PER_TEMPLATE = 32;
+
+const LuaEntityTemplate::Prefab *LuaEntityTemplate::findPrefab(const sol::optional<sol::table> &arguments, bool persistent,
+    std::string &signatureOut)
+{
+    signatureOut.clear();
+    if (!bPrefab)
+        return nullptr;
+
+    json argumentsJson;
+    try
+    {
+        if (arguments.has_value() && arguments.value().valid())
+            jsonFromLuaTable(arguments.value(), argumentsJson);
+    }
+    catch (std::exception &)
+    {
+        return nullptr; // arguments that cannot be converted to json (like functions) cannot be compared either.
+    }
+    std::string signature = (persistent ? "p" : "") + argumentsJson.dump();
+
+    auto it = prefabs.find(signature);
+    if (it != prefabs.end())
+        return it->second.bValid ? &it->second : nullptr;
+
+    if (prefabs.size() < MAX_PREFABS_PER_TEMPLATE)
+        signatureOut = std::move(signature);
+    return nullptr;
+}
+
+/**
+ * Returns true if the function has upvalues other than _ENV, one of those could be the entity it was created for.
+ */
+static bool capturesLocals(const sol::safe_function &function)
+{
+    if (!function.valid() || function.get_type() != sol::type::function)
+        return false;
+
+    lua_State *lua = function.lua_state();
+    function.push(lua);
+    bool bCaptures = false;
+    for (int i = 1; const char *upvalueName = lua_getupvalue(lua, -1, i); i++)
+    {
+        lua_pop(lua, 1);
+        if (strcmp(upvalueName, "_ENV") != 0)
+        {
+            bCaptures = true;
+            break;
+        }
+    }
+    lua_pop(lua, 1);
+    return bCaptures;
+}
+
+void LuaEntityTemplate::recordPrefab(entt::entity e, std::string &&signature, const ComponentSnapshots &componentsBefore)
+{
+    Prefab &prefab = prefabs[std::move(signature)];
+    entt::registry &reg = engine->entities;
+
+    auto addedByCreate = [&] (const ComponentUtils *utils)
+    {
+        return utils->entityHasComponent(e, reg) && std::find_if(componentsBefore.begin(), componentsBefore.end(), [&] (auto &before)
+        {
+            return before.first == utils;
+        }) == componentsBefore.end();
+    };
+    if (addedByCreate(ComponentUtils::getFor<Parent>()) || addedByCreate(ComponentUtils::getFor<Child>()) || reg.has<EventEmitter>(e))
+    {
+        prefab.bValid = false;
+        return;
+    }
+    const ComponentUtils *luaScriptedUtils = ComponentUtils::getFor<LuaScripted>();
+    const ComponentUtils *persistentUtils = ComponentUtils::getFor<Persistent>();
+
+    // the copies would not get these changes, for example a Position3d set by a spawner that create() moved:
+    for (auto &[utils, jsonBefore] : componentsBefore)
+    {
+        if (utils == luaScriptedUtils || utils == persistentUtils)
+            continue;
+
+        json jsonAfter;
+        if (utils->entityHasComponent(e, reg))
+            utils->getJsonComponentWithKeys(jsonAfter, e, reg);
+        if (jsonAfter != jsonBefore)
+        {
+            prefab.bValid = false;
+            return;
+        }
+    }
+
+    for (const std::string &componentName : ComponentUtils::getAllComponentTypeNames())
+    {
+        const ComponentUtils *utils = ComponentUtils::getFor(componentName);
+        if (utils == luaScriptedUtils || utils == persistentUtils || !addedByCreate(utils))
+            continue;
+
+        std::shared_ptr<void> copy = utils->copyComponent(e, reg);
+        if (!copy)
+        {
+            prefab.bValid = false;
+            prefab.components.clear();
+            return;
+        }
+        prefab.components.emplace_back(utils, std::move(copy));
+    }
+    if (const LuaScripted *luaScripted = reg.try_get<LuaScripted>(e))
+    {
+        if (!luaScripted->coroutines.empty() || !luaScripted->timeoutFuncs.empty()
+            || capturesLocals(luaScripted->updateFunc) || capturesLocals(luaScripted->onDestroyFunc))
+        {
+            prefab.bValid = false;
+            prefab.components.clear();
+            return;
+        }
+        prefab.luaScripted = std::make_shared<LuaScripted>(*luaScripted);
+    }
+}
+
+LuaEntityTemplate::ComponentSnapshots LuaEntityTemplate::getComponentsOf(entt::entity e, const entt::registry &reg)
+{
+    ComponentSnapshots components;
+    for (const std::string &componentName : ComponentUtils::getAllComponentTypeNames())
+    {
+        const ComponentUtils *utils = ComponentUtils::getFor(componentName);
+        if (utils->entityHasComponent(e, reg))
+            utils->getJsonComponentWithKeys(components.emplace_back(utils, json()).second, e, reg);
+    }
+    return components;
+}
+
+void LuaEntityTemplate::instantiatePrefab(const Prefab &prefab, entt::entity e, const sol::optional<sol::table> &arguments,
+    bool persistent, const sol::table &saveData)
+{
+    entt::registry &reg = engine->entities;
+    for (auto &[utils, copy] : prefab.components)
+        utils->pasteComponent(copy, e, reg);
+
+    if (prefab.luaScripted)
+    {
+        LuaScripted &luaScripted = reg.get_or_assign<LuaScripted>(e);
+        // setUpdateFunction() spreads the updates of entities over frames with a random delay (unless it was disabled, then it is 0),
+        // so don't copy the recorded one.
+        if (prefab.luaScripted->updateAccumulator == 0)
+            luaScripted.updateAccumulator = 0;
+        else
+            luaScripted.updateAccumulator = prefab.luaScripted->updateFrequency * mu::random();
+        luaScripted.updateFrequency = prefab.luaScripted->updateFrequency;
+        luaScripted.updateFunc = prefab.luaScripted->updateFunc;
+        luaScripted.onDestroyFunc = prefab.luaScripted->onDestroyFunc;
+        luaScripted.updateFuncScript = prefab.luaScripted->updateFuncScript;
+        luaScripted.onDestroyFuncScript = prefab.luaScripted->onDestroyFuncScript;
+    }
+    if (luaInitPrefabInstance.has_value())
+    {
+        luau::profiler::Scope profilerScope(name.c_str());
+        sol::protected_function_result result = luaInitPrefabInstance.value()(e, arguments, persistent, saveData);
+        if (!result.valid())
+            throw gu_err(result.get<sol::error>().what());
+    }
+}
+
 std::string LuaEntityTemplate::getUniqueID()
 {
     return name + "_" + su::randomAlphanumeric(24);
@@ -10,6 +10,10 @@
 #include "../../macro_magic/component.h"
 #include "../../generated/Saving.hpp"
 
+#include <unordered_map>
+
+struct LuaScripted;
+
 class LuaEntityTemplate : public EntityTemplate
 {
   public:
@@ -29,6 +33,17 @@ class LuaEntityTemplate : public EntityTemplate
 
     void createComponentsWithLuaArguments(entt::entity, sol::optional<sol::table> arguments, bool persistent);
 
+    void createMany(int count, std::vector<entt::entity> &entitiesOut, bool persistent) override;
+
+    /**
+     * Creates `count` entities that all get the same arguments table. Default arguments are merged only once,
+     * and the template's create() function is only looked up once.
+     *
+     * If the template script defines `createBatch(entities, args, persistent, saveDatas)`,
+     * that function is called once for the whole batch instead of calling `create()` for each entity.
+     */
+    void createManyWithLuaArguments(int count, sol::optional<sol::table> arguments, bool persistent, std::vector<entt::entity> &entitiesOut);
+
     sol::environment &getTemplateEnvironment();
 
   protected:
@@ -36,15 +51,58 @@ class LuaEntityTemplate : public EntityTemplate
 
     std::string getUniqueID();
 
+    void mergeDefaultArgs(sol::optional<sol::table> &arguments);
+
   private:
+
+    /**
+     * The components that create() assigned to an entity, copied to the next entities that are created with the same arguments,
+     * without calling create() again. Enabled by calling `prefab(true)` in the template script.
+     *
+     * Per instance, only Persistent and LuaScripted::saveData differ.
+     * If the template script defines `initPrefabInstance(entity, args, persistent, saveData)`, that is called for each copy.
+     *
+     * Only components that create() added are recorded, not the ones the entity had already (like the spawner's).
+     * Copies are shallow, so no prefab is recorded when a component cannot be shared (see PrefabCopyable in component.h),
+     * or when a Lua function stored in LuaScripted could have captured the entity.
+     */
+    struct Prefab
+    {
+        std::vector<std::pair<const ComponentUtils *, std::shared_ptr<void>>> components;
+        std::shared_ptr<LuaScripted> luaScripted;
+        // false if create() did something that cannot be copied, like creating child entities, adding event listeners or a Brain,
+        // or changing a component that the entity already had.
+        bool bValid = true;
+    };
+
+    // returns nullptr if there is no prefab for these arguments (yet). `signatureOut` is empty if there can be no prefab.
+    const Prefab *findPrefab(const sol::optional<sol::table> &arguments, bool persistent, std::string &signatureOut);
+
+    using ComponentSnapshots = std::vector<std::pair<const ComponentUtils *, json>>;
+
+    // `componentsBefore`: the components the entity had before create() was called, these are not recorded.
+    // If create() changed or removed one of them, the prefab is invalid.
+    void recordPrefab(entt::entity, std::string &&signature, const ComponentSnapshots &componentsBefore);
+
+    static ComponentSnapshots getComponentsOf(entt::entity, const entt::registry &);
+
+    void instantiatePrefab(const Prefab &, entt::entity, const sol::optional<sol::table> &arguments, bool persistent,
+        const sol::table &saveData);
+
     std::string description;
     sol::table defaultArgs;
 
     sol::environment luaEnvironment;
     sol::safe_function luaCreateComponents;
+    sol::optional<sol::safe_function> luaCreateBatch;
 
     Persistent persistency;
     bool bPersistentArgs = false;
+
+    bool bPrefab = false;
+    // by arguments (as json) and persistency:
+    std::unordered_map<std::string, Prefab> prefabs;
+    sol::optional<sol::safe_function> luaInitPrefabInstance;
 };
 
 
@@ -1,9 +1,77 @@
 
 #include "AudioSystem.h"
 #include "../../generated/PlayerControlled.hpp"
+#include "../../generated/Position3d.hpp"
+#include "../../game/VoicePool.h"
 
-void AudioSystem::init(EntityEngine *engine)
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+// how often speakers are reconsidered for a voice, while there are virtual speakers:
+#define VOICE_REBALANCE_INTERVAL .25
+
+void AudioSystem::markChanged(entt::entity e)
+{
+    markChanged(engine->entities, e);
+}
+
+void AudioSystem::markChanged(entt::registry &reg, entt::entity e)
 {
+    if (reg.valid(e) && !reg.has<SoundSpeakerChanged>(e))
+    {
+        reg.assign<SoundSpeakerChanged>(e);
+    }
+}
+
+template<class Type, Type SoundSpeaker::*field>
+static void addMarkingProperty(sol::usertype<SoundSpeaker> &usertype, const char *name)
+{
+    usertype[name] = sol::property(
+        [] (const SoundSpeaker &speaker) -> Type
+        {
+            return speaker.*field;
+        },
+        [] (SoundSpeaker &speaker, Type value)
+        {
+            speaker.*field = std::move(value);
+            // not a speaker of an entity, e.g. a table that will be passed to setComponents():
+            if (speaker.registry == nullptr || speaker.registry->try_get<SoundSpeaker>(speaker.entity) != &speaker)
+                return;
+            AudioSystem::markChanged(*speaker.registry, speaker.entity);
+        }
+    );
+}
+
+void AudioSystem::addToLuaEnvironment(sol::state *lua)
+{
+    sol::usertype<SoundSpeaker> usertype = (*lua)["SoundSpeaker"];
+    addMarkingProperty<asset<au::Sound>, &SoundSpeaker::sound>(usertype, "sound");
+    addMarkingProperty<float, &SoundSpeaker::volume>(usertype, "volume");
+    addMarkingProperty<float, &SoundSpeaker::pitch>(usertype, "pitch");
+    addMarkingProperty<bool, &SoundSpeaker::looping>(usertype, "looping");
+    addMarkingProperty<bool, &SoundSpeaker::paused>(usertype, "paused");
+    addMarkingProperty<bool, &SoundSpeaker::stream>(usertype, "stream");
+    addMarkingProperty<int, &SoundSpeaker::priority>(usertype, "priority");
+}
+
+void AudioSystem::init(EntityEngine *inEngine)
+{
+    engine = inEngine;
+
+    engine->entities.on_construct<SoundSpeaker>().connect<&AudioSystem::onSpeakerChanged>(this);
+    engine->entities.on_replace<SoundSpeaker>().connect<&AudioSystem::onSpeakerChanged>(this);
+    ComponentUtils::onFieldsChanged<SoundSpeaker>(engine->entities).connect<&AudioSystem::onSpeakerChanged>(this);
+    engine->entities.view<SoundSpeaker>().each([&] (entt::entity e, auto &)
+    {
+        onSpeakerChanged(engine->entities, e);
+    });
+
+    engine->luaEnvironment["markSoundSpeakerChanged"] = [this] (entt::entity e)
+    {
+        markChanged(e);
+    };
+
     if (Room *room = dynamic_cast<Room *>(engine))
     {
         onPlayerLeft = room->getLevel().onPlayerLeftRoom += [&, room] (Room *r, auto) {
@@ -15,11 +83,18 @@ void AudioSystem::init(EntityEngine *engine)
 
             int paused = 0;
             r->entities.view<SoundSpeaker>().each([&](SoundSpeaker &speaker) {
-                if (speaker.pauseOnLeavingRoom && speaker.source && !speaker.source->isPaused())
+                if (!speaker.pauseOnLeavingRoom)
+                    return;
+                if (speaker.source && !speaker.source->isPaused())
                 {
                     speaker.source->pause();
                     paused++;
                 }
+                if (speaker.streamSource && !speaker.streamSource->isPaused())
+                {
+                    speaker.streamSource->pause();
+                    paused++;
+                }
             });
             if (paused > 0)
                 std::cout << "Paused " << paused << " sounds in room " << r->getIndexInLevel() << std::endl;
@@ -27,49 +102,253 @@ void AudioSystem::init(EntityEngine *engine)
     }
 }
 
+template<class Source>
+bool applySpeakerSettings(const SoundSpeaker &speaker, Source &source, bool roomActive)
+{
+    bool resumed = false;
+    if (roomActive && speaker.paused != source.isPaused())
+    {
+        if (speaker.paused)
+            source.pause();
+        else
+        {
+            source.play();
+            resumed = true;
+        }
+    }
+
+    source.setVolume(speaker.volume);
+    source.setLooping(speaker.looping);
+    source.setPitch(speaker.pitch);
+    return resumed;
+}
+
 void AudioSystem::update(double deltaTime, EntityEngine *room)
 {
+    time += deltaTime;
+
     int resumed = 0;
     bool roomActive = !room->entities.empty<LocalPlayer>();
-    room->entities.view<SoundSpeaker>().each([&](auto e, SoundSpeaker &speaker) {
+    if (roomActive && !bRoomWasActive)
+    {
+        // resume the sounds that were paused when the room became inactive:
+        room->entities.view<SoundSpeaker>().each([&](auto e, auto &) {
+            markChanged(e);
+        });
+    }
+    bRoomWasActive = roomActive;
 
-        if (roomActive && !speaker.paused && speaker.source && speaker.source->isPaused())
-        {
-            speaker.source->play();
-            resumed++;
-        }
+    bool bRebalance = false;
 
-        auto hash = speaker.getHash();
-        if (hash != speaker.prevHash)
-        {
-            // speaker settings have changed, update SoundSource:
+    auto changedView = room->entities.view<SoundSpeakerChanged, SoundSpeaker>();
+    for (entt::entity e : changedView)
+    {
+        SoundSpeaker &speaker = changedView.get<SoundSpeaker>(e);
 
-            if (!speaker.source && speaker.sound.isSet())
-            {
-                speaker.source = std::make_shared<au::SoundSource>(speaker.sound.get());
-                speaker.source->play();
-            }
+        // switched between streaming and not streaming:
+        if (isStreamed(speaker))
+            speaker.source = nullptr;
+        else
+            speaker.streamSource = nullptr;
 
-            if (speaker.source)
-            {
-                if (roomActive && speaker.paused != speaker.source->isPaused())
-                {
-                    if (speaker.paused)
-                        speaker.source->pause();
-                    else
-                        speaker.source->play();
-                }
+        if (!speaker.sound.isSet())
+            room->entities.remove_if_exists<SoundSpeakerVirtual>(e);
 
-                speaker.source->setVolume(speaker.volume);
-                speaker.source->setLooping(speaker.looping);
-                speaker.source->setPitch(speaker.pitch);
+        else if (!speaker.source && !speaker.streamSource && !room->entities.has<SoundSpeakerVirtual>(e))
+        {
+            if (!startVoice(speaker, 0.f))
+            {
+                // all voices are in use, rebalanceVoices() decides whether this speaker gets one.
+                speaker.playbackStart = time;
+                room->entities.assign<SoundSpeakerVirtual>(e);
+                bRebalance = true;
             }
-            speaker.prevHash = hash;
         }
-        if (!speaker.looping && speaker.source && speaker.source->hasStopped())
-            room->entities.remove<SoundSpeaker>(e);
-    });
+
+        if (speaker.source && applySpeakerSettings(speaker, *speaker.source, roomActive))
+            resumed++;
+        if (speaker.streamSource && applySpeakerSettings(speaker, *speaker.streamSource, roomActive))
+            resumed++;
+
+        if (!speaker.looping && (speaker.source || speaker.streamSource))
+            room->entities.assign_or_replace<SoundSpeakerPlayingOnce>(e);
+        else
+            room->entities.remove_if_exists<SoundSpeakerPlayingOnce>(e);
+    }
+    room->entities.clear<SoundSpeakerChanged>();
+
+    std::vector<entt::entity> stopped;
+    auto playingOnceView = room->entities.view<SoundSpeakerPlayingOnce, SoundSpeaker>();
+    for (entt::entity e : playingOnceView)
+    {
+        SoundSpeaker &speaker = playingOnceView.get<SoundSpeaker>(e);
+        if ((speaker.source && speaker.source->hasStopped()) || (speaker.streamSource && speaker.streamSource->hasStopped()))
+            stopped.push_back(e);
+    }
+    for (entt::entity e : stopped)
+    {
+        room->entities.remove<SoundSpeaker>(e);
+        room->entities.remove<SoundSpeakerPlayingOnce>(e);
+    }
+
+    timeUntilRebalance -= deltaTime;
+    if (bRebalance || (timeUntilRebalance <= 0 && !room->entities.empty<SoundSpeakerVirtual>()))
+    {
+        rebalanceVoices(room, roomActive);
+        timeUntilRebalance = VOICE_REBALANCE_INTERVAL;
+    }
+
     if (resumed > 0)
         std::cout << "Resumed " << resumed << " sounds in room" << std::endl;
 }
 
+// files that could not be opened for streaming, these are played from the decoded au::Sound instead:
+static std::unordered_set<std::string> unstreamablePaths;
+
+bool AudioSystem::isStreamed(const SoundSpeaker &speaker)
+{
+    if (!speaker.sound.isSet())
+        return false;
+    const std::string &path = speaker.sound.getLoadedAsset()->fullPath;
+    return (speaker.stream || SoundStream::isStreamedOnly(path)) && unstreamablePaths.count(path) == 0;
+}
+
+bool AudioSystem::startVoice(SoundSpeaker &speaker, float playbackPosition)
+{
+    const std::string &path = speaker.sound.getLoadedAsset()->fullPath;
+    if (isStreamed(speaker))
+    {
+        try
+        {
+            speaker.streamSource = VoicePool::get().acquireStream(path);
+        }
+        catch (std::exception &exc)
+        {
+            std::cerr << "Could not stream " << path << ", playing the decoded sound instead:\n" << exc.what() << std::endl;
+            unstreamablePaths.insert(path);
+            return startVoice(speaker, playbackPosition);
+        }
+        if (!speaker.streamSource)
+            return false;
+
+        const float length = speaker.streamSource->getLength();
+        if (speaker.looping && length > 0.f)
+            playbackPosition = std::fmod(playbackPosition, length);
+        speaker.streamSource->setPlaybackPosition(playbackPosition);
+        speaker.streamSource->play();
+    }
+    else if (SoundStream::isStreamedOnly(path))
+    {
+        // streaming failed, and the file was too large to be decoded at load time, so there is nothing to play.
+        return true;
+    }
+    else
+    {
+        speaker.source = VoicePool::get().acquire(speaker.sound);
+        if (!speaker.source)
+            return false;
+
+        // au::SoundSource cannot seek, so it starts at the beginning.
+        playbackPosition = 0.f;
+        speaker.source->play();
+    }
+    speaker.playbackStart = time - playbackPosition;
+    return true;
+}
+
+void AudioSystem::rebalanceVoices(EntityEngine *room, bool roomActive)
+{
+    vec3 listenerPosition(0);
+    bool bHasListener = false;
+    auto listenerView = room->entities.view<LocalPlayer, Position3d>();
+    for (entt::entity e : listenerView)
+    {
+        listenerPosition = listenerView.get<Position3d>(e).vec;
+        bHasListener = true;
+        break;
+    }
+
+    struct Candidate
+    {
+        int priority;
+        float audibility;
+        entt::entity e;
+        bool bReal;
+    };
+    std::vector<Candidate> candidates;
+    int numVoices = VoicePool::get().getNumFreeVoices();
+
+    room->entities.view<SoundSpeaker>().each([&](entt::entity e, SoundSpeaker &speaker) {
+
+        const bool bReal = speaker.source || speaker.streamSource;
+        if (!bReal && !room->entities.has<SoundSpeakerVirtual>(e))
+            return;
+        if (speaker.paused || (!roomActive && speaker.pauseOnLeavingRoom))
+            return; // keeps its voice, if it has one.
+
+        float distance = 0.f;
+        if (bHasListener)
+            if (const Position3d *position = room->entities.try_get<Position3d>(e))
+                distance = length(position->vec - listenerPosition);
+
+        candidates.push_back({ speaker.priority, speaker.volume / (1.f + distance), e, bReal });
+        if (bReal)
+            numVoices++;
+    });
+    std::sort(candidates.begin(), candidates.end(), [] (const Candidate &a, const Candidate &b) {
+        return a.priority != b.priority ? a.priority > b.priority : a.audibility > b.audibility;
+    });
+
+    std::vector<entt::entity> toStart, toRemove;
+    for (int i = 0; i < int(candidates.size()); i++)
+    {
+        const Candidate &candidate = candidates[i];
+        if (i < numVoices)
+        {
+            if (!candidate.bReal)
+                toStart.push_back(candidate.e);
+            continue;
+        }
+        SoundSpeaker &speaker = room->entities.get<SoundSpeaker>(candidate.e);
+        if (candidate.bReal)
+        {
+            // virtualize, this gives the voice back to the pool:
+            speaker.source = nullptr;
+            speaker.streamSource = nullptr;
+            room->entities.remove_if_exists<SoundSpeakerPlayingOnce>(candidate.e);
+            room->entities.assign<SoundSpeakerVirtual>(candidate.e);
+        }
+        // a non-looping sound that cannot be heard now is not continued later:
+        if (!speaker.looping)
+            toRemove.push_back(candidate.e);
+    }
+
+    for (entt::entity e : toStart)
+    {
+        SoundSpeaker &speaker = room->entities.get<SoundSpeaker>(e);
+        if (!startVoice(speaker, float(time - speaker.playbackStart)))
+            continue; // taken by another room in the meantime.
+
+        room->entities.remove<SoundSpeakerVirtual>(e);
+        if (speaker.source)
+            applySpeakerSettings(speaker, *speaker.source, roomActive);
+        if (speaker.streamSource)
+            applySpeakerSettings(speaker, *speaker.streamSource, roomActive);
+        if (!speaker.looping)
+            room->entities.assign_or_replace<SoundSpeakerPlayingOnce>(e);
+    }
+    for (entt::entity e : toRemove)
+    {
+        room->entities.remove_if_exists<SoundSpeakerVirtual>(e);
+        room->entities.remove<SoundSpeaker>(e);
+    }
+}
+
+void AudioSystem::onSpeakerChanged(entt::registry &reg, entt::entity e)
+{
+    // a new or replaced speaker does not know its entity yet:
+    SoundSpeaker &speaker = reg.get<SoundSpeaker>(e);
+    speaker.registry = &reg;
+    speaker.entity = e;
+    markChanged(e);
+}
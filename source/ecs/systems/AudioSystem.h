@@ -7,18 +7,85 @@
 #include "../../game/dibidab.h"
 #include "../../generated/SoundSpeaker.hpp"
 
+/**
+ * Tag for SoundSpeakers whose settings still have to be applied to their source.
+ */
+struct SoundSpeakerChanged
+{};
+
+/**
+ * Tag for SoundSpeakers that are playing a non-looping sound. Only these are checked for having stopped.
+ */
+struct SoundSpeakerPlayingOnce
+{};
+
+/**
+ * Tag for SoundSpeakers that should play, but have no voice (see VoicePool). Their playback time is still tracked.
+ */
+struct SoundSpeakerVirtual
+{};
+
+/**
+ * Plays the sounds of SoundSpeakers.
+ *
+ * Speakers are only looked at when they changed: when SoundSpeaker is assigned/replaced, set by ComponentUtils (from json or Lua),
+ * when a field is set from Lua, or after markChanged().
+ * A speaker that played its non-looping sound to the end is removed.
+ *
+ * When all voices are in use, speakers with the lowest SoundSpeaker::priority (then the quietest and furthest from the local player)
+ * are made virtual. Virtual looping speakers get a voice again when one is available, streamed sounds continue where they would have been.
+ * Non-looping speakers that lose their voice are removed.
+ */
 class AudioSystem : public EntitySystem
 {
     using EntitySystem::EntitySystem;
 
     delegate_method onPlayerLeft;
 
+  public:
+
+    /**
+     * Needed after changing a SoundSpeaker in place (Lua: markSoundSpeakerChanged(entity)).
+     */
+    void markChanged(entt::entity);
+
+    static void markChanged(entt::registry &, entt::entity);
+
+    /**
+     * Replaces the Lua properties of SoundSpeaker by ones that also mark the speaker as changed.
+     * Must be called after the usertypes of the components are registered.
+     */
+    static void addToLuaEnvironment(sol::state *lua);
+
   protected:
 
     void init(EntityEngine *engine) override;
 
     void update(double deltaTime, EntityEngine *room) override;
 
+  private:
+
+    static bool isStreamed(const SoundSpeaker &);
+
+    /**
+     * Returns false if there was no voice available.
+     * If the sound cannot be streamed, an error is logged and the decoded sound is played instead.
+     */
+    bool startVoice(SoundSpeaker &, float playbackPosition);
+
+    /**
+     * Gives the free voices and the voices of this room to the speakers with the highest priority.
+     */
+    void rebalanceVoices(EntityEngine *room, bool roomActive);
+
+    void onSpeakerChanged(entt::registry &, entt::entity);
+
+    EntityEngine *engine = nullptr;
+
+    bool bRoomWasActive = false;
+
+    double time = 0.;
+    double timeUntilRebalance = 0.;
 };
 
 
@@ -3,6 +3,7 @@
 
 #include "../EntityEngine.h"
 #include "../../ai/behavior_trees/BehaviorTree.h"
+#include "../../ai/behavior_trees/CompiledBehaviorTree.h"
 
 #include "../../generated/Brain.hpp"
 
@@ -23,6 +24,33 @@ void BehaviorTreeSystem::init(EntityEngine *engine)
         brain.behaviorTree.setRootNode(node);
         engine->entities.assign<BrainPendingActivation>(e);
     };
+    engine->luaEnvironment["component"]["Brain"]["setCompiledBehaviorTreeFor"] = [engine] (entt::entity e, const std::shared_ptr<CompiledBehaviorTree> &tree)
+    {
+        if (!engine->entities.valid(e))
+        {
+            throw gu_err("Entity " + std::to_string(int(e)) + " is not valid!");
+        }
+        if (!tree)
+        {
+            throw gu_err("No compiled behavior tree given for entity " + std::to_string(int(e)));
+        }
+        Brain &brain = engine->entities.get_or_assign<Brain>(e);
+        if (brain.compiledBehaviorTree)
+        {
+            throw gu_err("A compiled behavior tree was already set for entity " + std::to_string(int(e)));
+        }
+        brain.compiledBehaviorTree = std::make_shared<CompiledBehaviorTree::Instance>(tree, engine, e);
+        engine->entities.assign<BrainPendingActivation>(e);
+    };
+
+    engine->luaEnvironment["setBehaviorTreeTraceEnabled"] = [this] (bool bEnabled, sol::optional<int> capacity)
+    {
+        trace.setEnabled(bEnabled, uint32_t(capacity.value_or(1 << 16)));
+    };
+    engine->luaEnvironment["dumpBehaviorTreeTrace"] = [this, engine] (const char *path)
+    {
+        return trace.dump(path, *engine);
+    };
 }
 
 void BehaviorTreeSystem::update(double deltaTime, EntityEngine *engine)
@@ -31,8 +59,14 @@ void BehaviorTreeSystem::update(double deltaTime, EntityEngine *engine)
     {
         if (Brain *brain = engine->entities.try_get<Brain>(e))
         {
-            if (BehaviorTree::Node *rootNode = brain->behaviorTree.getRootNode())
+            if (std::shared_ptr<CompiledBehaviorTree::Instance> compiledTree = brain->compiledBehaviorTree)
+            {
+                compiledTree->setTrace(&trace);
+                compiledTree->enterRoot();
+            }
+            else if (BehaviorTree::Node *rootNode = brain->behaviorTree.getRootNode())
             {
+                brain->behaviorTree.setTrace(&trace, e);
                 rootNode->enter();
             }
         }
@@ -3,6 +3,7 @@
 #define GAME_BEHAVIORTREESYSTEM_H
 
 #include "EntitySystem.h"
+#include "../../ai/behavior_trees/BehaviorTreeTrace.h"
 
 class BehaviorTreeSystem : public EntitySystem
 {
@@ -12,6 +13,10 @@ class BehaviorTreeSystem : public EntitySystem
     void init(EntityEngine *engine) override;
 
     void update(double deltaTime, EntityEngine *engine) override;
+
+  public:
+    // Disabled by default, see setBehaviorTreeTraceEnabled() and dumpBehaviorTreeTrace() in Lua.
+    BehaviorTreeTrace trace;
 };
 
 
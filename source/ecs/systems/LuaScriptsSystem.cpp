@@ -1,18 +1,163 @@
 
 #include "LuaScriptsSystem.h"
 
+#include "../entity_templates/LuaEntityTemplate.h"
+#include "../../macro_magic/component.h"
+
 #include <asset_manager/AssetManager.h>
 
 // https://github.com/skypjack/entt/issues/17
 
+// used to label the Lua profiler's samples.
+static const char *getTemplateName(const entt::registry &reg, entt::entity e)
+{
+    const LuaScripted *scripted = reg.try_get<LuaScripted>(e);
+    return scripted && scripted->usedTemplate ? scripted->usedTemplate->name.c_str() : nullptr;
+}
+
 void LuaScriptsSystem::init(EntityEngine *room)
 {
     engine = room;
     room->entities.on_destroy<LuaScripted>().connect<&LuaScriptsSystem::onDestroyed>(this);
+
+    auto &env = room->luaEnvironment;
+
+    env["startCoroutine"] = [this] (entt::entity e, const sol::function &func)
+    {
+        startCoroutine(e, func);
+    };
+    env["wait"] = sol::yielding([this] (sol::this_state lua, double seconds)
+    {
+        timers.push({ time + seconds, getRunningCoroutine(lua, "wait") });
+    });
+    env["waitForEvent"] = sol::yielding([this] (sol::this_state lua, const char *eventName, sol::optional<entt::entity> emitterEntity)
+    {
+        const std::shared_ptr<LuaCoroutine> &waitingCoroutine = getRunningCoroutine(lua, "waitForEvent");
+        std::weak_ptr<LuaCoroutine> coroutine = waitingCoroutine;
+
+        // the coroutine is resumed right away, because the event might be a pointer that is only valid during emit().
+        sol::function listener = sol::make_object(lua, [this, coroutine, alive = bAlive] (const sol::object &event, const sol::function &removeListener)
+        {
+            removeListener();
+            if (!*alive)
+                return;
+            if (std::shared_ptr<LuaCoroutine> lockedCoroutine = coroutine.lock())
+                resume(lockedCoroutine, event);
+        }).as<sol::function>();
+
+        if (emitterEntity.has_value())
+            waitingCoroutine->eventWait = engine->entities.get_or_assign<EventEmitter>(emitterEntity.value()).onWithHandle(eventName, listener);
+        else
+            waitingCoroutine->eventWait = engine->events.onWithHandle(eventName, listener);
+    });
+    env["waitForComponent"] = sol::yielding([this] (sol::this_state lua, const sol::table &componentTable, sol::optional<entt::entity> entity)
+    {
+        const std::shared_ptr<LuaCoroutine> &coroutine = getRunningCoroutine(lua, "waitForComponent");
+        const ComponentUtils *componentUtils = ComponentUtils::getFromLuaComponentTable(componentTable);
+        const entt::entity observedEntity = entity.value_or(coroutine->entity);
+
+        // resuming is always done in the next update, resuming from within an EnTT signal is not safe.
+        if (componentUtils->entityHasComponent(observedEntity, engine->entities))
+        {
+            toResumeNextUpdate.push_back(coroutine);
+            return;
+        }
+        EntityObserver *observer = componentUtils->getEntityObserver(engine->entities);
+        std::weak_ptr<LuaCoroutine> weakCoroutine = coroutine;
+
+        coroutine->componentWaitObserver = observer;
+        coroutine->componentWait.emplace(observer->onConstruct(observedEntity, [this, observer, weakCoroutine, alive = bAlive]
+        {
+            if (!*alive)
+                return;
+            if (std::shared_ptr<LuaCoroutine> lockedCoroutine = weakCoroutine.lock())
+            {
+                observer->unregister(lockedCoroutine->componentWait.value());
+                lockedCoroutine->componentWait.reset();
+                toResumeNextUpdate.push_back(lockedCoroutine);
+            }
+        }));
+    });
+}
+
+LuaCoroutine::~LuaCoroutine()
+{
+    // when the engine is destructing, the observers might be destroyed already (and would be destroyed anyway).
+    if (componentWait.has_value() && !engine->isDestructing())
+        componentWaitObserver->unregister(componentWait.value());
+}
+
+void LuaScriptsSystem::startCoroutine(entt::entity e, const sol::function &func)
+{
+    auto coroutine = std::make_shared<LuaCoroutine>();
+    coroutine->engine = engine;
+    coroutine->entity = e;
+    coroutine->thread = sol::thread::create(func.lua_state());
+    coroutine->coroutine = sol::coroutine(coroutine->thread.thread_state(), func);
+
+    engine->entities.get_or_assign<LuaScripted>(e).coroutines.push_back(coroutine);
+
+    resume(coroutine, sol::make_object(func.lua_state(), e));
+}
+
+void LuaScriptsSystem::resume(const std::shared_ptr<LuaCoroutine> &coroutine, const sol::object &resumeValue)
+{
+    if (!engine->entities.valid(coroutine->entity))
+        return;
+
+    // a coroutine can resume another one (by emitting an event), so remember which one was running:
+    std::shared_ptr<LuaCoroutine> previouslyRunning = runningCoroutine;
+    runningCoroutine = coroutine;
+
+    sol::protected_function_result result;
+    {
+        luau::profiler::Scope profilerScope(getTemplateName(engine->entities, coroutine->entity));
+        if (luau::profiler::isEnabled())
+            luau::profiler::installHook(coroutine->thread.thread_state());
+
+        result = coroutine->coroutine(resumeValue);
+    }
+
+    runningCoroutine = previouslyRunning;
+
+    if (!result.valid())
+    {
+        sol::error error = result;
+        std::cerr << "Error in coroutine of entity#" << int(coroutine->entity) << ":" << std::endl;
+        std::cerr << error.what() << std::endl;
+    }
+    if (result.status() != sol::call_status::yielded)
+    {
+        if (LuaScripted *scripted = engine->entities.valid(coroutine->entity) ? engine->entities.try_get<LuaScripted>(coroutine->entity) : nullptr)
+            scripted->coroutines.remove(coroutine);
+    }
+}
+
+const std::shared_ptr<LuaCoroutine> &LuaScriptsSystem::getRunningCoroutine(lua_State *lua, const char *functionName) const
+{
+    if (!runningCoroutine || runningCoroutine->thread.thread_state() != lua)
+        throw gu_err(std::string(functionName) + "() can only be called from a coroutine started with startCoroutine()");
+    return runningCoroutine;
 }
 
 void LuaScriptsSystem::update(double deltaTime, EntityEngine *room)
 {
+    time += deltaTime;
+
+    // collect first, a coroutine might call wait(0) again when resumed.
+    std::vector<std::weak_ptr<LuaCoroutine>> coroutinesToResume;
+    coroutinesToResume.swap(toResumeNextUpdate);
+    while (!timers.empty() && timers.top().time <= time)
+    {
+        coroutinesToResume.push_back(timers.top().coroutine);
+        timers.pop();
+    }
+    for (std::weak_ptr<LuaCoroutine> &coroutine : coroutinesToResume)
+    {
+        if (std::shared_ptr<LuaCoroutine> lockedCoroutine = coroutine.lock())
+            resume(lockedCoroutine, sol::object());
+    }
+
     std::vector<std::tuple<double, entt::entity, sol::safe_function>> updatesToCall;
     std::vector<std::pair<entt::entity, sol::safe_function>> timeoutsToCall;
 
@@ -57,6 +202,7 @@ void LuaScriptsSystem::update(double deltaTime, EntityEngine *room)
     {
         if (room->entities.valid(entity))
         {
+            luau::profiler::Scope profilerScope(getTemplateName(room->entities, entity));
             luau::tryCallFunction(function, updateTimeDelta, entity);
         }
     }
@@ -64,6 +210,7 @@ void LuaScriptsSystem::update(double deltaTime, EntityEngine *room)
     {
         if (room->entities.valid(entity))
         {
+            luau::profiler::Scope profilerScope(getTemplateName(room->entities, entity));
             luau::tryCallFunction(function, entity);
         }
     }
@@ -81,6 +228,7 @@ void LuaScriptsSystem::onDestroyed(entt::registry &reg, entt::entity e)
         sol::table saveData = scripted.saveData;
         // cpy and saveData are copied because EnTT might move them if the lua script causes a `LuaScripted` component to be created
 
+        luau::profiler::Scope profilerScope(getTemplateName(reg, e));
         luau::callFunction(cpy, e, saveData);
     }
     catch (std::exception &exc)
@@ -93,6 +241,7 @@ void LuaScriptsSystem::onDestroyed(entt::registry &reg, entt::entity e)
 
 LuaScriptsSystem::~LuaScriptsSystem()
 {
+    *bAlive = false;
     engine->entities.view<LuaScripted>().each([&] (auto e, auto) {
         onDestroyed(engine->entities, e);
     });
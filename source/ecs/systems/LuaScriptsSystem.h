@@ -6,12 +6,47 @@
 #include "../../level/room/Room.h"
 #include "../../generated/LuaScripted.hpp"
 
+#include <optional>
+#include <queue>
+
+/**
+ * A Lua function running as a coroutine for an entity. Owned by the entity's LuaScripted component.
+ */
+class LuaCoroutine
+{
+  public:
+    EntityEngine *engine = nullptr;
+    entt::entity entity = entt::null;
+    sol::thread thread;
+    sol::coroutine coroutine;
+
+    // set while waiting for an event, the listener is removed when the coroutine is dropped before the event is emitted.
+    EventEmitter::ListenerHandle eventWait;
+
+    // set while waiting for a component to be added.
+    std::optional<EntityObserver::Handle> componentWait;
+    EntityObserver *componentWaitObserver = nullptr;
+
+    ~LuaCoroutine();
+};
+
 class LuaScriptsSystem : public EntitySystem
 {
     using EntitySystem::EntitySystem;
 
     EntityEngine *engine;
 
+  public:
+
+    /**
+     * Runs `func(entity)` as a coroutine until it calls wait(seconds), waitForEvent(name, entity?) or
+     * waitForComponent(componentTable, entity?). The coroutine is then parked until it is due,
+     * a parked coroutine does not cost anything per frame.
+     *
+     * The coroutine is dropped when the entity (or its LuaScripted component) is destroyed.
+     */
+    void startCoroutine(entt::entity, const sol::function &func);
+
   protected:
     void init(EntityEngine *) override;
 
@@ -21,6 +56,32 @@ class LuaScriptsSystem : public EntitySystem
 
     ~LuaScriptsSystem() override;
 
+  private:
+
+    struct Timer
+    {
+        double time;
+        std::weak_ptr<LuaCoroutine> coroutine;
+
+        bool operator>(const Timer &other) const
+        {
+            return time > other.time;
+        }
+    };
+
+    void resume(const std::shared_ptr<LuaCoroutine> &, const sol::object &resumeValue);
+
+    // throws if not called from the coroutine that is currently resumed by this system.
+    const std::shared_ptr<LuaCoroutine> &getRunningCoroutine(lua_State *, const char *functionName) const;
+
+    double time = 0.;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<std::weak_ptr<LuaCoroutine>> toResumeNextUpdate;
+    std::shared_ptr<LuaCoroutine> runningCoroutine;
+
+    // shared with the event listeners of waiting coroutines, which can outlive this system.
+    std::shared_ptr<bool> bAlive = std::make_shared<bool>(true);
+
 };
 
 
@@ -0,0 +1,311 @@
+#include "SpatialIndexSystem.h"
+
+#include <algorithm>
+#include <limits>
+
+constexpr int CELL_COORD_BITS = 21;
+constexpr int CELL_COORD_OFFSET = 1 << (CELL_COORD_BITS - 1);
+constexpr uint64 CELL_COORD_MASK = (uint64(1) << CELL_COORD_BITS) - 1;
+
+void SpatialIndexSystem::setCellSize(float size)
+{
+    if (size <= 0.f)
+    {
+        throw gu_err("Cell size of the spatial index must be positive, got " + std::to_string(size));
+    }
+    if (size == cellSize)
+    {
+        return;
+    }
+    cellSize = size;
+    if (engine == nullptr)
+    {
+        return;
+    }
+    cells.clear();
+    entries.clear();
+    movedEntities.clear();
+    engine->entities.view<Position3d>().each([&] (entt::entity e, const Position3d &position)
+    {
+        insert(e, getCellKey(getCell(position.vec)));
+    });
+}
+
+float SpatialIndexSystem::getCellSize() const
+{
+    return cellSize;
+}
+
+void SpatialIndexSystem::markMoved(entt::entity e)
+{
+    auto entryIt = entries.find(e);
+    if (entryIt != entries.end() && !entryIt->second.bMoved)
+    {
+        entryIt->second.bMoved = true;
+        movedEntities.push_back(e);
+    }
+}
+
+void SpatialIndexSystem::refresh()
+{
+    moveMarked();
+    engine->entities.view<Position3d>().each([&] (entt::entity e, const Position3d &position)
+    {
+        move(e, position.vec);
+    });
+}
+
+void SpatialIndexSystem::getInRadius(const vec3 &center, float radius, std::vector<entt::entity> &out,
+    const ComponentUtils *filter) const
+{
+    const float radius2 = radius * radius;
+    forEachInCells(center - radius, center + radius, [&] (entt::entity e, const vec3 &position)
+    {
+        const vec3 diff = position - center;
+        if (dot(diff, diff) <= radius2 && (!filter || filter->entityHasComponent(e, engine->entities)))
+        {
+            out.push_back(e);
+        }
+    });
+}
+
+void SpatialIndexSystem::getInBox(const vec3 &min, const vec3 &max, std::vector<entt::entity> &out,
+    const ComponentUtils *filter) const
+{
+    forEachInCells(min, max, [&] (entt::entity e, const vec3 &position)
+    {
+        if (all(greaterThanEqual(position, min)) && all(lessThanEqual(position, max))
+            && (!filter || filter->entityHasComponent(e, engine->entities)))
+        {
+            out.push_back(e);
+        }
+    });
+}
+
+void SpatialIndexSystem::getNearest(const vec3 &center, int k, float maxRadius, std::vector<entt::entity> &out,
+    const ComponentUtils *filter) const
+{
+    if (k <= 0 || entries.empty())
+    {
+        return;
+    }
+    const float maxRadius2 = maxRadius * maxRadius;
+    // squared distance and entity, the k nearest found so far, sorted:
+    std::vector<std::pair<float, entt::entity>> nearest;
+    nearest.reserve(k + 1);
+
+    auto consider = [&] (entt::entity e, const vec3 &position)
+    {
+        const vec3 diff = position - center;
+        const float distance2 = dot(diff, diff);
+        if (distance2 > maxRadius2 || (int(nearest.size()) == k && distance2 >= nearest.back().first))
+        {
+            return;
+        }
+        if (filter && !filter->entityHasComponent(e, engine->entities))
+        {
+            return;
+        }
+        nearest.insert(std::upper_bound(nearest.begin(), nearest.end(), std::make_pair(distance2, e)), { distance2, e });
+        if (int(nearest.size()) > k)
+        {
+            nearest.pop_back();
+        }
+    };
+
+    // Visit the cells in shells around the center cell.
+    // After visiting shell n, all entities that were not visited are more than n * cellSize away.
+    const ivec3 centerCell = getCell(center);
+    for (int shell = 0; true; shell++)
+    {
+        const uint64 shellWidth = 2 * shell + 1;
+        const uint64 numCellsInShell = shell == 0 ? 1 : shellWidth * shellWidth * shellWidth - (shellWidth - 2) * (shellWidth - 2) * (shellWidth - 2);
+        if (numCellsInShell > cells.size())
+        {
+            // the shell has more cells than there are occupied cells, just check the remaining entities.
+            forEachInCells(center - maxRadius, center + maxRadius, [&] (entt::entity e, const vec3 &position)
+            {
+                const ivec3 cell = getCell(position);
+                if (any(greaterThanEqual(abs(cell - centerCell), ivec3(shell))))
+                {
+                    consider(e, position);
+                }
+            });
+            break;
+        }
+        for (int x = -shell; x <= shell; x++)
+        {
+            for (int y = -shell; y <= shell; y++)
+            {
+                const bool bOnShellXY = abs(x) == shell || abs(y) == shell;
+                for (int z = -shell; z <= shell; z += bOnShellXY ? 1 : 2 * std::max(shell, 1))
+                {
+                    auto it = cells.find(getCellKey(centerCell + ivec3(x, y, z)));
+                    if (it != cells.end())
+                    {
+                        forEachInCell(it->second, consider);
+                    }
+                }
+            }
+        }
+        const float searched = shell * cellSize;
+        if (searched >= maxRadius || (int(nearest.size()) == k && nearest.back().first <= searched * searched))
+        {
+            break;
+        }
+    }
+    for (auto &[distance2, e] : nearest)
+    {
+        out.push_back(e);
+    }
+}
+
+void SpatialIndexSystem::init(EntityEngine *inEngine)
+{
+    EntitySystem::init(inEngine);
+    engine = inEngine;
+
+    engine->entities.on_construct<Position3d>().connect<&SpatialIndexSystem::onPositionConstructed>(this);
+    engine->entities.on_replace<Position3d>().connect<&SpatialIndexSystem::onPositionReplaced>(this);
+    // set in place from json or Lua, or assigned as default (at the origin) and set afterwards:
+    ComponentUtils::onFieldsChanged<Position3d>(engine->entities).connect<&SpatialIndexSystem::onPositionReplaced>(this);
+    engine->entities.on_destroy<Position3d>().connect<&SpatialIndexSystem::onPositionDestroyed>(this);
+
+    engine->entities.view<Position3d>().each([&] (entt::entity e, const Position3d &position)
+    {
+        insert(e, getCellKey(getCell(position.vec)));
+    });
+
+    auto getFilter = [] (const sol::optional<std::string> &componentName) -> const ComponentUtils *
+    {
+        return componentName.has_value() ? &EntityEngine::componentUtils(componentName.value()) : nullptr;
+    };
+
+    auto &env = engine->luaEnvironment;
+    env["setSpatialIndexCellSize"] = [this] (float size)
+    {
+        setCellSize(size);
+    };
+    env["markMovedInSpatialIndex"] = [this] (entt::entity e)
+    {
+        markMoved(e);
+    };
+    env["getEntitiesInRadius"] = [this, getFilter] (const vec3 &center, float radius, sol::optional<std::string> componentName)
+    {
+        std::vector<entt::entity> result;
+        getInRadius(center, radius, result, getFilter(componentName));
+        return sol::as_table(result);
+    };
+    env["getEntitiesInBox"] = [this, getFilter] (const vec3 &min, const vec3 &max, sol::optional<std::string> componentName)
+    {
+        std::vector<entt::entity> result;
+        getInBox(min, max, result, getFilter(componentName));
+        return sol::as_table(result);
+    };
+    env["getNearestEntities"] = [this, getFilter] (const vec3 &center, int k, sol::optional<float> maxRadius, sol::optional<std::string> componentName)
+    {
+        std::vector<entt::entity> result;
+        getNearest(center, k, maxRadius.value_or(std::numeric_limits<float>::max()), result, getFilter(componentName));
+        return sol::as_table(result);
+    };
+}
+
+void SpatialIndexSystem::update(double deltaTime, EntityEngine *)
+{
+    moveMarked();
+}
+
+ivec3 SpatialIndexSystem::getCell(const vec3 &position) const
+{
+    // clamped, so that huge query ranges do not overflow.
+    return ivec3(clamp(floor(position / cellSize), vec3(-CELL_COORD_OFFSET), vec3(CELL_COORD_OFFSET - 1)));
+}
+
+uint64 SpatialIndexSystem::getCellKey(const ivec3 &cell)
+{
+    return (uint64(cell.x + CELL_COORD_OFFSET) & CELL_COORD_MASK)
+        | ((uint64(cell.y + CELL_COORD_OFFSET) & CELL_COORD_MASK) << CELL_COORD_BITS)
+        | ((uint64(cell.z + CELL_COORD_OFFSET) & CELL_COORD_MASK) << (2 * CELL_COORD_BITS));
+}
+
+ivec3 SpatialIndexSystem::getCellFromKey(uint64 key)
+{
+    return ivec3(
+        int(key & CELL_COORD_MASK) - CELL_COORD_OFFSET,
+        int((key >> CELL_COORD_BITS) & CELL_COORD_MASK) - CELL_COORD_OFFSET,
+        int((key >> (2 * CELL_COORD_BITS)) & CELL_COORD_MASK) - CELL_COORD_OFFSET
+    );
+}
+
+void SpatialIndexSystem::insert(entt::entity e, uint64 cellKey)
+{
+    std::vector<entt::entity> &cell = cells[cellKey];
+    entries[e] = { cellKey, uint32(cell.size()) };
+    cell.push_back(e);
+}
+
+void SpatialIndexSystem::remove(entt::entity e)
+{
+    auto entryIt = entries.find(e);
+    if (entryIt == entries.end())
+    {
+        return;
+    }
+    const Entry entry = entryIt->second;
+    entries.erase(entryIt);
+
+    auto cellIt = cells.find(entry.cellKey);
+    std::vector<entt::entity> &cell = cellIt->second;
+    if (entry.indexInCell + 1 != cell.size())
+    {
+        cell[entry.indexInCell] = cell.back();
+        entries[cell[entry.indexInCell]].indexInCell = entry.indexInCell;
+    }
+    cell.pop_back();
+    if (cell.empty())
+    {
+        cells.erase(cellIt);
+    }
+}
+
+void SpatialIndexSystem::move(entt::entity e, const vec3 &position)
+{
+    const uint64 cellKey = getCellKey(getCell(position));
+    auto entryIt = entries.find(e);
+    if (entryIt != entries.end() && entryIt->second.cellKey == cellKey)
+    {
+        return;
+    }
+    remove(e);
+    insert(e, cellKey);
+}
+
+void SpatialIndexSystem::moveMarked()
+{
+    for (entt::entity e : movedEntities)
+    {
+        auto entryIt = entries.find(e);
+        if (entryIt == entries.end())
+        {
+            continue; // Position3d was removed since.
+        }
+        entryIt->second.bMoved = false;
+        move(e, engine->entities.get<Position3d>(e).vec);
+    }
+    movedEntities.clear();
+}
+
+void SpatialIndexSystem::onPositionConstructed(entt::registry &reg, entt::entity e)
+{
+    insert(e, getCellKey(getCell(reg.get<Position3d>(e).vec)));
+}
+
+void SpatialIndexSystem::onPositionReplaced(entt::registry &, entt::entity e)
+{
+    markMoved(e);
+}
+
+void SpatialIndexSystem::onPositionDestroyed(entt::registry &, entt::entity e)
+{
+    remove(e);
+}
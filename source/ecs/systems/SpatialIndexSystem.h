@@ -0,0 +1,151 @@
+
+#ifndef GAME_SPATIALINDEXSYSTEM_H
+#define GAME_SPATIALINDEXSYSTEM_H
+
+#include "EntitySystem.h"
+#include "../EntityEngine.h"
+#include "../../generated/Position3d.hpp"
+
+#include <unordered_map>
+
+/**
+ * Spatial hash of all entities with a Position3d, to query entities by radius, box or nearest.
+ *
+ * Entities are added/removed when Position3d is constructed/destroyed.
+ * Moved entities are put in their new cell during update(), only entities that were marked as moved are checked:
+ * by replacing Position3d, by setting it through ComponentUtils (json, Lua setComponents()), by EntityEngine::setPosition(),
+ * by the TransformSystem, or by calling markMoved() yourself after changing Position3d::vec in place.
+ * Queries check the actual Position3d, but an entity that moved to another cell since the last update might be missed.
+ */
+class SpatialIndexSystem : public EntitySystem
+{
+    using EntitySystem::EntitySystem;
+
+  public:
+
+    /**
+     * Rebuilds the index if the size changed.
+     */
+    void setCellSize(float size);
+
+    float getCellSize() const;
+
+    /**
+     * Needed after changing Position3d::vec in place, the entity is put in its new cell during the next update.
+     */
+    void markMoved(entt::entity);
+
+    /**
+     * Puts all entities in their current cell, also the ones that were not marked as moved.
+     */
+    void refresh();
+
+    /**
+     * Results are appended to `out`.
+     * If `filter` is given, only entities that have that component are returned.
+     */
+    void getInRadius(const vec3 &center, float radius, std::vector<entt::entity> &out,
+        const ComponentUtils *filter = nullptr) const;
+
+    void getInBox(const vec3 &min, const vec3 &max, std::vector<entt::entity> &out,
+        const ComponentUtils *filter = nullptr) const;
+
+    /**
+     * Appends at most `k` entities, nearest first.
+     */
+    void getNearest(const vec3 &center, int k, float maxRadius, std::vector<entt::entity> &out,
+        const ComponentUtils *filter = nullptr) const;
+
+    /**
+     * Calls `function(entt::entity, const vec3 &position)` for each entity in the cells overlapping the box.
+     * The entity itself might lie outside the box.
+     */
+    template<class Function>
+    void forEachInCells(const vec3 &min, const vec3 &max, Function &&function) const
+    {
+        const ivec3 minCell = getCell(min), maxCell = getCell(max);
+        const uint64 numCellsInBox = uint64(maxCell.x - minCell.x + 1) * uint64(maxCell.y - minCell.y + 1) * uint64(maxCell.z - minCell.z + 1);
+
+        if (numCellsInBox > cells.size())
+        {
+            // cheaper to visit the occupied cells than to look up every cell in the box.
+            for (auto &[key, cell] : cells)
+            {
+                const ivec3 cellCoords = getCellFromKey(key);
+                if (all(greaterThanEqual(cellCoords, minCell)) && all(lessThanEqual(cellCoords, maxCell)))
+                {
+                    forEachInCell(cell, function);
+                }
+            }
+            return;
+        }
+        for (int x = minCell.x; x <= maxCell.x; x++)
+        {
+            for (int y = minCell.y; y <= maxCell.y; y++)
+            {
+                for (int z = minCell.z; z <= maxCell.z; z++)
+                {
+                    auto it = cells.find(getCellKey({ x, y, z }));
+                    if (it != cells.end())
+                    {
+                        forEachInCell(it->second, function);
+                    }
+                }
+            }
+        }
+    }
+
+  protected:
+    void init(EntityEngine *engine) override;
+
+    void update(double deltaTime, EntityEngine *engine) override;
+
+  private:
+
+    struct Entry
+    {
+        uint64 cellKey;
+        uint32 indexInCell;
+        bool bMoved = false;
+    };
+
+    ivec3 getCell(const vec3 &position) const;
+
+    static uint64 getCellKey(const ivec3 &cell);
+
+    static ivec3 getCellFromKey(uint64 key);
+
+    template<class Function>
+    void forEachInCell(const std::vector<entt::entity> &cell, Function &function) const
+    {
+        for (entt::entity e : cell)
+        {
+            function(e, engine->entities.get<Position3d>(e).vec);
+        }
+    }
+
+    void insert(entt::entity, uint64 cellKey);
+
+    void remove(entt::entity);
+
+    void move(entt::entity, const vec3 &position);
+
+    void moveMarked();
+
+    void onPositionConstructed(entt::registry &, entt::entity);
+
+    void onPositionReplaced(entt::registry &, entt::entity);
+
+    void onPositionDestroyed(entt::registry &, entt::entity);
+
+    EntityEngine *engine = nullptr;
+
+    float cellSize = 4.f;
+
+    std::unordered_map<uint64, std::vector<entt::entity>> cells;
+    std::unordered_map<entt::entity, Entry> entries;
+    std::vector<entt::entity> movedEntities;
+};
+
+
+#endif //GAME_SPATIALINDEXSYSTEM_H
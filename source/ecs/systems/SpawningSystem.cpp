@@ -1,15 +1,125 @@
-
 #include "SpawningSystem.h"
 #include "../../generated/Spawning.hpp"
 
+#include <utils/hashing.h>
+
+entt::entity SpawningSystem::spawnPooled(const TemplateHandle &templateHandle)
+{
+    EntityTemplate &entityTemplate = room->getTemplate(templateHandle);
+    const entt::entity e = acquirePooled(templateHandle.getHash());
+    entityTemplate.createComponents(e);
+    return e;
+}
+
+entt::entity SpawningSystem::acquirePooled(int templateHash)
+{
+    EntityPool &pool = getPool(templateHash);
+
+    entt::entity e = entt::null;
+    while (!pool.inactive.empty() && e == entt::null)
+    {
+        e = pool.inactive.back();
+        pool.inactive.pop_back();
+        // someone might have destroyed or used the inactive entity in the meantime:
+        if (!room->entities.valid(e) || !room->entities.orphan(e))
+            e = entt::null;
+    }
+    if (e == entt::null)
+    {
+        e = room->entities.create();
+        pool.numCreated++;
+    }
+    else pool.numReused++;
+
+    room->entities.assign<Pooled>(e).templateHash = templateHash;
+    return e;
+}
+
+void SpawningSystem::despawn(entt::entity e)
+{
+    if (!room->entities.valid(e))
+        return;
+
+    // the entity's version does not change when it is returned to a pool, so this is the only way for others to find out:
+    room->events.emit(e, "Despawned");
+    if (!room->entities.valid(e))
+        return; // destroyed by a listener.
+
+    const Pooled *pooled = room->entities.try_get<Pooled>(e);
+    if (!pooled)
+    {
+        room->entities.destroy(e);
+        return;
+    }
+    EntityPool &pool = getPool(pooled->templateHash);
+    if (int(pool.inactive.size()) >= pool.capacity || !deactivate(e))
+    {
+        if (room->entities.valid(e))
+            room->entities.destroy(e);
+        pool.numDestroyed++;
+        return;
+    }
+    pool.inactive.push_back(e);
+    pool.numReturned++;
+}
+
+SpawningSystem::EntityPool &SpawningSystem::getPool(int templateHash)
+{
+    return pools[templateHash];
+}
+
+void SpawningSystem::init(EntityEngine *engine)
+{
+    room = engine;
+
+    auto &env = engine->luaEnvironment;
+    env["despawn"] = [&] (entt::entity e)
+    {
+        despawn(e);
+    };
+    env["spawnPooled"] = [&] (const sol::object &templateNameOrHandle) -> entt::entity
+    {
+        if (templateNameOrHandle.is<TemplateHandle>())
+            return spawnPooled(templateNameOrHandle.as<TemplateHandle &>());
+        return spawnPooled(TemplateHandle(templateNameOrHandle.as<std::string>()));
+    };
+    env["setEntityPoolCapacity"] = [&] (const char *templateName, int capacity)
+    {
+        EntityPool &pool = getPool(hashStringCrossPlatform(templateName));
+        pool.capacity = capacity;
+        while (int(pool.inactive.size()) > pool.capacity)
+        {
+            if (room->entities.valid(pool.inactive.back()))
+                room->entities.destroy(pool.inactive.back());
+            pool.inactive.pop_back();
+        }
+    };
+    env["getEntityPoolStats"] = [&] (const char *templateName, sol::this_state lua)
+    {
+        const EntityPool &pool = getPool(hashStringCrossPlatform(templateName));
+        sol::table stats = sol::table::create(lua);
+        stats["inactive"] = pool.inactive.size();
+        stats["capacity"] = pool.capacity;
+        stats["created"] = pool.numCreated;
+        stats["reused"] = pool.numReused;
+        stats["returned"] = pool.numReturned;
+        stats["destroyed"] = pool.numDestroyed;
+        return stats;
+    };
+}
+
 void SpawningSystem::update(double deltaTime, EntityEngine *room)
 {
     this->room = room;
+    toDespawn.clear();
     room->entities.view<DespawnAfter>().each([&](auto e, DespawnAfter &despawnAfter) {
         despawnAfter.timer += deltaTime;
         if (despawnAfter.timer >= despawnAfter.time)
-            room->entities.destroy(e);
+            toDespawn.push_back(e);
     });
+    // not during the view, deactivating removes many components, and onDestroy callbacks can do anything.
+    for (entt::entity e : toDespawn)
+        despawn(e);
 
     room->entities.view<TemplateSpawner>().each([&](auto e, TemplateSpawner &spawner) {
 
@@ -30,16 +140,40 @@ void SpawningSystem::spawn(entt::entity spawnerEntity, TemplateSpawner &spawner)
 {
     try
     {
-        auto spawned = room->entities.create();
+        // hash the name only when it changed:
+        if (spawner.templateName != spawner.hashedTemplateName)
+        {
+            spawner.templateHandle = TemplateHandle(spawner.templateName);
+            spawner.hashedTemplateName = spawner.templateName;
+        }
+        EntityTemplate &entityTemplate = room->getTemplate(spawner.templateHandle);
+
+        const entt::entity spawned = spawner.usePool ? acquirePooled(spawner.templateHandle.getHash()) : room->entities.create();
         auto &spawnedBy = room->entities.assign<SpawnedBy>(spawned);
         spawnedBy.spawner = spawnerEntity;
         spawnedBy.customData = spawner.customData;
         spawnedBy.spawnerPos = room->getPosition(spawnerEntity);
 
-        room->getTemplate(spawner.templateName).createComponents(spawned);
+        entityTemplate.createComponents(spawned);
     }
     catch (_gu_err &err)
     {
         std::cerr << "TemplateSpawner#" << int(spawnerEntity) << " caused error:\n" << err.what() << std::endl;
     }
 }
+
+bool SpawningSystem::deactivate(entt::entity e)
+{
+    entt::registry &reg = room->entities;
+    reg.remove<Pooled>(e);
+
+    // removing LuaScripted calls the entity's onDestroy callback, just like destroying the entity would.
+    for (const std::string &componentName : ComponentUtils::getAllComponentTypeNames())
+    {
+        const ComponentUtils *utils = ComponentUtils::getFor(componentName);
+        if (utils->entityHasComponent(e, reg))
+            utils->removeComponent(e, reg);
+    }
+    // components that are not known to ComponentUtils (like event listeners or timeouts) cannot be reset:
+    return reg.valid(e) && reg.orphan(e);
+}
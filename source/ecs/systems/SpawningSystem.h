@@ -1,4 +1,3 @@
-
 #ifndef GAME_SPAWNINGSYSTEM_H
 #define GAME_SPAWNINGSYSTEM_H
 
@@ -6,6 +5,19 @@
 #include "../../level/room/Room.h"
 #include "../../generated/Spawning.hpp"
 
+#include <unordered_map>
+
+/**
+ * Marks an entity that was created from an entity pool. It will be returned to that pool when despawned.
+ *
+ * NOTE: a pooled entity is not destroyed, so its version stays the same and registry.valid() stays true after despawning.
+ * Whoever keeps the entity (e.g. as a target) should listen to the engine's "Despawned" event, or the entity will
+ * silently refer to the next entity that is spawned from the pool.
+ */
+struct Pooled
+{
+    int templateHash;
+};
 
 class SpawningSystem : public EntitySystem
 {
@@ -13,10 +25,55 @@ class SpawningSystem : public EntitySystem
 
     EntityEngine *room = nullptr;
 
+  public:
+
+    /**
+     * Inactive entities of one template, that have no components left.
+     */
+    struct EntityPool
+    {
+        std::vector<entt::entity> inactive;
+        int capacity = 64;
+
+        // stats:
+        int numCreated = 0;
+        int numReused = 0;
+        int numReturned = 0;
+        // despawned while the pool was full, or with components that could not be removed.
+        int numDestroyed = 0;
+    };
+
+    /**
+     * Creates an entity using the template, reusing an inactive entity of that template's pool if there is one.
+     * A reused entity has the same entt::entity value (including version) as before, see Pooled.
+     */
+    entt::entity spawnPooled(const TemplateHandle &);
+
+    /**
+     * Returns the entity to its pool if it was spawned with spawnPooled(), otherwise (or if the pool is full) destroys it.
+     * First emits "Despawned" with the entity on the engine's events, while it still has its components.
+     */
+    void despawn(entt::entity);
+
+    EntityPool &getPool(int templateHash);
+
   protected:
+    void init(EntityEngine *room) override;
+
     void update(double deltaTime, EntityEngine *room) override;
 
     void spawn(entt::entity spawnerEntity, TemplateSpawner &spawner);
+
+  private:
+
+    // returns an inactive entity of the pool (or a new one) without components, except for Pooled.
+    entt::entity acquirePooled(int templateHash);
+
+    bool deactivate(entt::entity);
+
+    std::unordered_map<int, EntityPool> pools;
+
+    std::vector<entt::entity> toDespawn;
 };
 
 
@@ -0,0 +1,127 @@
+#include "TransformSystem.h"
+#include "SpatialIndexSystem.h"
+
+#include "../../generated/Children.hpp"
+#include "../../generated/Position3d.hpp"
+
+#include <algorithm>
+
+void TransformSystem::markDirty(entt::entity e)
+{
+    if (engine->entities.valid(e) && !engine->entities.has<TransformDirty>(e))
+    {
+        engine->entities.assign<TransformDirty>(e);
+    }
+}
+
+void TransformSystem::init(EntityEngine *inEngine)
+{
+    EntitySystem::init(inEngine);
+    engine = inEngine;
+
+    engine->entities.on_construct<LocalPosition3d>().connect<&TransformSystem::onLocalPositionChanged>(this);
+    engine->entities.on_replace<LocalPosition3d>().connect<&TransformSystem::onLocalPositionChanged>(this);
+    engine->entities.on_construct<Child>().connect<&TransformSystem::onChildCreated>(this);
+    // the parent might have been changed in place:
+    ComponentUtils::onFieldsChanged<Child>(engine->entities).connect<&TransformSystem::onChildCreated>(this);
+
+    engine->luaEnvironment["markTransformDirty"] = [this] (entt::entity e)
+    {
+        markDirty(e);
+    };
+    engine->luaEnvironment["setLocalPosition"] = [this] (entt::entity e, const vec3 &localPosition)
+    {
+        LocalPosition3d local;
+        local.vec = localPosition;
+        engine->entities.assign_or_replace<LocalPosition3d>(e, local);
+    };
+}
+
+void TransformSystem::update(double deltaTime, EntityEngine *)
+{
+    dirtyEntities.clear();
+    engine->entities.view<TransformDirty>().each([&] (entt::entity e, auto)
+    {
+        dirtyEntities.emplace_back(getDepth(e), e);
+    });
+    if (dirtyEntities.empty())
+    {
+        return;
+    }
+    // Parents first, so that a dirty entity and its dirty descendants are only updated once.
+    std::sort(dirtyEntities.begin(), dirtyEntities.end(), [] (const auto &a, const auto &b)
+    {
+        return a.first < b.first;
+    });
+
+    for (auto &[depth, e] : dirtyEntities)
+    {
+        if (!engine->entities.valid(e) || !engine->entities.has<TransformDirty>(e))
+        {
+            continue; // updated already as the descendant of another dirty entity.
+        }
+        engine->entities.remove<TransformDirty>(e);
+
+        vec3 position;
+        const LocalPosition3d *local = engine->entities.try_get<LocalPosition3d>(e);
+        const Child *child = engine->entities.try_get<Child>(e);
+
+        if (local && child && engine->entities.valid(child->parent))
+        {
+            position = engine->getPosition(child->parent) + local->vec;
+            engine->entities.get_or_assign<Position3d>(e).vec = position;
+            engine->getSpatialIndex()->markMoved(e);
+        }
+        else
+        {
+            const Position3d *worldPosition = engine->entities.try_get<Position3d>(e);
+            position = worldPosition ? worldPosition->vec : vec3(0);
+        }
+        propagateToChildren(e, position);
+    }
+}
+
+void TransformSystem::onLocalPositionChanged(entt::registry &, entt::entity e)
+{
+    markDirty(e);
+}
+
+void TransformSystem::onChildCreated(entt::registry &reg, entt::entity e)
+{
+    if (reg.has<LocalPosition3d>(e))
+    {
+        markDirty(e);
+    }
+}
+
+void TransformSystem::propagateToChildren(entt::entity parent, const vec3 &parentPosition)
+{
+    engine->forEachChild(parent, [&] (entt::entity child)
+    {
+        // children without a LocalPosition3d (and their descendants) do not move along with their parent.
+        if (const LocalPosition3d *local = engine->entities.try_get<LocalPosition3d>(child))
+        {
+            const vec3 position = parentPosition + local->vec;
+            engine->entities.get_or_assign<Position3d>(child).vec = position;
+            engine->getSpatialIndex()->markMoved(child);
+            engine->entities.remove_if_exists<TransformDirty>(child);
+
+            propagateToChildren(child, position);
+        }
+    });
+}
+
+int TransformSystem::getDepth(entt::entity e) const
+{
+    int depth = 0;
+    while (const Child *child = engine->entities.try_get<Child>(e))
+    {
+        if (!engine->entities.valid(child->parent))
+        {
+            break;
+        }
+        e = child->parent;
+        depth++;
+    }
+    return depth;
+}
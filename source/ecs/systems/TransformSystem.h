@@ -0,0 +1,54 @@
+
+#ifndef GAME_TRANSFORMSYSTEM_H
+#define GAME_TRANSFORMSYSTEM_H
+
+#include "EntitySystem.h"
+#include "../EntityEngine.h"
+
+/**
+ * Tag for entities whose Position3d (or the Position3d of their descendants) needs to be recomputed.
+ */
+struct TransformDirty
+{};
+
+/**
+ * Sets the Position3d of entities that have a LocalPosition3d to the Position3d of their parent + LocalPosition3d.
+ *
+ * Only dirty entities and their descendants are updated, parents before children.
+ * Entities are marked dirty when LocalPosition3d is assigned/replaced, when they become a Child,
+ * and by EntityEngine::setPosition()/markTransformDirty().
+ */
+class TransformSystem : public EntitySystem
+{
+    using EntitySystem::EntitySystem;
+
+  public:
+
+    /**
+     * Needed after changing LocalPosition3d::vec in place, or after changing Position3d::vec of a parent in place.
+     */
+    void markDirty(entt::entity);
+
+  protected:
+    void init(EntityEngine *engine) override;
+
+    void update(double deltaTime, EntityEngine *engine) override;
+
+  private:
+
+    void onLocalPositionChanged(entt::registry &, entt::entity);
+
+    void onChildCreated(entt::registry &, entt::entity);
+
+    void propagateToChildren(entt::entity parent, const vec3 &parentPosition);
+
+    int getDepth(entt::entity) const;
+
+    EntityEngine *engine = nullptr;
+
+    // depth and entity, reused each update.
+    std::vector<std::pair<int, entt::entity>> dirtyEntities;
+};
+
+
+#endif //GAME_TRANSFORMSYSTEM_H
@@ -0,0 +1,271 @@
+#include "AssetReloadQueue.h"
+
+#include <asset_manager/AssetManager.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+
+AssetReloadQueue::~AssetReloadQueue()
+{
+    stop();
+}
+
+void AssetReloadQueue::start()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (bRunning)
+    {
+        return;
+    }
+    bRunning = true;
+    thread = std::thread(&AssetReloadQueue::work, this);
+}
+
+void AssetReloadQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!bRunning)
+        {
+            return;
+        }
+        bRunning = false;
+    }
+    condition.notify_all();
+    thread.join();
+
+    // what is still pending will be loaded by swapPrepared():
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto &path : pending)
+    {
+        addReady(path, Prepared());
+    }
+    pending.clear();
+    pendingSet.clear();
+}
+
+void AssetReloadQueue::push(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!bRunning || findPreparer(path) == nullptr)
+        {
+            addReady(path, Prepared());
+            return;
+        }
+        // a newer version is coming, so don't swap in the older one:
+        ready.erase(std::remove_if(ready.begin(), ready.end(), [&] (auto &r) { return r.first == path; }), ready.end());
+
+        if (!pendingSet.insert(path).second)
+        {
+            return;
+        }
+        pending.push_back(path);
+    }
+    condition.notify_one();
+}
+
+int AssetReloadQueue::swapPrepared(const std::string &removePreFix)
+{
+    std::vector<std::pair<std::string, Prepared>> toSwap;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        toSwap.swap(ready);
+    }
+    for (auto &[path, prepared] : toSwap)
+    {
+        try
+        {
+            loadFile(path, std::move(prepared), removePreFix, true);
+        }
+        catch (std::exception &exc)
+        {
+            std::cerr << "Error while reloading " << path << ":\n" << exc.what() << std::endl;
+        }
+    }
+    return int(toSwap.size());
+}
+
+int AssetReloadQueue::loadDirectory(const std::string &directory, const std::string &removePreFix, int numThreads,
+    const std::function<void(int numLoaded, int numTotal)> &onProgress)
+{
+    std::vector<std::string> toPrepare, toLoad;
+    for (auto &entry : std::filesystem::recursive_directory_iterator(directory))
+    {
+        if (entry.is_regular_file())
+        {
+            std::string path = entry.path().generic_string();
+            (findPreparer(path) ? toPrepare : toLoad).push_back(std::move(path));
+        }
+    }
+    const int numTotal = int(toPrepare.size() + toLoad.size());
+    int numLoaded = 0;
+
+    if (numThreads <= 0)
+    {
+        numThreads = std::max<int>(1, int(std::thread::hardware_concurrency()) - 1);
+    }
+    numThreads = std::min<int>(numThreads, int(toPrepare.size()));
+
+    std::vector<Prepared> prepared(toPrepare.size());
+    std::vector<size_t> finished;
+    std::mutex finishedMutex;
+    std::condition_variable finishedCondition;
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> bAbort = false;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back([&]
+        {
+            for (size_t j = next++; j < toPrepare.size() && !bAbort; j = next++)
+            {
+                try
+                {
+                    prepared[j] = (*findPreparer(toPrepare[j]))(toPrepare[j]);
+                }
+                catch (std::exception &exc)
+                {
+                    // the main thread will load the file the normal way, and throw the error there.
+                    std::cerr << "Error while preparing " << toPrepare[j] << ":\n" << exc.what() << std::endl;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(finishedMutex);
+                    finished.push_back(j);
+                }
+                finishedCondition.notify_one();
+            }
+        });
+    }
+
+    size_t numSwapped = 0;
+    auto swapFinished = [&] (bool bWait)
+    {
+        std::vector<size_t> toSwap;
+        {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            if (bWait)
+            {
+                finishedCondition.wait(lock, [&] { return !finished.empty(); });
+            }
+            toSwap.swap(finished);
+        }
+        for (size_t j : toSwap)
+        {
+            loadFile(toPrepare[j], std::move(prepared[j]), removePreFix, false);
+            if (onProgress)
+            {
+                onProgress(++numLoaded, numTotal);
+            }
+            numSwapped++;
+        }
+    };
+
+    try
+    {
+        for (auto &path : toLoad)
+        {
+            loadFile(path, Prepared(), removePreFix, false);
+            if (onProgress)
+            {
+                onProgress(++numLoaded, numTotal);
+            }
+            swapFinished(false);
+        }
+        while (numSwapped < toPrepare.size())
+        {
+            swapFinished(true);
+        }
+    }
+    catch (...)
+    {
+        bAbort = true;
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        throw;
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    return numTotal;
+}
+
+const std::function<AssetReloadQueue::Prepared(const std::string &)> *AssetReloadQueue::findPreparer(const std::string &path) const
+{
+    for (auto &[extension, preparer] : preparers)
+    {
+        if (path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+        {
+            return &preparer;
+        }
+    }
+    return nullptr;
+}
+
+void AssetReloadQueue::addReady(const std::string &path, Prepared &&prepared)
+{
+    for (auto &r : ready)
+    {
+        if (r.first == path)
+        {
+            r.second = std::move(prepared);
+            return;
+        }
+    }
+    ready.emplace_back(path, std::move(prepared));
+}
+
+void AssetReloadQueue::loadFile(const std::string &path, Prepared &&prepared, const std::string &removePreFix, bool bForce)
+{
+    swappingPath = path;
+    swapping = std::move(prepared);
+    try
+    {
+        AssetManager::loadFile(path, removePreFix, bForce);
+    }
+    catch (...)
+    {
+        swappingPath.clear();
+        swapping = Prepared();
+        throw;
+    }
+    swappingPath.clear();
+    swapping = Prepared();
+}
+
+void AssetReloadQueue::work()
+{
+    while (true)
+    {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] { return !bRunning || !pending.empty(); });
+            if (!bRunning)
+            {
+                return;
+            }
+            path = std::move(pending.front());
+            pending.pop_front();
+            pendingSet.erase(path);
+        }
+        Prepared prepared;
+        try
+        {
+            prepared = (*findPreparer(path))(path);
+        }
+        catch (std::exception &exc)
+        {
+            // swapPrepared() will load the file the normal way, which reports the error where it used to.
+            std::cerr << "Error while preparing " << path << " for reload:\n" << exc.what() << std::endl;
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        addReady(path, std::move(prepared));
+    }
+}
@@ -0,0 +1,129 @@
+
+#ifndef GAME_ASSETRELOADQUEUE_H
+#define GAME_ASSETRELOADQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Queue of changed asset files that should be reloaded (filled by the FileWatcher in dibidab::init()).
+ *
+ * Paths are de-duplicated, so a burst of changes to the same file results in one reload, and no change is lost.
+ * If a preparer is added for the file's extension, the asset is prepared (e.g. Lua compiled, json parsed) on a background thread.
+ * Only swapPrepared() touches the AssetManager, on the main thread.
+ * Asset loaders can pick up the prepared asset with takePrepared(), and should fall back to loading the file themselves.
+ *
+ * The same preparers are used by loadDirectory(), to load all assets on multiple threads at startup.
+ */
+class AssetReloadQueue
+{
+  public:
+
+    ~AssetReloadQueue();
+
+    /**
+     * `function` is called on the background thread, and should not touch the AssetManager, OpenGL, OpenAL, or the main Lua state.
+     * Add preparers before calling start().
+     */
+    template<class type>
+    void addPreparer(const std::vector<std::string> &fileExtensions, std::function<type *(const std::string &path)> function)
+    {
+        for (auto &extension : fileExtensions)
+        {
+            preparers.emplace_back(extension, [function] (const std::string &path)
+            {
+                Prepared prepared;
+                prepared.asset = PreparedAsset(function(path), [] (void *asset)
+                {
+                    delete static_cast<type *>(asset);
+                });
+                prepared.type = typeid(type);
+                return prepared;
+            });
+        }
+    }
+
+    /**
+     * Starts the background thread. Without it, all pushed paths are loaded entirely by swapPrepared().
+     */
+    void start();
+
+    void stop();
+
+    /**
+     * Can be called from any thread.
+     */
+    void push(const std::string &path);
+
+    /**
+     * Call this on the main thread. (Re)loads all prepared assets using AssetManager::loadFile().
+     * Returns the number of reloaded files.
+     */
+    int swapPrepared(const std::string &removePreFix);
+
+    /**
+     * Loads all files in `directory` like AssetManager::loadDirectory(), but files that have a preparer are prepared on `numThreads` threads
+     * (0 = one less than the number of cores), while the main thread loads the other files (e.g. textures, which need OpenGL).
+     * `onProgress(numLoaded, numTotal)` is called on the calling thread after each file.
+     * Returns the number of files.
+     */
+    int loadDirectory(const std::string &directory, const std::string &removePreFix, int numThreads,
+        const std::function<void(int numLoaded, int numTotal)> &onProgress = nullptr);
+
+    /**
+     * For use in asset loaders: returns the asset prepared for `path` (ownership is passed to the caller),
+     * or nullptr if it is not being loaded by swapPrepared() or loadDirectory().
+     */
+    template<class type>
+    type *takePrepared(const std::string &path)
+    {
+        if (path != swappingPath || swapping.type != typeid(type) || !swapping.asset)
+        {
+            return nullptr;
+        }
+        return static_cast<type *>(swapping.asset.release());
+    }
+
+  private:
+
+    using PreparedAsset = std::unique_ptr<void, void (*)(void *)>;
+
+    struct Prepared
+    {
+        PreparedAsset asset = PreparedAsset(nullptr, nullptr);
+        std::type_index type = typeid(void);
+    };
+
+    const std::function<Prepared(const std::string &)> *findPreparer(const std::string &path) const;
+
+    void addReady(const std::string &path, Prepared &&);
+
+    void loadFile(const std::string &path, Prepared &&, const std::string &removePreFix, bool bForce);
+
+    void work();
+
+    std::vector<std::pair<std::string, std::function<Prepared(const std::string &)>>> preparers;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+    bool bRunning = false;
+
+    std::deque<std::string> pending;
+    std::unordered_set<std::string> pendingSet;
+    std::vector<std::pair<std::string, Prepared>> ready;
+
+    // only used on the main thread, by loadFile() and takePrepared():
+    std::string swappingPath;
+    Prepared swapping;
+};
+
+#endif //GAME_ASSETRELOADQUEUE_H
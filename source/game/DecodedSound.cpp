@@ -0,0 +1,125 @@
+#include "DecodedSound.h"
+
+#include <utils/gu_error.h>
+
+#include <AL/al.h>
+
+// the implementation is compiled into gu, for au::OggLoader:
+#define STB_VORBIS_HEADER_ONLY
+#include <stb_vorbis.c>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static uint32_t readLittleEndian(const unsigned char *bytes, int numBytes)
+{
+    uint32_t value = 0;
+    for (int i = numBytes - 1; i >= 0; i--)
+    {
+        value = (value << 8u) | bytes[i];
+    }
+    return value;
+}
+
+DecodedSound *DecodedSound::decodeWav(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw gu_err("Could not open " + path);
+    }
+    const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (bytes.size() < 12 || std::memcmp(bytes.data(), "RIFF", 4) != 0 || std::memcmp(bytes.data() + 8, "WAVE", 4) != 0)
+    {
+        throw gu_err(path + " is not a .wav file");
+    }
+    int channels = 0, sampleRate = 0, bitsPerSample = 0;
+    bool bPCM = false;
+
+    for (std::size_t chunk = 12; chunk + 8 <= bytes.size(); )
+    {
+        const unsigned char *header = bytes.data() + chunk;
+        const std::size_t chunkSize = readLittleEndian(header + 4, 4);
+        const unsigned char *data = header + 8;
+        if (chunk + 8 + chunkSize > bytes.size())
+        {
+            throw gu_err(path + " is cut off");
+        }
+        if (std::memcmp(header, "fmt ", 4) == 0 && chunkSize >= 16)
+        {
+            bPCM = readLittleEndian(data, 2) == 1;
+            channels = int(readLittleEndian(data + 2, 2));
+            sampleRate = int(readLittleEndian(data + 4, 4));
+            bitsPerSample = int(readLittleEndian(data + 14, 2));
+        }
+        else if (std::memcmp(header, "data", 4) == 0)
+        {
+            if (!bPCM || (channels != 1 && channels != 2) || (bitsPerSample != 8 && bitsPerSample != 16))
+            {
+                return nullptr;
+            }
+            auto decoded = new DecodedSound;
+            decoded->channels = channels;
+            decoded->sampleRate = sampleRate;
+            if (bitsPerSample == 16)
+            {
+                decoded->samples.resize(chunkSize / 2);
+                for (std::size_t i = 0; i < decoded->samples.size(); i++)
+                {
+                    decoded->samples[i] = short(readLittleEndian(data + 2 * i, 2));
+                }
+            }
+            else
+            {
+                // 8 bit samples are unsigned:
+                decoded->samples.resize(chunkSize);
+                for (std::size_t i = 0; i < chunkSize; i++)
+                {
+                    decoded->samples[i] = short((int(data[i]) - 128) * 256);
+                }
+            }
+            return decoded;
+        }
+        // chunks are padded to an even size:
+        chunk += 8 + chunkSize + (chunkSize & 1u);
+    }
+    throw gu_err(path + " has no sound data");
+}
+
+DecodedSound *DecodedSound::decodeOgg(const std::string &path)
+{
+    int channels = 0, sampleRate = 0;
+    short *output = nullptr;
+    const int numFrames = stb_vorbis_decode_filename(path.c_str(), &channels, &sampleRate, &output);
+    if (numFrames < 0)
+    {
+        throw gu_err("Could not decode " + path);
+    }
+    if (channels != 1 && channels != 2)
+    {
+        std::free(output);
+        throw gu_err("Cannot play " + path + ", it has " + std::to_string(channels) + " channels. Only mono and stereo are supported.");
+    }
+    auto decoded = new DecodedSound;
+    decoded->channels = channels;
+    decoded->sampleRate = sampleRate;
+    decoded->samples.assign(output, output + std::size_t(numFrames) * channels);
+    std::free(output);
+    return decoded;
+}
+
+au::Sound *DecodedSound::createSound() const
+{
+    // au::Sound generates its OpenAL buffer when constructed.
+    auto sound = new au::Sound;
+    if (!samples.empty())
+    {
+        alBufferData(sound->buffer, channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
+            samples.data(), ALsizei(samples.size() * sizeof(short)), sampleRate);
+    }
+    return sound;
+}
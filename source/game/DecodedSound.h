@@ -0,0 +1,36 @@
+
+#ifndef GAME_DECODEDSOUND_H
+#define GAME_DECODEDSOUND_H
+
+#include <audio/audio.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * 16 bit PCM samples of a .wav or .ogg file, decoded without OpenAL, so that it can be done by the asset loading threads.
+ * The main thread turns it into an au::Sound with createSound().
+ */
+struct DecodedSound
+{
+    int channels = 0;
+    int sampleRate = 0;
+    // interleaved:
+    std::vector<short> samples;
+
+    /**
+     * Returns nullptr if the file uses an encoding that is not supported here (only 8 and 16 bit PCM, mono or stereo).
+     * au::WavLoader should be used for those.
+     */
+    static DecodedSound *decodeWav(const std::string &path);
+
+    static DecodedSound *decodeOgg(const std::string &path);
+
+    /**
+     * Creates the OpenAL buffer, call this on the main thread.
+     * If there are no samples the au::Sound stays empty, like the sounds that are only streamed (see SoundStream).
+     */
+    au::Sound *createSound() const;
+};
+
+#endif //GAME_DECODEDSOUND_H
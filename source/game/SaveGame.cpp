@@ -16,8 +16,11 @@ SaveGame::SaveGame(const char *path) : loadedFromPath(path ? path : "")
     if (!loadedFromPath.empty() && fu::exists(path))
     {
         auto data = fu::readBinary(path);
-        json jsonData = json::from_cbor(data.begin(), data.end());
-        jsonToLuaTable(luaTable, jsonData.at("luaTable"));
+        sol::table savedTable = cborToLuaTable(luaTable.lua_state(), (const unsigned char *) data.data(), data.size());
+        sol::optional<sol::table> savedLuaTable = savedTable["luaTable"];
+        if (!savedLuaTable.has_value())
+            throw gu_err("Save game " + loadedFromPath + " has no luaTable");
+        luaTable = savedLuaTable.value();
     }
 }
 
@@ -30,32 +33,55 @@ void SaveGame::save(const char *path)
         return;
     }
 
-    json j = json::object();
-    json &jsonLuaTable = j["luaTable"] = json::object();
-    jsonFromLuaTable(luaTable, jsonLuaTable);
-
-    std::vector<std::string> idsToRemove;
+    // don't save the save data of entities that have nothing to save. They're put back after writing.
+    std::vector<std::pair<sol::object, sol::table>> removedEmptySaveData;
+    sol::optional<sol::table> saveGameEntities = luaTable.raw_get<sol::optional<sol::table>>(SAVE_GAME_ENTITIES_TABLE_NAME);
+    if (saveGameEntities.has_value())
+    {
+        for (auto &[id, saveData] : saveGameEntities.value())
+            if (saveData.get_type() == sol::type::table && saveData.as<sol::table>().empty())
+                removedEmptySaveData.emplace_back(id, saveData);
 
-    for (auto &[id, saveData] : jsonLuaTable[SAVE_GAME_ENTITIES_TABLE_NAME].items())
-        if (saveData.empty())
-            idsToRemove.push_back(id);
+        for (auto &[id, saveData] : removedEmptySaveData)
+            saveGameEntities.value().raw_set(id, sol::lua_nil);
+    }
 
-    for (auto &id : idsToRemove)
-        jsonLuaTable[SAVE_GAME_ENTITIES_TABLE_NAME].erase(id);
+    // written as {"luaTable": luaTable}, same layout as before, so old save games can still be loaded.
+    static const std::string luaTableKey = "luaTable";
+    std::vector<unsigned char> data = {
+        0xa1,                                           // map with 1 entry
+        (unsigned char) (0x60 | luaTableKey.size())     // key: text string of 8 bytes
+    };
+    data.insert(data.end(), luaTableKey.begin(), luaTableKey.end());
+    try
+    {
+        cborFromLuaTable(luaTable, data);
+    }
+    catch (...)
+    {
+        for (auto &[id, saveData] : removedEmptySaveData)
+            saveGameEntities.value().raw_set(id, saveData);
+        throw;
+    }
+    for (auto &[id, saveData] : removedEmptySaveData)
+        saveGameEntities.value().raw_set(id, saveData);
 
-    std::vector<uint8> data;
-    json::to_cbor(j, data);
     fu::writeBinary(path == nullptr ? loadedFromPath.c_str() : path, (char *) data.data(), data.size());
 }
 
 sol::table SaveGame::getSaveDataForEntity(const std::string &entitySaveGameID, bool temporary)
+{
+    return getSaveDataOfAllEntities(temporary)[entitySaveGameID].get_or_create<sol::table>();
+}
+
+sol::table SaveGame::getSaveDataOfAllEntities(bool temporary)
 {
     if (temporary)
-        return luau::getLuaState()["tempSaveGameEntities"].get_or_create<sol::table>()[entitySaveGameID].get_or_create<sol::table>();
+        return luau::getLuaState()["tempSaveGameEntities"].get_or_create<sol::table>();
 
     auto &saveGameLuaTable = dibidab::getCurrentSession().saveGame.luaTable;
 
-    return saveGameLuaTable[SAVE_GAME_ENTITIES_TABLE_NAME].get_or_create<sol::table>()[entitySaveGameID].get_or_create<sol::table>();
+    return saveGameLuaTable[SAVE_GAME_ENTITIES_TABLE_NAME].get_or_create<sol::table>();
 }
 
 #endif
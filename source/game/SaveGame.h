@@ -17,6 +17,9 @@ struct SaveGame
 
     static sol::table getSaveDataForEntity(const std::string &entitySaveGameID, bool temporary);
 
+    // the table that contains the save data of all entities, by their save game ID.
+    static sol::table getSaveDataOfAllEntities(bool temporary);
+
   private:
     std::string loadedFromPath;
 };
@@ -0,0 +1,392 @@
+#include "SoundStream.h"
+
+#include <utils/gu_error.h>
+
+#include <AL/al.h>
+
+// the implementation is compiled into gu, for au::OggLoader:
+#define STB_VORBIS_HEADER_ONLY
+#include <stb_vorbis.c>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#define SOUND_STREAM_DECODE_INTERVAL_MS 20
+// length of one buffer, NUM_BUFFERS of these are queued:
+#define SOUND_STREAM_BUFFER_SECONDS .25
+
+/**
+ * The background thread that decodes ahead for all SoundStreams.
+ */
+class SoundStreamer
+{
+  public:
+
+    static SoundStreamer &get()
+    {
+        static SoundStreamer streamer;
+        return streamer;
+    }
+
+    void add(SoundStream *stream)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            streams.push_back(stream);
+            if (!thread.joinable())
+            {
+                thread = std::thread(&SoundStreamer::work, this);
+            }
+        }
+        condition.notify_one();
+    }
+
+    /**
+     * Waits if the stream is being decoded right now.
+     */
+    void remove(SoundStream *stream)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        streams.erase(std::remove(streams.begin(), streams.end(), stream), streams.end());
+    }
+
+    void updateAll()
+    {
+        // don't wait for the background thread to finish decoding, the queued buffers last much longer than a frame.
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            return;
+        }
+        for (SoundStream *stream : streams)
+        {
+            stream->update();
+        }
+    }
+
+    ~SoundStreamer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            bStopping = true;
+        }
+        condition.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+  private:
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            condition.wait(lock, [&] { return bStopping || !streams.empty(); });
+            if (bStopping)
+            {
+                return;
+            }
+            for (SoundStream *stream : streams)
+            {
+                stream->decodeAhead();
+            }
+            condition.wait_for(lock, std::chrono::milliseconds(SOUND_STREAM_DECODE_INTERVAL_MS), [&] { return bStopping; });
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+    bool bStopping = false;
+    std::vector<SoundStream *> streams;
+};
+
+SoundStream::SoundStream(const std::string &path)
+{
+    alGenSources(1, &source);
+    alGenBuffers(NUM_BUFFERS, buffers);
+    try
+    {
+        open(path);
+    }
+    catch (...)
+    {
+        alDeleteSources(1, &source);
+        alDeleteBuffers(NUM_BUFFERS, buffers);
+        throw;
+    }
+}
+
+SoundStream::~SoundStream()
+{
+    close();
+    alDeleteSources(1, &source);
+    alDeleteBuffers(NUM_BUFFERS, buffers);
+}
+
+void SoundStream::open(const std::string &path)
+{
+    close();
+
+    int error = 0;
+    decoder = stb_vorbis_open_filename(path.c_str(), &error, nullptr);
+    if (decoder == nullptr)
+    {
+        throw gu_err("Could not open " + path + " for streaming. stb_vorbis error: " + std::to_string(error));
+    }
+    const stb_vorbis_info info = stb_vorbis_get_info(decoder);
+    channels = info.channels;
+    sampleRate = int(info.sample_rate);
+    if (channels == 1)
+    {
+        format = AL_FORMAT_MONO16;
+    }
+    else if (channels == 2)
+    {
+        format = AL_FORMAT_STEREO16;
+    }
+    else
+    {
+        stb_vorbis_close(decoder);
+        decoder = nullptr;
+        throw gu_err("Cannot stream " + path + ", it has " + std::to_string(channels) + " channels. Only mono and stereo are supported.");
+    }
+    freeBuffers.assign(buffers, buffers + NUM_BUFFERS);
+    SoundStreamer::get().add(this);
+}
+
+void SoundStream::close()
+{
+    if (decoder == nullptr)
+    {
+        return;
+    }
+    // not holding `mutex` while removing, the background thread might be waiting for it while holding its own.
+    // after removing, decodeAhead() and update() are not called anymore.
+    SoundStreamer::get().remove(this);
+
+    alSourceStop(source);
+    // unqueues all buffers:
+    alSourcei(source, AL_BUFFER, 0);
+    stb_vorbis_close(decoder);
+    decoder = nullptr;
+
+    decodedParts.clear();
+    bDecodedAll = false;
+    freeBuffers.assign(buffers, buffers + NUM_BUFFERS);
+    bStarted = false;
+    bEndOfFile = false;
+    bPlaying = false;
+    bStopped = false;
+}
+
+void SoundStream::play()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    bPlaying = true;
+    // if not started yet, update() will start playing once the first parts are decoded.
+    if (bStarted && !bStopped)
+    {
+        alSourcePlay(source);
+    }
+}
+
+void SoundStream::pause()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    bPlaying = false;
+    alSourcePause(source);
+}
+
+bool SoundStream::isPaused() const
+{
+    return !bPlaying;
+}
+
+bool SoundStream::hasStopped() const
+{
+    return bStopped;
+}
+
+void SoundStream::setVolume(float volume)
+{
+    alSourcef(source, AL_GAIN, volume);
+}
+
+void SoundStream::setPitch(float pitch)
+{
+    alSourcef(source, AL_PITCH, pitch);
+}
+
+void SoundStream::setLooping(bool looping)
+{
+    // looping is done by decode(), the OpenAL source itself never loops.
+    bLooping = looping;
+}
+
+float SoundStream::getLength() const
+{
+    return stb_vorbis_stream_length_in_seconds(decoder);
+}
+
+void SoundStream::setPlaybackPosition(float seconds)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!bStarted && seconds > 0.f)
+    {
+        stb_vorbis_seek(decoder, unsigned(seconds * sampleRate));
+        // parts that were decoded from the old position:
+        decodedParts.clear();
+        bDecodedAll = false;
+        bEndOfFile = false;
+    }
+}
+
+static std::mutex streamedOnlyMutex;
+static std::unordered_set<std::string> streamedOnly;
+
+void SoundStream::setStreamedOnly(const std::string &path, bool bStreamedOnly)
+{
+    std::lock_guard<std::mutex> guard(streamedOnlyMutex);
+    if (bStreamedOnly)
+    {
+        streamedOnly.insert(path);
+    }
+    else
+    {
+        streamedOnly.erase(path);
+    }
+}
+
+bool SoundStream::isStreamedOnly(const std::string &path)
+{
+    std::lock_guard<std::mutex> guard(streamedOnlyMutex);
+    return streamedOnly.count(path) != 0;
+}
+
+void SoundStream::updateAll()
+{
+    SoundStreamer::get().updateAll();
+}
+
+void SoundStream::decodeAhead()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    // not before play(), setPlaybackPosition() might still seek.
+    if (bStopped || (!bPlaying && !bStarted))
+    {
+        return;
+    }
+    while (!bDecodedAll && decodedParts.size() < NUM_BUFFERS)
+    {
+        std::vector<short> samples;
+        if (decode(samples))
+        {
+            decodedParts.push_back(std::move(samples));
+        }
+        else
+        {
+            bDecodedAll = true;
+        }
+    }
+}
+
+bool SoundStream::decode(std::vector<short> &samples)
+{
+    const int samplesPerBuffer = int(sampleRate * SOUND_STREAM_BUFFER_SECONDS) * channels;
+    samples.resize(samplesPerBuffer);
+
+    int numSamples = 0;
+    bool bJustLooped = false;
+    while (numSamples < samplesPerBuffer)
+    {
+        if (bEndOfFile)
+        {
+            if (!bLooping || bJustLooped)
+            {
+                break;
+            }
+            stb_vorbis_seek_start(decoder);
+            bEndOfFile = false;
+            bJustLooped = true;
+        }
+        const int numFrames = stb_vorbis_get_samples_short_interleaved(
+            decoder, channels, samples.data() + numSamples, samplesPerBuffer - numSamples
+        );
+        if (numFrames == 0)
+        {
+            bEndOfFile = true;
+        }
+        else
+        {
+            numSamples += numFrames * channels;
+            bJustLooped = false;
+        }
+    }
+    samples.resize(numSamples);
+    return numSamples > 0;
+}
+
+void SoundStream::update()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (bStopped || (!bStarted && !bPlaying))
+    {
+        return;
+    }
+
+    ALint numProcessed = 0;
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &numProcessed);
+    for (int i = 0; i < numProcessed; i++)
+    {
+        ALuint buffer = 0;
+        alSourceUnqueueBuffers(source, 1, &buffer);
+        freeBuffers.push_back(buffer);
+    }
+    while (!freeBuffers.empty() && !decodedParts.empty())
+    {
+        const std::vector<short> &samples = decodedParts.front();
+        alBufferData(freeBuffers.back(), format, samples.data(), ALsizei(samples.size() * sizeof(short)), sampleRate);
+        alSourceQueueBuffers(source, 1, &freeBuffers.back());
+        freeBuffers.pop_back();
+        decodedParts.pop_front();
+    }
+
+    ALint numQueued = 0, state = 0;
+    alGetSourcei(source, AL_BUFFERS_QUEUED, &numQueued);
+    alGetSourcei(source, AL_SOURCE_STATE, &state);
+
+    if (!bStarted)
+    {
+        if (numQueued == 0)
+        {
+            // nothing decoded yet, or an empty file:
+            bStopped = bDecodedAll;
+            return;
+        }
+        bStarted = true;
+        alSourcePlay(source);
+        return;
+    }
+    if (state == AL_STOPPED)
+    {
+        if (numQueued == 0 && bDecodedAll && decodedParts.empty())
+        {
+            // everything was decoded and played.
+            bStopped = true;
+        }
+        else if (bPlaying && numQueued > 0)
+        {
+            // the source played all buffers before they were refilled.
+            alSourcePlay(source);
+        }
+    }
+}
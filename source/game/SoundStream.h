@@ -0,0 +1,124 @@
+
+#ifndef GAME_SOUNDSTREAM_H
+#define GAME_SOUNDSTREAM_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct stb_vorbis;
+
+/**
+ * Plays an .ogg file while decoding it, instead of decoding the whole file into an au::Sound first.
+ * Meant for long sounds like music, see SoundSpeaker::stream.
+ *
+ * One background thread, shared by all streams, decodes the next parts of the file.
+ * OpenAL is only used on the main thread: update() (called every frame by dibidab) puts the decoded parts in a small ring of buffers
+ * that is queued on the source.
+ * Has the same controls as au::SoundSource.
+ */
+class SoundStream
+{
+  public:
+
+    explicit SoundStream(const std::string &path);
+
+    SoundStream(const SoundStream &) = delete;
+
+    ~SoundStream();
+
+    void play();
+
+    void pause();
+
+    bool isPaused() const;
+
+    /**
+     * True if the end was reached (never if looping).
+     */
+    bool hasStopped() const;
+
+    void setVolume(float volume);
+
+    void setPitch(float pitch);
+
+    void setLooping(bool looping);
+
+    /**
+     * Length of the opened file in seconds.
+     */
+    float getLength() const;
+
+    /**
+     * Only has effect before play() is called for the first time.
+     */
+    void setPlaybackPosition(float seconds);
+
+    /**
+     * Reuses the OpenAL source and buffers to play another file. The stream is stopped and paused afterwards.
+     */
+    void open(const std::string &path);
+
+    /**
+     * Used by the .ogg asset loader: files larger than EngineSettings::audio.streamSoundsLargerThanKB are not decoded into an au::Sound,
+     * the au::Sound asset stays empty, and SoundSpeakers will stream those files.
+     */
+    static void setStreamedOnly(const std::string &path, bool bStreamedOnly);
+
+    static bool isStreamedOnly(const std::string &path);
+
+    /**
+     * Call this on the main thread, every frame. Queues the parts that were decoded since the last call on the sources of all streams.
+     */
+    static void updateAll();
+
+  private:
+
+    friend class SoundStreamer;
+
+    void close();
+
+    constexpr static int NUM_BUFFERS = 4;
+
+    /**
+     * Called by the background thread. Decodes parts until NUM_BUFFERS parts are waiting to be queued.
+     */
+    void decodeAhead();
+
+    /**
+     * Decodes the next part into `samples`. Returns false if there was nothing left to decode.
+     */
+    bool decode(std::vector<short> &samples);
+
+    /**
+     * Called by updateAll() on the main thread. Refills processed buffers, and restarts the source if it ran out of buffers.
+     */
+    void update();
+
+    stb_vorbis *decoder = nullptr;
+    int channels = 0;
+    int sampleRate = 0;
+    int format = 0;
+
+    // held by decodeAhead() on the background thread, and by the functions that are called on the main thread.
+    std::mutex mutex;
+
+    // decoded by the background thread, waiting to be queued by update():
+    std::deque<std::vector<short>> decodedParts;
+    bool bDecodedAll = false;
+
+    unsigned int source = 0;
+    unsigned int buffers[NUM_BUFFERS] {};
+    // buffers that are not queued on the source:
+    std::vector<unsigned int> freeBuffers;
+    std::atomic<bool> bStarted = false;
+    bool bEndOfFile = false;
+
+    std::atomic<bool> bPlaying = false;
+    std::atomic<bool> bLooping = false;
+    std::atomic<bool> bStopped = false;
+};
+
+#endif //GAME_SOUNDSTREAM_H
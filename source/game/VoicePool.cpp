@@ -0,0 +1,157 @@
+#include "VoicePool.h"
+#include "dibidab.h"
+
+#include <algorithm>
+
+// stopped sources that are kept for reuse, for all sounds together:
+#define MAX_FREE_SOURCES 32
+#define MAX_FREE_STREAMS 4
+
+VoicePool &VoicePool::get()
+{
+    // never destroyed, sources might still be released while statics are destroyed.
+    static VoicePool *pool = new VoicePool;
+    return *pool;
+}
+
+int VoicePool::getNumVoices() const
+{
+    return numVoices;
+}
+
+int VoicePool::getNumFreeVoices() const
+{
+    return std::max(0, dibidab::settings.audio.maxVoices - numVoices);
+}
+
+std::shared_ptr<au::SoundSource> VoicePool::acquire(const asset<au::Sound> &sound)
+{
+    if (getNumFreeVoices() == 0)
+    {
+        return nullptr;
+    }
+    const std::string &path = sound.getLoadedAsset()->fullPath;
+    const au::Sound *current = &sound.get();
+    dropReloaded(path, current);
+
+    au::SoundSource *source = nullptr;
+
+    auto it = freeSourcesByPath.find(path);
+    if (it != freeSourcesByPath.end())
+    {
+        // the most recently released one:
+        auto newest = it->second.back();
+        source = newest->source;
+        freeSources.erase(newest);
+        it->second.pop_back();
+        if (it->second.empty())
+        {
+            freeSourcesByPath.erase(it);
+        }
+    }
+    else
+    {
+        source = new au::SoundSource(*current);
+    }
+    numVoices++;
+    return std::shared_ptr<au::SoundSource>(source, [this, sound, current] (au::SoundSource *source)
+    {
+        release(source, sound, current);
+    });
+}
+
+std::shared_ptr<SoundStream> VoicePool::acquireStream(const std::string &path)
+{
+    if (getNumFreeVoices() == 0)
+    {
+        return nullptr;
+    }
+    SoundStream *stream = nullptr;
+    if (!freeStreams.empty())
+    {
+        stream = freeStreams.back();
+        freeStreams.pop_back();
+        try
+        {
+            stream->open(path);
+        }
+        catch (...)
+        {
+            delete stream;
+            throw;
+        }
+    }
+    else
+    {
+        stream = new SoundStream(path);
+    }
+    numVoices++;
+    return std::shared_ptr<SoundStream>(stream, [this] (SoundStream *stream)
+    {
+        release(stream);
+    });
+}
+
+void VoicePool::release(au::SoundSource *source, const asset<au::Sound> &sound, const au::Sound *createdFor)
+{
+    numVoices--;
+    source->stop();
+
+    if (&sound.get() != createdFor)
+    {
+        // the sound was reloaded while this source was playing.
+        delete source;
+        return;
+    }
+    const std::string &path = sound.getLoadedAsset()->fullPath;
+    dropReloaded(path, createdFor);
+
+    freeSources.push_back({ path, createdFor, source });
+    freeSourcesByPath[path].push_back(std::prev(freeSources.end()));
+
+    while (freeSources.size() > MAX_FREE_SOURCES)
+    {
+        evictOldest();
+    }
+}
+
+void VoicePool::dropReloaded(const std::string &path, const au::Sound *current)
+{
+    auto it = freeSourcesByPath.find(path);
+    if (it == freeSourcesByPath.end() || it->second.front()->createdFor == current)
+    {
+        return;
+    }
+    for (auto &stale : it->second)
+    {
+        delete stale->source;
+        freeSources.erase(stale);
+    }
+    freeSourcesByPath.erase(it);
+}
+
+void VoicePool::evictOldest()
+{
+    FreeSource &oldest = freeSources.front();
+    auto it = freeSourcesByPath.find(oldest.path);
+    // released in the same order, so it is the oldest of its path too:
+    it->second.pop_front();
+    if (it->second.empty())
+    {
+        freeSourcesByPath.erase(it);
+    }
+    delete oldest.source;
+    freeSources.pop_front();
+}
+
+void VoicePool::release(SoundStream *stream)
+{
+    numVoices--;
+    if (freeStreams.size() >= MAX_FREE_STREAMS)
+    {
+        delete stream;
+        return;
+    }
+    stream->pause();
+    freeStreams.push_back(stream);
+}
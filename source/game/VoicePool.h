@@ -0,0 +1,69 @@
+
+#ifndef GAME_VOICEPOOL_H
+#define GAME_VOICEPOOL_H
+
+#include "SoundStream.h"
+
+#include <audio/audio.h>
+#include <asset_manager/asset.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Limits the number of sounds playing at the same time to EngineSettings::audio.maxVoices, for all rooms together,
+ * and reuses the OpenAL sources of sounds that stopped.
+ *
+ * The returned sources give their voice back to the pool when the last reference to them is dropped.
+ * A limited number of stopped sources is kept for reuse, the least recently released are deleted first.
+ */
+class VoicePool
+{
+  public:
+
+    static VoicePool &get();
+
+    int getNumVoices() const;
+
+    int getNumFreeVoices() const;
+
+    /**
+     * Returns nullptr if all voices are in use.
+     * The source is stopped, and might have the volume/pitch/looping settings of its previous use.
+     */
+    std::shared_ptr<au::SoundSource> acquire(const asset<au::Sound> &sound);
+
+    std::shared_ptr<SoundStream> acquireStream(const std::string &path);
+
+  private:
+
+    void release(au::SoundSource *, const asset<au::Sound> &sound, const au::Sound *createdFor);
+
+    void release(SoundStream *);
+
+    /**
+     * Deletes the free sources of `path` that were created for another version of the sound, because it was reloaded.
+     */
+    void dropReloaded(const std::string &path, const au::Sound *current);
+
+    void evictOldest();
+
+    int numVoices = 0;
+
+    struct FreeSource
+    {
+        std::string path;
+        // the sources hold the OpenAL buffer of the au::Sound they were created for, which is replaced when the asset is reloaded.
+        const au::Sound *createdFor;
+        au::SoundSource *source;
+    };
+    // least recently released first:
+    std::list<FreeSource> freeSources;
+    std::unordered_map<std::string, std::list<std::list<FreeSource>::iterator>> freeSourcesByPath;
+    std::vector<SoundStream *> freeStreams;
+};
+
+#endif //GAME_VOICEPOOL_H
@@ -1,4 +1,7 @@
 #include "dibidab.h"
+#include "AssetReloadQueue.h"
+#include "DecodedSound.h"
+#include "SoundStream.h"
 
 #include "../ecs/EntityInspector.h"
 #include "../rendering/ImGuiStyle.h"
@@ -18,12 +21,15 @@
 #include <code_editor/CodeEditor.h>
 #include <utils/startup_args.h>
 
-#include <mutex>
+#include <filesystem>
+#include <memory>
 
 dibidab::EngineSettings dibidab::settings;
 
 std::map<std::string, std::string> dibidab::startupArgs;
 
+#define LUA_PROFILE_DEFAULT_PATH "lua_profile.folded"
+
 Session &dibidab::getCurrentSession()
 {
     auto *s = tryGetCurrentSession();
@@ -33,6 +39,8 @@ Session &dibidab::getCurrentSession()
 }
 
 delegate<void()> dibidab::onSessionChange;
+
+delegate<void(int numLoaded, int numTotal)> dibidab::onAssetLoadingProgress;
 Session *currSession = nullptr;
 
 Session *dibidab::tryGetCurrentSession()
@@ -112,6 +120,28 @@ void showDeveloperOptionsMenuBar()
         std::string luamem = "Lua memory: " + std::to_string(luau::getLuaState().memory_used() / (1024.f*1024.f)) + "MB";
         ImGui::MenuItem(luamem.c_str(), nullptr, false, false);
 
+        if (ImGui::BeginMenu("Lua profiler"))
+        {
+            bool bProfilerEnabled = luau::profiler::isEnabled();
+            if (ImGui::MenuItem("Enabled", nullptr, &bProfilerEnabled))
+                luau::profiler::setEnabled(bProfilerEnabled);
+
+            if (ImGui::MenuItem("Dump to " LUA_PROFILE_DEFAULT_PATH))
+                luau::profiler::dump(LUA_PROFILE_DEFAULT_PATH);
+
+            if (ImGui::MenuItem("Reset"))
+                luau::profiler::reset();
+
+            ImGui::Separator();
+            for (auto &[labelPath, stats] : luau::profiler::getScopeStats())
+            {
+                std::string item = labelPath + ": " + std::to_string(int(stats.totalMicroseconds / 1000.)) + "ms ("
+                    + std::to_string(stats.calls) + " calls)";
+                ImGui::MenuItem(item.c_str(), nullptr, false, false);
+            }
+            ImGui::EndMenu();
+        }
+
         ImGui::EndMenu();
     }
 
@@ -124,6 +154,19 @@ void showDeveloperOptionsMenuBar()
     );
 }
 
+AssetReloadQueue dibidab::assetReloadQueue;
+
+/**
+ * Large sounds are not decoded at load time, SoundSpeakers will stream them (see SoundStream).
+ */
+static bool shouldOnlyStreamSound(const std::string &path)
+{
+    const int thresholdKB = dibidab::settings.audio.streamSoundsLargerThanKB;
+    const bool bStreamedOnly = thresholdKB > 0 && std::filesystem::file_size(path) > uintmax_t(thresholdKB) * 1024u;
+    SoundStream::setStreamedOnly(path, bStreamedOnly);
+    return bStreamedOnly;
+}
+
 void dibidab::addDefaultAssetLoaders()
 {
 #ifdef DIBIDAB_ADD_TEXTURE_ASSET_LOADER
@@ -134,32 +177,73 @@ void dibidab::addDefaultAssetLoaders()
 #endif
     AssetManager::addAssetLoader<std::string>({ ".frag", ".vert", ".glsl" }, [](auto path) {
 
+        if (auto *prepared = assetReloadQueue.takePrepared<std::string>(path))
+            return prepared;
+        return new std::string(fu::readString(path.c_str()));
+    });
+    assetReloadQueue.addPreparer<std::string>({ ".frag", ".vert", ".glsl" }, [](auto path) {
+
         return new std::string(fu::readString(path.c_str()));
     });
     AssetManager::addAssetLoader<json>({ ".json" }, [](auto path) {
 
+        if (auto *prepared = assetReloadQueue.takePrepared<json>(path))
+            return prepared;
         return new json(json::parse(fu::readString(path.c_str())));
     });
+    assetReloadQueue.addPreparer<json>({ ".json" }, [](auto path) {
+
+        return new json(json::parse(fu::readString(path.c_str())));
+    });
+    // sounds are decoded by the preparers, but the OpenAL buffers are created by the loaders, on the main thread:
     AssetManager::addAssetLoader<au::Sound>({ ".wav" }, [](auto path) {
 
+        if (auto *prepared = assetReloadQueue.takePrepared<DecodedSound>(path))
+        {
+            std::unique_ptr<DecodedSound> decoded(prepared);
+            return decoded->createSound();
+        }
         auto sound = new au::Sound;
         au::WavLoader(path.c_str(), *sound);
         return sound;
     });
+    assetReloadQueue.addPreparer<DecodedSound>({ ".wav" }, [](auto path) {
+
+        // nullptr for encodings that only au::WavLoader supports, the loader will use that instead.
+        return DecodedSound::decodeWav(path);
+    });
     AssetManager::addAssetLoader<au::Sound>({ ".ogg" }, [](auto path) {
 
+        if (auto *prepared = assetReloadQueue.takePrepared<DecodedSound>(path))
+        {
+            std::unique_ptr<DecodedSound> decoded(prepared);
+            return decoded->createSound();
+        }
         auto sound = new au::Sound;
-        au::OggLoader::load(path.c_str(), *sound);
+        if (!shouldOnlyStreamSound(path))
+            au::OggLoader::load(path.c_str(), *sound);
         return sound;
     });
+    assetReloadQueue.addPreparer<DecodedSound>({ ".ogg" }, [](auto path) {
+
+        if (shouldOnlyStreamSound(path))
+            return new DecodedSound;
+        return DecodedSound::decodeOgg(path);
+    });
     AssetManager::addAssetLoader<luau::Script>({ ".lua" }, [](auto path) {
 
+        if (auto *prepared = assetReloadQueue.takePrepared<luau::Script>(path))
+            return prepared;
         return new luau::Script(path);
     });
+    assetReloadQueue.addPreparer<luau::Script>({ ".lua" }, [](auto path) {
+
+        // the main Lua state is not thread-safe, the reload thread compiles with its own:
+        static thread_local sol::state compiler;
+        return new luau::Script(path, luau::Script::compile(compiler, path));
+    });
 }
 
-std::mutex assetToReloadMutex;
-std::string assetToReload;
 FileWatcher assetWatcher;
 
 void dibidab::init(int argc, char **argv, gu::Config &config)
@@ -184,6 +268,12 @@ void dibidab::init(int argc, char **argv, gu::Config &config)
     // audio:
     au::init();
 
+    luau::setGarbageCollectorMode(dibidab::settings.lua.generationalGC, dibidab::settings.lua.gcStepBudgetMicroseconds > 0);
+
+    // --lua-profile [path]: profile Lua for the whole run, the folded stacks are written when the game closes.
+    if (dibidab::startupArgs.count("lua-profile"))
+        luau::profiler::setEnabled(true);
+
     setImGuiStyleAndConfig();
 
     #ifdef linux
@@ -191,14 +281,22 @@ void dibidab::init(int argc, char **argv, gu::Config &config)
 
     assetWatcher.onChange = [&] (auto path)
     {
-        assetToReloadMutex.lock();
-        assetToReload = path;
-        assetToReloadMutex.unlock();
+        dibidab::assetReloadQueue.push(path);
     };
+    dibidab::assetReloadQueue.start();
     assetWatcher.startWatchingAsync();
     #endif
 
-    AssetManager::loadDirectory("assets");
+    if (dibidab::settings.bParallelAssetLoading)
+    {
+        dibidab::assetReloadQueue.loadDirectory("assets", "assets/", dibidab::settings.numAssetLoadingThreads,
+            [] (int numLoaded, int numTotal) {
+                dibidab::onAssetLoadingProgress(numLoaded, numTotal);
+            }
+        );
+    }
+    else
+        AssetManager::loadDirectory("assets");
 
     // save window size in settings:
     static auto onResize = gu::onResize += [] {
@@ -212,17 +310,30 @@ void dibidab::init(int argc, char **argv, gu::Config &config)
         if (currSession)
             currSession->update(deltaTime);
 
-        if (KeyInput::justPressed(dibidab::settings.keyInput.reloadAssets) && dibidab::settings.bShowDeveloperOptions)
-            AssetManager::loadDirectory("assets", true);
+        // the settings can be changed at runtime, a budget of 0 must hand collection back to Lua:
+        static bool bGenerationalGC = dibidab::settings.lua.generationalGC;
+        static bool bManualGCStepping = dibidab::settings.lua.gcStepBudgetMicroseconds > 0;
+        if (bGenerationalGC != dibidab::settings.lua.generationalGC || bManualGCStepping != (dibidab::settings.lua.gcStepBudgetMicroseconds > 0))
+        {
+            bGenerationalGC = dibidab::settings.lua.generationalGC;
+            bManualGCStepping = dibidab::settings.lua.gcStepBudgetMicroseconds > 0;
+            luau::setGarbageCollectorMode(bGenerationalGC, bManualGCStepping);
+        }
 
+        if (bManualGCStepping)
         {
-            assetToReloadMutex.lock();
-            if (!assetToReload.empty())
-                AssetManager::loadFile(assetToReload, "assets/", true);
-            assetToReload.clear();
-            assetToReloadMutex.unlock();
+            gu::profiler::Zone gcZone("lua gc");
+            luau::stepGarbageCollector(dibidab::settings.lua.gcStepBudgetMicroseconds, dibidab::settings.lua.gcStepSizeKB);
         }
 
+        // the streams decode on a background thread, but use OpenAL only here:
+        SoundStream::updateAll();
+
+        if (KeyInput::justPressed(dibidab::settings.keyInput.reloadAssets) && dibidab::settings.bShowDeveloperOptions)
+            AssetManager::loadDirectory("assets", true);
+
+        dibidab::assetReloadQueue.swapPrepared("assets/");
+
         {
             dibidab::settings.graphics.vsync = gu::getVSync();
             dibidab::settings.graphics.fullscreen = gu::bFullscreen;
@@ -244,6 +355,15 @@ void dibidab::init(int argc, char **argv, gu::Config &config)
 void dibidab::run()
 {
     gu::run();
+    dibidab::assetReloadQueue.stop();
     dibidab::setCurrentSession(nullptr);
+
+    auto luaProfileArg = dibidab::startupArgs.find("lua-profile");
+    if (luaProfileArg != dibidab::startupArgs.end())
+    {
+        const std::string &path = luaProfileArg->second.empty() ? LUA_PROFILE_DEFAULT_PATH : luaProfileArg->second;
+        if (!luau::profiler::dump(path.c_str()))
+            std::cerr << "Could not write Lua profile to " << path << std::endl;
+    }
     au::terminate();
 }
@@ -10,6 +10,8 @@ namespace gu
     struct Config;
 }
 
+class AssetReloadQueue;
+
 namespace dibidab
 {
 
@@ -19,10 +21,21 @@ namespace dibidab
 
     extern delegate<void()> onSessionChange;
 
+    /**
+     * Called on the main thread after each asset that is loaded at startup, only if settings.bParallelAssetLoading is true.
+     */
+    extern delegate<void(int numLoaded, int numTotal)> onAssetLoadingProgress;
+
     Session &getCurrentSession();
     Session *tryGetCurrentSession();
     void setCurrentSession(Session *);
 
+    /**
+     * Changed asset files are reloaded through this queue. Custom asset loaders can add a preparer to it,
+     * to do the expensive part of reloading on a background thread.
+     */
+    extern AssetReloadQueue assetReloadQueue;
+
     void addDefaultAssetLoaders();
 
     void init(int argc, char *argv[], gu::Config &config);
@@ -66,7 +66,8 @@ void Session::spawnPlayerEntity(Player_ptr &p)
         if (!spawnRoom)
             spawnRoom = &level->getRoom(0);
 
-        auto &templ = spawnRoom->getTemplate("Player");
+        static const TemplateHandle playerTemplate("Player");
+        auto &templ = spawnRoom->getTemplate(playerTemplate);
         auto e = templ.create();
         PlayerControlled pc;
         pc.playerId = p->id;
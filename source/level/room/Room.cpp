@@ -106,6 +106,7 @@ void Room::loadPersistentEntities()
         {
             auto &p = entities.assign<Persistent>(e);
             p.persistentId = jsonEntity.at("persistentId");
+            entities.ctx_or_set<PersistentEntities>().set(p.persistentId, e);
             p.data = jsonEntity.at("data");
             if (jsonEntity.contains("position"))
                 setPosition(e, jsonEntity["position"]);
@@ -131,6 +132,8 @@ void Room::loadPersistentEntities()
         }
     }
     persistentEntitiesToLoad.clear();
+    // ids of entities that were not saved (or failed to load) can be reused now:
+    entities.ctx_or_set<PersistentEntities>().releaseUnclaimed();
     bLoadingPersistentEntities = false;
     luaEnvironment[resolveFuncName] = originalResolvePersistentRef;
     luaEnvironment[tryResolveFuncName] = originalTryResolvePersistentRef;
@@ -182,9 +185,9 @@ void Room::exportJsonData(json &j)
     events.emit(0, "BeforeSave");
     j = json{
         {"name", name},
-        {"entities", revivableEntitiesToSave},
-        {"persistentIdCounter", entities.ctx_or_set<PersistentEntities>().idCounter}
+        {"entities", revivableEntitiesToSave}
     };
+    entities.ctx_or_set<PersistentEntities>().toJson(j["persistentIdGenerations"]);
     entities.view<const Persistent>().each([&](auto e, const Persistent &persistent) {
 
         j["entities"].push_back(json::object());
@@ -196,5 +199,8 @@ void Room::loadJsonData(const json &j)
 {
     name = j.at("name");
     persistentEntitiesToLoad = j.at("entities");
-    entities.ctx_or_set<PersistentEntities>().idCounter = j.at("persistentIdCounter");
+    if (j.contains("persistentIdGenerations"))
+        entities.ctx_or_set<PersistentEntities>().loadJson(j["persistentIdGenerations"]);
+    else
+        entities.ctx_or_set<PersistentEntities>().loadLegacyIdCounter(j.at("persistentIdCounter"));
 }
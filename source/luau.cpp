@@ -1,6 +1,10 @@
 
 #include "ai/behavior_trees/BehaviorTree.h"
+#include "ai/behavior_trees/CompiledBehaviorTree.h"
+#include "ecs/NameSymbol.h"
+#include "ecs/entity_templates/EntityTemplate.h"
 #include "ecs/PersistentEntityRef.h"
+#include "ecs/systems/AudioSystem.h"
 #include "game/session/SingleplayerSession.h"
 #include "luau.h"
 #include "game/dibidab.h"
@@ -8,9 +12,14 @@
 #include <input/gamepad_input.h>
 #include <gu/game_utils.h>
 
+#include <chrono>
+
 luau::Script::Script(const std::string &path) : path(path)
 {}
 
+luau::Script::Script(const std::string &path, sol::bytecode bytecode) : path(path), bytecode(std::move(bytecode))
+{}
+
 const sol::bytecode &luau::Script::getByteCode()
 {
     if (!bytecode.empty())
@@ -18,14 +27,18 @@ const sol::bytecode &luau::Script::getByteCode()
         return bytecode;
     }
 
-    sol::load_result lr = luau::getLuaState().load_file(path);
+    bytecode = compile(luau::getLuaState(), path);
+    return bytecode;
+}
+
+sol::bytecode luau::Script::compile(sol::state_view lua, const std::string &path)
+{
+    sol::load_result lr = lua.load_file(path);
     if (!lr.valid())
     {
         throw gu_err("Lua code invalid!:\n" + std::string(lr.get<sol::error>().what()));
     }
-
-    bytecode = sol::protected_function(lr).dump();
-    return bytecode;
+    return sol::protected_function(lr).dump();
 }
 
 
@@ -121,6 +134,16 @@ sol::state &luau::getLuaState()
             dibidab::setCurrentSession(nullptr);
         };
 
+        env["setLuaProfilerEnabled"] = [] (bool bEnabled) {
+            profiler::setEnabled(bEnabled);
+        };
+        env["resetLuaProfiler"] = [] {
+            profiler::reset();
+        };
+        env["dumpLuaProfile"] = [] (const char *path) -> bool {
+            return profiler::dump(path);
+        };
+
         env["startSinglePlayerSession"] = [] (const sol::optional<std::string> &saveGamePath) {
             dibidab::setCurrentSession(new SingleplayerSession(saveGamePath.has_value() ? saveGamePath->c_str() : nullptr));
         };
@@ -159,6 +182,7 @@ sol::state &luau::getLuaState()
         // register Yaml-structs:
         for (auto &[typeName, info] : SerializableStructInfo::getForAllTypes())
             info->luaUserTypeGenerator(*lua);
+        AudioSystem::addToLuaEnvironment(lua);
 
         // register glm vectors:
         registerVecUserType<int>("ivec", *lua);
@@ -208,7 +232,23 @@ sol::state &luau::getLuaState()
             return GamepadInput::getAxisName(key);
         };
 
+        // register NameSymbol, so that scripts can look up names without hashing them every time:
+        sol::usertype<LuaNameSymbol> nameSymbol = lua->new_usertype<LuaNameSymbol>("NameSymbol", sol::call_constructor,
+            sol::factories([] (const std::string &name) {
+                return LuaNameSymbol { NameSymbol(name) };
+            }));
+        nameSymbol[sol::meta_function::to_string] = [] (const LuaNameSymbol &s) -> const std::string & {
+            return s.symbol.str();
+        };
+        nameSymbol[sol::meta_function::equal_to] = [] (const LuaNameSymbol &a, const LuaNameSymbol &b) {
+            return a.symbol == b.symbol;
+        };
+
+        // returned by getTemplate(name):
+        lua->new_usertype<TemplateHandle>("TemplateHandle");
+
         BehaviorTree::addToLuaEnvironment(lua);
+        CompiledBehaviorTree::addToLuaEnvironment(lua);
     }
     return *lua;
 }
@@ -237,3 +277,63 @@ lua_Debug luau::getDebugInfo(sol::function func)
     }
     return dbgInfo;
 }
+
+static bool bGenerationalGC = false;
+static bool bManualGCStepping = false;
+static int memoryKBAfterLastGCCycle = 0;
+
+void luau::setGarbageCollectorMode(bool bGenerational, bool bManualStepping)
+{
+    lua_State *luaState = getLuaState().lua_state();
+
+    // Passing 0 for the parameters means: keep Lua's defaults.
+    if (bGenerational)
+        lua_gc(luaState, LUA_GCGEN, 0, 0);
+    else
+        lua_gc(luaState, LUA_GCINC, 0, 0, 0);
+
+    if (bManualStepping)
+        lua_gc(luaState, LUA_GCSTOP, 0);
+    else
+        lua_gc(luaState, LUA_GCRESTART, 0);
+
+    bGenerationalGC = bGenerational;
+    bManualGCStepping = bManualStepping;
+    memoryKBAfterLastGCCycle = lua_gc(luaState, LUA_GCCOUNT, 0);
+}
+
+int luau::stepGarbageCollector(int budgetMicroseconds, int stepSizeKB)
+{
+    if (!bManualGCStepping)
+        return 0;
+
+    lua_State *luaState = getLuaState().lua_state();
+    auto startTime = std::chrono::steady_clock::now();
+    auto getMicrosecondsSpent = [&] {
+        return int(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+    };
+
+    const int memoryKB = lua_gc(luaState, LUA_GCCOUNT, 0);
+    if (memoryKB > 4 * std::max(memoryKBAfterLastGCCycle, 1024))
+    {
+        // Garbage is created faster than the budget allows us to collect it. Better a spike than running out of memory.
+        std::cerr << "Lua garbage collector can't keep up with budget of " << budgetMicroseconds << "us, doing a full collection ("
+            << memoryKB / 1024 << "MB in use)" << std::endl;
+        lua_gc(luaState, LUA_GCCOLLECT, 0);
+        memoryKBAfterLastGCCycle = lua_gc(luaState, LUA_GCCOUNT, 0);
+        return getMicrosecondsSpent();
+    }
+
+    do
+    {
+        // In generational mode a step is a complete (minor) collection, so one step per frame is enough.
+        if (lua_gc(luaState, LUA_GCSTEP, stepSizeKB) || bGenerationalGC)
+        {
+            memoryKBAfterLastGCCycle = lua_gc(luaState, LUA_GCCOUNT, 0);
+            break;
+        }
+    }
+    while (getMicrosecondsSpent() < budgetMicroseconds);
+
+    return getMicrosecondsSpent();
+}
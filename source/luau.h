@@ -12,14 +12,27 @@ extern "C" {
 #include <sol/sol.hpp>
 #include <utils/gu_error.h>
 
+#include "luau_profiler.h"
+
 namespace luau
 {
     struct Script
     {
         Script(const std::string &path);
 
+        /**
+         * For a script that was already compiled, see compile().
+         */
+        Script(const std::string &path, sol::bytecode bytecode);
+
         const sol::bytecode &getByteCode();
 
+        /**
+         * Compiles the file using `lua`, which does not have to be the main Lua state.
+         * The bytecode can be used by any Lua state, so scripts can be compiled on another thread.
+         */
+        static sol::bytecode compile(sol::state_view lua, const std::string &path);
+
       private:
         std::string path;
         sol::bytecode bytecode;
@@ -30,6 +43,7 @@ namespace luau
     template <typename ...Args>
     void callFunction(sol::function func, Args&&... args)
     {
+        profiler::Scope profilerScope(nullptr);
         sol::protected_function_result result = func(std::forward<Args>(args)...);
         if (!result.valid())
             throw gu_err(result.get<sol::error>().what());
@@ -53,6 +67,18 @@ namespace luau
 
     lua_Debug getDebugInfo(sol::function func);
 
+    /**
+     * If bManualStepping is true, Lua's allocator will no longer start garbage collection by itself.
+     * The engine is then responsible for calling stepGarbageCollector() regularly.
+     */
+    void setGarbageCollectorMode(bool bGenerational, bool bManualStepping);
+
+    /**
+     * Performs garbage collection steps of stepSizeKB until the current cycle is finished or the budget is used up.
+     * Returns the time spent in microseconds.
+     */
+    int stepGarbageCollector(int budgetMicroseconds, int stepSizeKB);
+
 }
 
 #endif //GAME_LUAU_H
@@ -0,0 +1,178 @@
+
+#include "luau_profiler.h"
+#include "luau.h"
+
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+constexpr static int SAMPLE_INSTRUCTION_COUNT = 1000;
+constexpr static int MAX_SAMPLED_STACK_DEPTH = 64;
+
+static bool bProfilerEnabled = false;
+static int numActiveScopes = 0;
+
+// time of the previous sample (or of entering/leaving a scope), time between now and then is given to the next sample.
+static long long lastSampleTime = 0;
+
+static std::vector<const char *> scopeLabels;
+static std::string scopeLabelPath;
+
+static std::unordered_map<std::string, double> foldedStacks;
+static std::map<std::string, luau::profiler::ScopeStats> scopeStats;
+
+static long long getMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void updateScopeLabelPath()
+{
+    scopeLabelPath.clear();
+    for (const char *label : scopeLabels)
+    {
+        if (!scopeLabelPath.empty())
+            scopeLabelPath += ';';
+        scopeLabelPath += label;
+    }
+}
+
+static void addSampleTime(const std::string &stack, long long now)
+{
+    foldedStacks[stack.empty() ? "[unknown]" : stack] += double(now - lastSampleTime);
+    lastSampleTime = now;
+}
+
+static void countHook(lua_State *lua, lua_Debug *)
+{
+    if (!bProfilerEnabled)
+        return;
+
+    const long long now = getMicroseconds();
+    if (numActiveScopes == 0)
+    {
+        // Lua was called without a Scope, the time since the previous sample is unknown.
+        lastSampleTime = now;
+        return;
+    }
+
+    lua_Debug frames[MAX_SAMPLED_STACK_DEPTH];
+    int depth = 0;
+    while (depth < MAX_SAMPLED_STACK_DEPTH && lua_getstack(lua, depth, &frames[depth]))
+    {
+        lua_getinfo(lua, "Snl", &frames[depth]);
+        depth++;
+    }
+
+    std::string stack = scopeLabelPath;
+    // outermost frame first:
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        const lua_Debug &frame = frames[i];
+        if (!stack.empty())
+            stack += ';';
+
+        stack += frame.name ? frame.name : (*frame.what == 'm' ? "main chunk" : "?");
+        if (*frame.what == 'C')
+        {
+            stack += " [C]";
+            continue;
+        }
+        stack += " (";
+        stack += frame.short_src;
+        stack += ':';
+        // the innermost function gets the line that was running, so that hot lines show up as separate frames:
+        stack += std::to_string(i == 0 ? frame.currentline : frame.linedefined);
+        stack += ')';
+    }
+    addSampleTime(stack, now);
+}
+
+luau::profiler::Scope::Scope(const char *label) :
+    bActive(bProfilerEnabled), bPushedLabel(false), startTime(0)
+{
+    if (!bActive)
+        return;
+
+    startTime = getMicroseconds();
+    if (numActiveScopes++ > 0)
+        addSampleTime(scopeLabelPath, startTime); // time spent in the outer scope before entering this one.
+    else
+        lastSampleTime = startTime; // time spent outside of Lua does not belong to the first sample.
+
+    if (label)
+    {
+        scopeLabels.push_back(label);
+        updateScopeLabelPath();
+        bPushedLabel = true;
+    }
+}
+
+luau::profiler::Scope::~Scope()
+{
+    if (!bActive)
+        return;
+
+    // time after the last sample is given to the scope itself, the Lua stack is gone already.
+    const long long now = getMicroseconds();
+    addSampleTime(scopeLabelPath, now);
+
+    ScopeStats &stats = scopeStats[scopeLabelPath.empty() ? "[unlabeled]" : scopeLabelPath];
+    stats.totalMicroseconds += double(now - startTime);
+    stats.calls++;
+    numActiveScopes--;
+
+    if (bPushedLabel)
+    {
+        scopeLabels.pop_back();
+        updateScopeLabelPath();
+    }
+}
+
+void luau::profiler::setEnabled(bool bEnabled)
+{
+    if (bEnabled == bProfilerEnabled)
+        return;
+    bProfilerEnabled = bEnabled;
+
+    if (bEnabled)
+        installHook(getLuaState().lua_state());
+    else
+        lua_sethook(getLuaState().lua_state(), nullptr, 0, 0);
+}
+
+bool luau::profiler::isEnabled()
+{
+    return bProfilerEnabled;
+}
+
+void luau::profiler::reset()
+{
+    foldedStacks.clear();
+    scopeStats.clear();
+}
+
+const std::map<std::string, luau::profiler::ScopeStats> &luau::profiler::getScopeStats()
+{
+    return scopeStats;
+}
+
+bool luau::profiler::dump(const char *path)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+
+    for (auto &[stack, microseconds] : foldedStacks)
+        if (microseconds >= 1.)
+            file << stack << ' ' << (long long) microseconds << '\n';
+
+    return bool(file);
+}
+
+void luau::profiler::installHook(lua_State *lua)
+{
+    if (lua_gethook(lua) != &countHook)
+        lua_sethook(lua, &countHook, LUA_MASKCOUNT, SAMPLE_INSTRUCTION_COUNT);
+}
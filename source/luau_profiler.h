@@ -0,0 +1,66 @@
+
+#ifndef GAME_LUAU_PROFILER_H
+#define GAME_LUAU_PROFILER_H
+
+#include <map>
+#include <string>
+
+struct lua_State;
+
+/**
+ * Sampling profiler for Lua code.
+ *
+ * While enabled, a count hook samples the Lua call stack every few thousand instructions.
+ * Each sample is weighted by the time that passed since the previous sample, and is prefixed with the labels of the
+ * Scopes that are active (e.g. the name of the entity template whose update function is called).
+ *
+ * The result can be dumped as folded stacks ("label;function (file:line);... microseconds"),
+ * which can be turned into a flame graph by tools like flamegraph.pl, speedscope or inferno.
+ */
+namespace luau::profiler
+{
+    struct ScopeStats
+    {
+        double totalMicroseconds = 0.;
+        int calls = 0;
+    };
+
+    /**
+     * Times a call from C++ into Lua. Does nothing if the profiler is disabled.
+     * If label is not nullptr, it is added to the stacks of all samples taken within this scope.
+     */
+    struct Scope
+    {
+        Scope(const char *label);
+
+        ~Scope();
+
+      private:
+        bool bActive, bPushedLabel;
+        long long startTime;
+    };
+
+    void setEnabled(bool);
+
+    bool isEnabled();
+
+    void reset();
+
+    /**
+     * Total time spent in Scopes, by label path (e.g. "Enemy;Bullet").
+     */
+    const std::map<std::string, ScopeStats> &getScopeStats();
+
+    /**
+     * Writes the samples in the folded-stack format. Returns false if the file could not be written.
+     */
+    bool dump(const char *path);
+
+    /**
+     * Coroutines (Lua threads) do not inherit hooks that were set after they were created.
+     * Call this for such a thread to sample it as well.
+     */
+    void installHook(lua_State *);
+}
+
+#endif //GAME_LUAU_PROFILER_H
@@ -10,6 +10,26 @@
 #include <utils/hashing.h>
 #include <math/interpolation.h>
 
+/**
+ * Whether prefabs (see LuaEntityTemplate) can copy a component to other entities.
+ * Copies are shallow, so components with state that should not be shared between entities are excluded here.
+ */
+template<class Component>
+struct PrefabCopyable : std::is_copy_constructible<Component>
+{};
+
+// shares its BehaviorTree/compiled instance, and needs BehaviorTreeSystem to activate it:
+struct Brain;
+template<>
+struct PrefabCopyable<Brain> : std::false_type
+{};
+
+// shares its playing au::SoundSource/SoundStream:
+struct SoundSpeaker;
+template<>
+struct PrefabCopyable<SoundSpeaker> : std::false_type
+{};
+
 struct ComponentUtils
 {
     template<class Component>
@@ -40,8 +60,30 @@ struct ComponentUtils
 
     std::function<EntityObserver *(entt::registry &)> getEntityObserver;
 
+    // used by prefabs (see LuaEntityTemplate): copies the component of an entity, to assign it to other entities later.
+    // copyComponent returns nullptr if the component cannot be copied (see PrefabCopyable).
+    std::function<std::shared_ptr<void>(entt::entity, const entt::registry &)> copyComponent;
+    std::function<void(const std::shared_ptr<void> &, entt::entity, entt::registry &)> pasteComponent;
+
     const SerializableStructInfo *structInfo = nullptr;
 
+    template<class Component>
+    struct FieldsChanged
+    {
+        entt::sigh<void(entt::registry &, entt::entity)> signal;
+    };
+
+    /**
+     * Published after setJsonComponent(), setJsonComponentWithKeys() or setFromLuaTable() set the fields of a component.
+     * These change an existing component in place, so registry.on_replace() is not triggered,
+     * and a new component is assigned (triggering registry.on_construct()) before its fields are set.
+     */
+    template<class Component>
+    static entt::sink<void(entt::registry &, entt::entity)> onFieldsChanged(entt::registry &reg)
+    {
+        return { reg.ctx_or_set<FieldsChanged<Component>>().signal };
+    }
+
     template <class Component>
     const static ComponentUtils *create()
     {
@@ -75,10 +117,12 @@ struct ComponentUtils
         u->setJsonComponent = [] (const json &j, entt::entity e, entt::registry &reg)
         {
             reg.get_or_assign<Component>(e).fromJsonArray(j);
+            publishFieldsChanged<Component>(e, reg);
         };
         u->setJsonComponentWithKeys = [] (const json &j, entt::entity e, entt::registry &reg)
         {
             reg.get_or_assign<Component>(e).fromJson(j);
+            publishFieldsChanged<Component>(e, reg);
         };
         u->addComponent = [] (entt::entity e, entt::registry &reg)
         {
@@ -103,6 +147,8 @@ struct ComponentUtils
 
             else // TODO: give error instead?
                 reg.get_or_assign<Component>(e).fromLuaTable(table);
+
+            publishFieldsChanged<Component>(e, reg);
         };
 
         u->registerLuaFunctions = [u] (sol::table &table, entt::registry &reg)
@@ -122,6 +168,22 @@ struct ComponentUtils
             return &wrapper.observer;
         };
 
+        u->copyComponent = [] (entt::entity e, const entt::registry &reg) -> std::shared_ptr<void>
+        {
+            if constexpr (PrefabCopyable<Component>::value)
+            {
+                return std::make_shared<Component>(reg.get<Component>(e));
+            }
+            else return nullptr;
+        };
+        u->pasteComponent = [] (const std::shared_ptr<void> &copy, entt::entity e, entt::registry &reg)
+        {
+            if constexpr (PrefabCopyable<Component>::value)
+            {
+                reg.assign_or_replace<Component>(e, *static_cast<const Component *>(copy.get()));
+            }
+        };
+
         return u;
     }
 
@@ -152,6 +214,16 @@ struct ComponentUtils
     }
 
   private:
+    template<class Component>
+    static void publishFieldsChanged(entt::entity e, entt::registry &reg)
+    {
+        // no context variable means nobody is listening:
+        if (FieldsChanged<Component> *fieldsChanged = reg.try_ctx<FieldsChanged<Component>>())
+        {
+            fieldsChanged->signal.publish(reg, e);
+        }
+    }
+
     static std::map<std::size_t, ComponentUtils *> *utilsByType;
     static std::map<std::string, ComponentUtils *> *utils;
     static std::vector<std::string> *names;
@@ -1,74 +1,645 @@
 
 #include "lua_converters.h"
 
-template<typename luaRef>
-void jsonToLua(luaRef &luaVal, const json &json)
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+constexpr static int MAX_LUA_TABLE_DEPTH = 128; // deeper than this is probably a table that contains itself.
+
+static void checkLuaTableDepth(lua_State *lua, int depth)
+{
+    if (depth > MAX_LUA_TABLE_DEPTH)
+        throw gu_err("Lua table is nested more than " + std::to_string(MAX_LUA_TABLE_DEPTH) + " levels deep. Does it contain itself?");
+    if (!lua_checkstack(lua, 4))
+        throw gu_err("Lua stack overflow while converting a table");
+}
+
+/**
+ * Returns the length of the table if it is a sequence (keys 1..n), otherwise 0.
+ */
+static std::size_t getLuaSequenceLength(lua_State *lua, int tableIndex, std::size_t &numEntriesOut)
+{
+    numEntriesOut = 0;
+    // lua_rawlen() is not enough, {1, nil, 3, x = 1} has a border at 3 and 3 entries as well.
+    bool bOnlyPositiveIntegerKeys = true;
+    lua_Integer maxKey = 0;
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIndex))
+    {
+        numEntriesOut++;
+        if (bOnlyPositiveIntegerKeys)
+        {
+            if (lua_isinteger(lua, -2) && lua_tointeger(lua, -2) >= 1)
+                maxKey = std::max(maxKey, lua_tointeger(lua, -2));
+            else
+                bOnlyPositiveIntegerKeys = false;
+        }
+        lua_pop(lua, 1);
+    }
+    // n distinct keys that are all in 1..n:
+    return bOnlyPositiveIntegerKeys && std::size_t(maxKey) == numEntriesOut ? numEntriesOut : 0;
+}
+
+///////////////// json
+
+// Number keys of tables that are not sequences are written as "[3]" in json objects.
+// String keys that start with '[' are escaped by adding another '[' in front.
+constexpr static char JSON_NUMBER_KEY_OPEN = '[', JSON_NUMBER_KEY_CLOSE = ']';
+
+static void jsonFromLuaStackValue(lua_State *lua, int index, json &jsonOut, int depth);
+
+static void jsonFromLuaStackTable(lua_State *lua, int tableIndex, json &jsonOut, int depth)
+{
+    checkLuaTableDepth(lua, depth);
+    tableIndex = lua_absindex(lua, tableIndex);
+
+    std::size_t numEntries;
+    if (std::size_t sequenceLength = getLuaSequenceLength(lua, tableIndex, numEntries))
+    {
+        jsonOut = json::array();
+        for (std::size_t i = 1; i <= sequenceLength; i++)
+        {
+            lua_rawgeti(lua, tableIndex, lua_Integer(i));
+            jsonFromLuaStackValue(lua, -1, jsonOut.emplace_back(), depth + 1);
+            lua_pop(lua, 1);
+        }
+        return;
+    }
+    jsonOut = json::object();
+
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIndex))
+    {
+        switch (lua_type(lua, -2))
+        {
+            case LUA_TSTRING:
+            {
+                std::size_t keyLength;
+                const char *key = lua_tolstring(lua, -2, &keyLength);
+                std::string keyStr(key, keyLength);
+                if (!keyStr.empty() && keyStr[0] == JSON_NUMBER_KEY_OPEN)
+                    keyStr.insert(keyStr.begin(), JSON_NUMBER_KEY_OPEN); // escaped, see jsonToLuaStackKey()
+                jsonFromLuaStackValue(lua, -1, jsonOut[keyStr], depth + 1);
+                break;
+            }
+            case LUA_TNUMBER:
+            {
+                // lua_tolstring() would change the key in place, which confuses lua_next(), so convert a copy:
+                lua_pushvalue(lua, -2);
+                std::size_t keyLength;
+                const char *key = lua_tolstring(lua, -1, &keyLength);
+                // marked, so that jsonToLuaTable() turns it back into a number key:
+                std::string keyStr = JSON_NUMBER_KEY_OPEN + std::string(key, keyLength) + JSON_NUMBER_KEY_CLOSE;
+                lua_pop(lua, 1);
+                jsonFromLuaStackValue(lua, -1, jsonOut[keyStr], depth + 1);
+                break;
+            }
+            case LUA_TBOOLEAN:
+                jsonFromLuaStackValue(lua, -1, jsonOut[lua_toboolean(lua, -2) ? "true" : "false"], depth + 1);
+                break;
+            default:
+                break;
+        }
+        lua_pop(lua, 1);
+    }
+}
+
+static void jsonFromLuaStackValue(lua_State *lua, int index, json &jsonOut, int depth)
+{
+    switch (lua_type(lua, index))
+    {
+        case LUA_TNUMBER:
+            if (lua_isinteger(lua, index))
+                jsonOut = int64(lua_tointeger(lua, index));
+            else
+                jsonOut = double(lua_tonumber(lua, index));
+            break;
+        case LUA_TBOOLEAN:
+            jsonOut = bool(lua_toboolean(lua, index));
+            break;
+        case LUA_TSTRING:
+        {
+            std::size_t length;
+            const char *str = lua_tolstring(lua, index, &length);
+            jsonOut = std::string(str, length);
+            break;
+        }
+        case LUA_TTABLE:
+            jsonFromLuaStackTable(lua, index, jsonOut, depth);
+            break;
+        default:
+            jsonOut = json();
+            break;
+    }
+}
+
+void jsonFromLuaStackValue(lua_State *lua, int index, json &jsonOut)
+{
+    jsonFromLuaStackValue(lua, index, jsonOut, 0);
+}
+
+void jsonFromLuaTable(const sol::table &table, json &jsonOut)
+{
+    lua_State *lua = table.lua_state();
+    const int top = lua_gettop(lua);
+    try
+    {
+        table.push();
+        jsonFromLuaStackTable(lua, -1, jsonOut, 0);
+    }
+    catch (...)
+    {
+        lua_settop(lua, top);
+        throw;
+    }
+    lua_settop(lua, top);
+}
+
+static void jsonToLuaStackTable(lua_State *lua, int tableIndex, const json &json, int depth);
+
+/**
+ * Pushes the Lua key for a json object key, see JSON_NUMBER_KEY_OPEN.
+ */
+static void jsonToLuaStackKey(lua_State *lua, const std::string &key)
+{
+    if (key.size() >= 2 && key[0] == JSON_NUMBER_KEY_OPEN)
+    {
+        if (key[1] == JSON_NUMBER_KEY_OPEN)
+        {
+            lua_pushlstring(lua, key.data() + 1, key.size() - 1);
+            return;
+        }
+        // lua_stringtonumber() pushes the number if the string is a valid Lua number:
+        if (key.back() == JSON_NUMBER_KEY_CLOSE && lua_stringtonumber(lua, key.substr(1, key.size() - 2).c_str()) != 0)
+            return;
+    }
+    lua_pushlstring(lua, key.data(), key.size());
+}
+
+/**
+ * Sets table[key] = json, where key is on top of the stack. Pops the key.
+ * Existing sub tables are reused instead of replaced.
+ */
+static void jsonToLuaStackField(lua_State *lua, int tableIndex, const json &json, int depth)
 {
     if (json.is_structured())
     {
-        auto subTable = luaVal.template get_or_create<sol::table>();
-        jsonToLuaTable(subTable, json);
-    } else if (json.is_number_integer())
-        luaVal = int(json);
+        lua_pushvalue(lua, -1);
+        lua_rawget(lua, tableIndex);
+        if (!lua_istable(lua, -1))
+        {
+            lua_pop(lua, 1);
+            lua_createtable(lua, json.is_array() ? int(json.size()) : 0, json.is_object() ? int(json.size()) : 0);
+            lua_pushvalue(lua, -2);
+            lua_pushvalue(lua, -2);
+            lua_rawset(lua, tableIndex);
+        }
+        jsonToLuaStackTable(lua, -1, json, depth + 1);
+        lua_pop(lua, 2);
+        return;
+    }
+    if (json.is_number_integer())
+        lua_pushinteger(lua, lua_Integer(json.get<int64>()));
     else if (json.is_number())
-        luaVal = float(json);
+        lua_pushnumber(lua, lua_Number(json.get<double>()));
     else if (json.is_boolean())
-        luaVal = bool(json);
+        lua_pushboolean(lua, bool(json));
     else if (json.is_string())
-        luaVal = std::string(json);
+    {
+        const std::string &str = json.get_ref<const std::string &>();
+        lua_pushlstring(lua, str.data(), str.size());
+    }
+    else
+    {
+        lua_pop(lua, 1);
+        return;
+    }
+    lua_rawset(lua, tableIndex);
 }
 
-void jsonToLuaTable(sol::table &table, const json &json)
+static void jsonToLuaStackTable(lua_State *lua, int tableIndex, const json &json, int depth)
 {
-    assert(json.is_structured());
+    checkLuaTableDepth(lua, depth);
+    tableIndex = lua_absindex(lua, tableIndex);
+
     if (json.is_object())
-        for (auto &[key, val] : json.items())
+        for (auto it = json.begin(); it != json.end(); ++it)
         {
-            auto ref = table[key];
-            jsonToLua(ref, val);
+            jsonToLuaStackKey(lua, it.key());
+            jsonToLuaStackField(lua, tableIndex, it.value(), depth);
         }
     else
-        for (auto &[key, val] : json.items())
+        for (std::size_t i = 0; i < json.size(); i++)
         {
-            auto ref = table[atoi(key.c_str()) + 1];
-            jsonToLua(ref, val);
+            lua_pushinteger(lua, lua_Integer(i + 1));
+            jsonToLuaStackField(lua, tableIndex, json[i], depth);
         }
 }
 
-void jsonFromLuaTable(const sol::table &table, json &jsonOut)
+void jsonToLuaTable(sol::table &table, const json &json)
 {
-    jsonOut = json::object(); // assume its an object (keys are strings).
-    for (auto &[key, val] : table)
+    assert(json.is_structured());
+    lua_State *lua = table.lua_state();
+    const int top = lua_gettop(lua);
+    try
+    {
+        table.push();
+        jsonToLuaStackTable(lua, -1, json, 0);
+    }
+    catch (...)
     {
-        if (jsonOut.is_object() && key.get_type() == sol::type::number)
-            jsonOut = json::array();
+        lua_settop(lua, top);
+        throw;
+    }
+    lua_settop(lua, top);
+}
+
+///////////////// CBOR (https://www.rfc-editor.org/rfc/rfc8949.html)
+
+enum CborMajorType : unsigned char
+{
+    CBOR_UNSIGNED_INT = 0,
+    CBOR_NEGATIVE_INT = 1,
+    CBOR_BYTE_STRING = 2,
+    CBOR_TEXT_STRING = 3,
+    CBOR_ARRAY = 4,
+    CBOR_MAP = 5,
+    CBOR_TAG = 6,
+    CBOR_SIMPLE_OR_FLOAT = 7
+};
 
-        json jsonVal;
+constexpr static unsigned char
+    CBOR_FALSE = 0xf4,
+    CBOR_TRUE = 0xf5,
+    CBOR_NULL = 0xf6,
+    CBOR_DOUBLE = 0xfb,
+    CBOR_BREAK = 0xff,
+    CBOR_INDEFINITE_LENGTH = 31;
 
-        switch (val.get_type())
+static void cborWriteBigEndian(std::vector<unsigned char> &out, uint64 value, int numBytes)
+{
+    for (int i = numBytes - 1; i >= 0; i--)
+        out.push_back((unsigned char) (value >> (i * 8)));
+}
+
+static void cborWriteHead(std::vector<unsigned char> &out, CborMajorType majorType, uint64 argument)
+{
+    const unsigned char type = majorType << 5u;
+    if (argument < 24)
+        out.push_back(type | (unsigned char) argument);
+    else if (argument <= 0xff)
+    {
+        out.push_back(type | 24u);
+        cborWriteBigEndian(out, argument, 1);
+    }
+    else if (argument <= 0xffff)
+    {
+        out.push_back(type | 25u);
+        cborWriteBigEndian(out, argument, 2);
+    }
+    else if (argument <= 0xffffffff)
+    {
+        out.push_back(type | 26u);
+        cborWriteBigEndian(out, argument, 4);
+    }
+    else
+    {
+        out.push_back(type | 27u);
+        cborWriteBigEndian(out, argument, 8);
+    }
+}
+
+static void cborFromLuaStackValue(lua_State *lua, int index, std::vector<unsigned char> &out, int depth);
+
+static void cborFromLuaStackTable(lua_State *lua, int tableIndex, std::vector<unsigned char> &out, int depth)
+{
+    checkLuaTableDepth(lua, depth);
+    tableIndex = lua_absindex(lua, tableIndex);
+
+    std::size_t numEntries;
+    if (std::size_t sequenceLength = getLuaSequenceLength(lua, tableIndex, numEntries))
+    {
+        cborWriteHead(out, CBOR_ARRAY, sequenceLength);
+        for (std::size_t i = 1; i <= sequenceLength; i++)
         {
-            case sol::type::number:
-                jsonVal = val.as<double>();
-                break;
-            case sol::type::boolean:
-                jsonVal = val.as<bool>();
-                break;
-            case sol::type::string:
-                jsonVal = val.as<std::string>();
-                break;
-            case sol::type::table:
-                jsonFromLuaTable(val.as<sol::table>(), jsonVal);
-                break;
+            lua_rawgeti(lua, tableIndex, lua_Integer(i));
+            cborFromLuaStackValue(lua, -1, out, depth + 1);
+            lua_pop(lua, 1);
+        }
+        return;
+    }
+    cborWriteHead(out, CBOR_MAP, numEntries);
+
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIndex))
+    {
+        const int keyType = lua_type(lua, -2);
+        if (keyType != LUA_TSTRING && keyType != LUA_TNUMBER && keyType != LUA_TBOOLEAN)
+            throw gu_err("Cannot convert a Lua table with keys of type " + std::string(lua_typename(lua, keyType)) + " to CBOR");
+
+        cborFromLuaStackValue(lua, -2, out, depth + 1);
+        cborFromLuaStackValue(lua, -1, out, depth + 1);
+        lua_pop(lua, 1);
+    }
+}
+
+static void cborFromLuaStackValue(lua_State *lua, int index, std::vector<unsigned char> &out, int depth)
+{
+    switch (lua_type(lua, index))
+    {
+        case LUA_TNUMBER:
+            if (lua_isinteger(lua, index))
+            {
+                const lua_Integer integer = lua_tointeger(lua, index);
+                if (integer >= 0)
+                    cborWriteHead(out, CBOR_UNSIGNED_INT, uint64(integer));
+                else
+                    cborWriteHead(out, CBOR_NEGATIVE_INT, uint64(-(integer + 1)));
+            }
+            else
+            {
+                const double number = lua_tonumber(lua, index);
+                uint64 bits;
+                std::memcpy(&bits, &number, sizeof(bits));
+                out.push_back(CBOR_DOUBLE);
+                cborWriteBigEndian(out, bits, 8);
+            }
+            break;
+        case LUA_TBOOLEAN:
+            out.push_back(lua_toboolean(lua, index) ? CBOR_TRUE : CBOR_FALSE);
+            break;
+        case LUA_TSTRING:
+        {
+            std::size_t length;
+            const char *str = lua_tolstring(lua, index, &length);
+            cborWriteHead(out, CBOR_TEXT_STRING, length);
+            out.insert(out.end(), str, str + length);
+            break;
+        }
+        case LUA_TTABLE:
+            cborFromLuaStackTable(lua, index, out, depth);
+            break;
+        default:
+            out.push_back(CBOR_NULL);
+            break;
+    }
+}
+
+void cborFromLuaTable(const sol::table &table, std::vector<unsigned char> &cborOut)
+{
+    lua_State *lua = table.lua_state();
+    const int top = lua_gettop(lua);
+    try
+    {
+        table.push();
+        cborFromLuaStackTable(lua, -1, cborOut, 0);
+    }
+    catch (...)
+    {
+        lua_settop(lua, top);
+        throw;
+    }
+    lua_settop(lua, top);
+}
+
+namespace
+{
+
+struct CborReader
+{
+    const unsigned char *data, *end;
+
+    unsigned char readByte()
+    {
+        if (data >= end)
+            throw gu_err("Unexpected end of CBOR data");
+        return *data++;
+    }
+
+    uint64 readBigEndian(int numBytes)
+    {
+        if (end - data < numBytes)
+            throw gu_err("Unexpected end of CBOR data");
+        uint64 value = 0;
+        for (int i = 0; i < numBytes; i++)
+            value = (value << 8u) | *data++;
+        return value;
+    }
+
+    uint64 readArgument(unsigned char additionalInfo)
+    {
+        if (additionalInfo < 24)
+            return additionalInfo;
+        switch (additionalInfo)
+        {
+            case 24: return readBigEndian(1);
+            case 25: return readBigEndian(2);
+            case 26: return readBigEndian(4);
+            case 27: return readBigEndian(8);
             default:
-                break;
+                throw gu_err("Invalid CBOR argument: " + std::to_string(int(additionalInfo)));
         }
-        if (jsonOut.is_object())
-            jsonOut[key.as<std::string>()] = jsonVal;
+    }
+
+    bool nextIsBreak() const
+    {
+        return data < end && *data == CBOR_BREAK;
+    }
+
+    void readString(unsigned char majorType, unsigned char additionalInfo, std::string &out)
+    {
+        if (additionalInfo == CBOR_INDEFINITE_LENGTH)
+        {
+            while (!nextIsBreak())
+            {
+                const unsigned char head = readByte();
+                if (head >> 5u != majorType || (head & 31u) == CBOR_INDEFINITE_LENGTH)
+                    throw gu_err("Invalid chunk in indefinite length CBOR string");
+                readString(majorType, head & 31u, out);
+            }
+            readByte();
+            return;
+        }
+        const uint64 length = readArgument(additionalInfo);
+        if (uint64(end - data) < length)
+            throw gu_err("Unexpected end of CBOR data");
+        out.append((const char *) data, length);
+        data += length;
+    }
+
+    static double halfToDouble(uint16 half)
+    {
+        const int exponent = (half >> 10u) & 0x1fu;
+        const int mantissa = half & 0x3ffu;
+        double value;
+        if (exponent == 0)
+            value = std::ldexp(mantissa, -24);
+        else if (exponent != 31)
+            value = std::ldexp(mantissa + 1024, exponent - 25);
         else
-            jsonOut.push_back(jsonVal);
+            value = mantissa == 0 ? INFINITY : NAN;
+        return half & 0x8000u ? -value : value;
     }
+
+    /**
+     * Pushes exactly one value onto the Lua stack. null and undefined are pushed as nil.
+     */
+    void pushValue(lua_State *lua, int depth)
+    {
+        checkLuaTableDepth(lua, depth);
+
+        const unsigned char head = readByte();
+        const unsigned char majorType = head >> 5u;
+        const unsigned char additionalInfo = head & 31u;
+
+        switch (majorType)
+        {
+            case CBOR_UNSIGNED_INT:
+            {
+                const uint64 value = readArgument(additionalInfo);
+                if (value > uint64(std::numeric_limits<lua_Integer>::max()))
+                    lua_pushnumber(lua, lua_Number(value));
+                else
+                    lua_pushinteger(lua, lua_Integer(value));
+                return;
+            }
+            case CBOR_NEGATIVE_INT:
+            {
+                const uint64 value = readArgument(additionalInfo);
+                if (value > uint64(std::numeric_limits<lua_Integer>::max()))
+                    lua_pushnumber(lua, -1.0 - lua_Number(value));
+                else
+                    lua_pushinteger(lua, -1 - lua_Integer(value));
+                return;
+            }
+            case CBOR_BYTE_STRING:
+            case CBOR_TEXT_STRING:
+            {
+                if (additionalInfo != CBOR_INDEFINITE_LENGTH)
+                {
+                    const uint64 length = readArgument(additionalInfo);
+                    if (uint64(end - data) < length)
+                        throw gu_err("Unexpected end of CBOR data");
+                    lua_pushlstring(lua, (const char *) data, length);
+                    data += length;
+                    return;
+                }
+                std::string str;
+                readString(majorType, additionalInfo, str);
+                lua_pushlstring(lua, str.data(), str.size());
+                return;
+            }
+            case CBOR_ARRAY:
+            {
+                const bool bIndefinite = additionalInfo == CBOR_INDEFINITE_LENGTH;
+                const uint64 length = bIndefinite ? 0 : readArgument(additionalInfo);
+
+                // don't trust the length too much when preallocating, every item takes at least 1 byte:
+                lua_createtable(lua, int(std::min<uint64>(length, end - data)), 0);
+                for (lua_Integer i = 1; bIndefinite ? !nextIsBreak() : uint64(i) <= length; i++)
+                {
+                    pushValue(lua, depth + 1);
+                    if (lua_isnil(lua, -1))
+                        lua_pop(lua, 1);
+                    else
+                        lua_rawseti(lua, -2, i);
+                }
+                if (bIndefinite)
+                    readByte();
+                return;
+            }
+            case CBOR_MAP:
+            {
+                const bool bIndefinite = additionalInfo == CBOR_INDEFINITE_LENGTH;
+                const uint64 length = bIndefinite ? 0 : readArgument(additionalInfo);
+
+                lua_createtable(lua, 0, int(std::min<uint64>(length, (end - data) / 2)));
+                for (uint64 i = 0; bIndefinite ? !nextIsBreak() : i < length; i++)
+                {
+                    pushValue(lua, depth + 1);
+                    pushValue(lua, depth + 1);
+
+                    const bool bInvalidKey = lua_isnil(lua, -2) || (lua_type(lua, -2) == LUA_TNUMBER && lua_tonumber(lua, -2) != lua_tonumber(lua, -2));
+                    if (bInvalidKey || lua_isnil(lua, -1))
+                        lua_pop(lua, 2);
+                    else
+                        lua_rawset(lua, -3);
+                }
+                if (bIndefinite)
+                    readByte();
+                return;
+            }
+            case CBOR_TAG:
+                readArgument(additionalInfo); // tags are ignored, the tagged value is used as is.
+                pushValue(lua, depth);
+                return;
+            case CBOR_SIMPLE_OR_FLOAT:
+                switch (additionalInfo)
+                {
+                    case 20:
+                        lua_pushboolean(lua, false);
+                        return;
+                    case 21:
+                        lua_pushboolean(lua, true);
+                        return;
+                    case 22: // null
+                    case 23: // undefined
+                        lua_pushnil(lua);
+                        return;
+                    case 25:
+                        lua_pushnumber(lua, halfToDouble(uint16(readBigEndian(2))));
+                        return;
+                    case 26:
+                    {
+                        const uint32 bits = uint32(readBigEndian(4));
+                        float number;
+                        std::memcpy(&number, &bits, sizeof(number));
+                        lua_pushnumber(lua, number);
+                        return;
+                    }
+                    case 27:
+                    {
+                        const uint64 bits = readBigEndian(8);
+                        double number;
+                        std::memcpy(&number, &bits, sizeof(number));
+                        lua_pushnumber(lua, number);
+                        return;
+                    }
+                    default:
+                        throw gu_err("Unsupported CBOR simple value: " + std::to_string(int(head)));
+                }
+            default:
+                throw gu_err("Invalid CBOR major type: " + std::to_string(int(majorType)));
+        }
+    }
+};
+
+}
+
+sol::table cborToLuaTable(lua_State *lua, const unsigned char *cbor, std::size_t size)
+{
+    const int top = lua_gettop(lua);
+    try
+    {
+        CborReader reader { cbor, cbor + size };
+        reader.pushValue(lua, 0);
+        if (!lua_istable(lua, -1))
+            throw gu_err("CBOR data does not contain a map or an array");
+    }
+    catch (...)
+    {
+        lua_settop(lua, top);
+        throw;
+    }
+    sol::table table(lua, -1);
+    lua_settop(lua, top);
+    return table;
 }
 
+///////////////// entt::entity
+
 int sol_lua_push(sol::types<entt::entity>, lua_State *L, const entt::entity &e)
 {
     int n;
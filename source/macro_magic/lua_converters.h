@@ -59,10 +59,29 @@ int sol_lua_push(sol::types<entt::entity>, lua_State* L, const entt::entity& e);
 
 ///////////////
 
+/**
+ * Sequences become arrays, other tables become objects.
+ * Number keys become object keys like "[3]", jsonToLuaTable() turns those back into numbers.
+ */
 void jsonFromLuaTable(const sol::table &table, json &jsonOut);
 
+// Converts the Lua value at the given stack index. Values that cannot be serialized (functions, userdata) become null.
+void jsonFromLuaStackValue(lua_State *lua, int index, json &jsonOut);
+
 void jsonToLuaTable(sol::table &table, const json &json);
 
+/**
+ * Encodes a Lua table as CBOR, directly from the Lua stack (no json in between).
+ * Sequences become arrays, other tables become maps. Integer keys and values stay integers.
+ * Values that cannot be serialized (functions, userdata) are written as null.
+ */
+void cborFromLuaTable(const sol::table &table, std::vector<unsigned char> &cborOut);
+
+/**
+ * Decodes a CBOR map or array (like the ones written by cborFromLuaTable() or json::to_cbor()) directly into a new Lua table.
+ */
+sol::table cborToLuaTable(lua_State *lua, const unsigned char *cbor, std::size_t size);
+
 template <>
 struct sol::usertype_container<json> : public container_detail::usertype_container_default<json>
 {
@@ -101,27 +120,8 @@ struct sol::usertype_container<json> : public container_detail::usertype_contain
     {
         json &j = *sol::stack::unqualified_check_get<json *>(lua, 1).value();
 
-        sol::object luaVal = sol::stack::unqualified_check_get<sol::object>(lua, 3).value();
-
         json jsonVal;
-
-        switch (luaVal.get_type())  // copied from jsonFromLuaTable(). todo: move this switch to separate function
-        {
-            case sol::type::number:
-                jsonVal = luaVal.as<double>();
-                break;
-            case sol::type::boolean:
-                jsonVal = luaVal.as<bool>();
-                break;
-            case sol::type::string:
-                jsonVal = luaVal.as<std::string>();
-                break;
-            case sol::type::table:
-                jsonFromLuaTable(luaVal.as<sol::table>(), jsonVal);
-                break;
-            default:
-                break;
-        }
+        jsonFromLuaStackValue(lua, 3, jsonVal);
 
         const char *keyStr = sol::stack::unqualified_check_get<const char *>(lua, 2).value_or((const char *) nullptr);
         if (keyStr)
@@ -0,0 +1,144 @@
+#include "ecs/EntityObserver.h"
+#include "generated/Position3d.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Adds and removes a component on 10k observed entities every frame, and prints how long registering callbacks,
+// dispatching them and unregistering them takes.
+// Also checks that callbacks (un)registered during a dispatch are handled like EntityObserver promises.
+
+static int numFailures = 0;
+
+static void check(bool bOk, const std::string &what)
+{
+    if (!bOk)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        numFailures++;
+    }
+}
+
+static void testDispatch()
+{
+    entt::registry registry;
+    EntityObserver observer(std::in_place_type<Position3d>, registry);
+    entt::entity e = registry.create();
+
+    int numSelfCalls = 0, numOtherCalls = 0, numAddedCalls = 0;
+    std::vector<EntityObserver::Handle> handles, added;
+
+    // unregisters the next callback before it is called:
+    handles.push_back(observer.onConstruct(e, [&] { observer.unregister(handles[1]); }));
+    handles.push_back(observer.onConstruct(e, [&] { numOtherCalls++; }));
+    // unregisters itself and registers another callback, which should only be called by the next dispatch:
+    handles.push_back(observer.onConstruct(e, [&]
+    {
+        numSelfCalls++;
+        observer.unregister(handles[2]);
+        added.push_back(observer.onConstruct(e, [&] { numAddedCalls++; }));
+    }));
+
+    registry.assign<Position3d>(e);
+    check(numSelfCalls == 1, "callback is called once");
+    check(numOtherCalls == 0, "callback unregistered during a dispatch is not called by it");
+    check(numAddedCalls == 0, "callback registered during a dispatch is not called by it");
+
+    registry.remove<Position3d>(e);
+    registry.assign<Position3d>(e);
+    check(numSelfCalls == 1, "callback that unregistered itself is not called again");
+    check(numAddedCalls == 1, "callback registered during a dispatch is called by the next one");
+
+    int numDestroyCalls = 0;
+    observer.onDestroy(e, [&] { numDestroyCalls++; });
+    registry.destroy(e);
+    check(numDestroyCalls == 1, "onDestroy callback is called when the entity is destroyed");
+
+    // unregistering after the entity was destroyed is allowed:
+    observer.unregister(added.back());
+}
+
+static void benchmark()
+{
+    constexpr int NUM_ENTITIES = 10000;
+    constexpr int NUM_CALLBACKS_PER_ENTITY = 8;
+    constexpr int NUM_FRAMES = 100;
+
+    entt::registry registry;
+    EntityObserver observer(std::in_place_type<Position3d>, registry);
+    std::mt19937 random(42);
+
+    std::vector<entt::entity> entities(NUM_ENTITIES);
+    for (entt::entity &e : entities)
+    {
+        e = registry.create();
+    }
+
+    using clock = std::chrono::steady_clock;
+    clock::duration registerTime {}, churnTime {}, unregisterTime {};
+    std::size_t numCalls = 0, numExpectedCalls = 0;
+    std::vector<EntityObserver::Handle> handles;
+    handles.reserve(NUM_ENTITIES * NUM_CALLBACKS_PER_ENTITY);
+
+    for (int frame = 0; frame < NUM_FRAMES; frame++)
+    {
+        auto start = clock::now();
+        for (entt::entity e : entities)
+        {
+            for (int i = 0; i < NUM_CALLBACKS_PER_ENTITY; i += 2)
+            {
+                handles.push_back(observer.onConstruct(e, [&] { numCalls++; }));
+                handles.push_back(observer.onDestroy(e, [&] { numCalls++; }));
+            }
+        }
+        auto registered = clock::now();
+
+        // a different subset of the entities each frame:
+        for (entt::entity e : entities)
+        {
+            if (random() % 2u == 0u)
+            {
+                registry.assign<Position3d>(e);
+                registry.remove<Position3d>(e);
+                numExpectedCalls += NUM_CALLBACKS_PER_ENTITY;
+            }
+        }
+        auto churned = clock::now();
+
+        for (EntityObserver::Handle &handle : handles)
+        {
+            observer.unregister(handle);
+        }
+        handles.clear();
+        auto unregistered = clock::now();
+
+        registerTime += registered - start;
+        churnTime += churned - registered;
+        unregisterTime += unregistered - churned;
+    }
+    check(numCalls == numExpectedCalls, "every callback is called once per construct/destroy");
+
+    auto microsPerFrame = [&] (clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / NUM_FRAMES;
+    };
+    std::cout << NUM_ENTITIES << " entities with " << NUM_CALLBACKS_PER_ENTITY << " callbacks each:" << std::endl;
+    std::cout << "registering: " << microsPerFrame(registerTime) << "us per frame" << std::endl;
+    std::cout << "adding and removing the component on half of them: " << microsPerFrame(churnTime) << "us per frame" << std::endl;
+    std::cout << "unregistering: " << microsPerFrame(unregisterTime) << "us per frame" << std::endl;
+}
+
+int main()
+{
+    testDispatch();
+    benchmark();
+
+    if (numFailures > 0)
+    {
+        std::cerr << numFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
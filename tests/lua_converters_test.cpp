@@ -0,0 +1,152 @@
+#include "macro_magic/lua_converters.h"
+
+#include <chrono>
+#include <iostream>
+
+// Round-trips Lua tables through json and CBOR, and prints how long converting a large table takes.
+
+static int numFailures = 0;
+
+static void check(bool bOk, const std::string &what)
+{
+    if (!bOk)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        numFailures++;
+    }
+}
+
+static const char *DEEP_EQUALS = R"(
+    local function deepEquals(a, b)
+        if type(a) ~= type(b) then
+            return false
+        end
+        if type(a) ~= "table" then
+            return a == b and math.type(a) == math.type(b)
+        end
+        for k, v in pairs(a) do
+            if not deepEquals(v, b[k]) then
+                return false
+            end
+        end
+        for k in pairs(b) do
+            if a[k] == nil then
+                return false
+            end
+        end
+        return true
+    end
+    return deepEquals
+)";
+
+static sol::table jsonRoundTrip(sol::state &lua, const sol::table &table)
+{
+    json j;
+    jsonFromLuaTable(table, j);
+    // also through text, like a save file:
+    j = json::parse(j.dump());
+    sol::table result = lua.create_table();
+    jsonToLuaTable(result, j);
+    return result;
+}
+
+static sol::table cborRoundTrip(sol::state &lua, const sol::table &table)
+{
+    std::vector<unsigned char> cbor;
+    cborFromLuaTable(table, cbor);
+    return cborToLuaTable(lua.lua_state(), cbor.data(), cbor.size());
+}
+
+static void testRoundTrips(sol::state &lua)
+{
+    sol::function deepEquals = lua.script(DEEP_EQUALS);
+
+    const char *tables[] = {
+        "return {}",
+        "return { 1, 2, 3, 'four', true, 5.5 }",
+        "return { a = 1, b = 'two', c = { d = { e = false } }, f = 0.25 }",
+        "return { [1] = 'a', [3] = 'c', [100] = 'z' }", // sparse
+        "return { [-1] = 'negative', [0] = 'zero', [1] = 'one' }",
+        "return { [1.5] = 'float key', [2] = 'integer key' }",
+        "return { 'sequence', named = 'mixed', [10] = 'sparse' }",
+        "return { ['[1]'] = 'string that looks like a marked key', ['[[x'] = 'starts with brackets', ['1'] = 'string one', [1] = 'integer one' }",
+        "return { nested = { { x = 1 }, { [7] = { 'deep' } } } }",
+        "local t = { 1, 2, 3 }; t[2] = nil; t.x = 1; return t", // a hole, and as many entries as its length
+        "return { big = math.maxinteger, small = math.mininteger, float = 1e300, integerValue = 3, floatValue = 3.0 }",
+    };
+    for (const char *tableScript : tables)
+    {
+        sol::table table = lua.script(tableScript);
+        check(deepEquals(table, jsonRoundTrip(lua, table)), std::string("json round trip of: ") + tableScript);
+        check(deepEquals(table, cborRoundTrip(lua, table)), std::string("CBOR round trip of: ") + tableScript);
+    }
+
+    sol::table selfContaining = lua.script("local t = {}; t.self = t; return t");
+    bool bThrown = false;
+    try
+    {
+        json j;
+        jsonFromLuaTable(selfContaining, j);
+    }
+    catch (std::exception &)
+    {
+        bThrown = true;
+    }
+    check(bThrown, "converting a table that contains itself throws");
+}
+
+static void benchmark(sol::state &lua)
+{
+    sol::table table = lua.script(R"(
+        local t = {}
+        for i = 1, 10000 do
+            t[i] = { id = i, name = "entity" .. i, position = { x = i * .5, y = -i, z = 0 }, tags = { "a", "b" } }
+        end
+        return t
+    )");
+    constexpr int NUM_ITERATIONS = 20;
+
+    auto measure = [&] (const char *name, auto &&function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < NUM_ITERATIONS; i++)
+            function();
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << micros / NUM_ITERATIONS << "us per table of 10000 entries" << std::endl;
+    };
+    measure("jsonFromLuaTable", [&] {
+        json j;
+        jsonFromLuaTable(table, j);
+    });
+    json j;
+    jsonFromLuaTable(table, j);
+    measure("jsonToLuaTable", [&] {
+        sol::table result = lua.create_table();
+        jsonToLuaTable(result, j);
+    });
+    std::vector<unsigned char> cbor;
+    measure("cborFromLuaTable", [&] {
+        cbor.clear();
+        cborFromLuaTable(table, cbor);
+    });
+    measure("cborToLuaTable", [&] {
+        cborToLuaTable(lua.lua_state(), cbor.data(), cbor.size());
+    });
+}
+
+int main()
+{
+    sol::state lua;
+    lua.open_libraries(sol::lib::base, sol::lib::math);
+
+    testRoundTrips(lua);
+    benchmark(lua);
+
+    if (numFailures > 0)
+    {
+        std::cerr << numFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "ecs/EntityEngine.h"
+#include "ecs/systems/SpatialIndexSystem.h"
+#include "generated/Position3d.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Moves 50k entities every frame, and prints how long updating the spatial index and querying it takes.
+// Also checks that entities are found after moving, including positions that were set through ComponentUtils.
+
+static int numFailures = 0;
+
+static void check(bool bOk, const std::string &what)
+{
+    if (!bOk)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        numFailures++;
+    }
+}
+
+static bool isFound(SpatialIndexSystem &index, entt::entity e, const vec3 &position)
+{
+    std::vector<entt::entity> found;
+    index.getInRadius(position, .01f, found);
+    return std::find(found.begin(), found.end(), e) != found.end();
+}
+
+static void testComponentUtilsPositions(EntityEngine &engine)
+{
+    SpatialIndexSystem &index = *engine.getSpatialIndex();
+    const ComponentUtils &utils = *ComponentUtils::getFor<Position3d>();
+    const vec3 target(100.f, -50.f, 25.f);
+
+    entt::entity source = engine.entities.create();
+    engine.entities.assign<Position3d>(source).vec = target;
+    json j;
+    utils.getJsonComponentWithKeys(j, source, engine.entities);
+    engine.entities.destroy(source);
+
+    // assigned at the origin by setJsonComponent(), then set:
+    entt::entity assigned = engine.entities.create();
+    utils.setJsonComponentWithKeys(j, assigned, engine.entities);
+
+    // set in place:
+    entt::entity inPlace = engine.entities.create();
+    engine.entities.assign<Position3d>(inPlace);
+    engine.update(1. / 60.);
+    utils.setJsonComponentWithKeys(j, inPlace, engine.entities);
+
+    engine.update(1. / 60.);
+    check(isFound(index, assigned, target), "position set on a new entity by setJsonComponentWithKeys() is indexed");
+    check(isFound(index, inPlace, target), "position set in place by setJsonComponentWithKeys() is indexed");
+
+    engine.entities.destroy(assigned);
+    engine.entities.destroy(inPlace);
+}
+
+static void benchmark(EntityEngine &engine)
+{
+    constexpr int NUM_ENTITIES = 50000;
+    constexpr int NUM_FRAMES = 100;
+    constexpr int NUM_QUERIES_PER_FRAME = 1000;
+    constexpr float WORLD_SIZE = 1000.f;
+
+    SpatialIndexSystem &index = *engine.getSpatialIndex();
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> inWorld(0.f, WORLD_SIZE), step(-1.f, 1.f);
+
+    std::vector<entt::entity> entities(NUM_ENTITIES);
+    for (entt::entity &e : entities)
+    {
+        e = engine.entities.create();
+        engine.entities.assign<Position3d>(e).vec = vec3(inWorld(random), inWorld(random), inWorld(random));
+    }
+
+    using clock = std::chrono::steady_clock;
+    clock::duration moveTime {}, updateTime {}, queryTime {};
+    std::size_t numFound = 0;
+    std::vector<entt::entity> found;
+
+    for (int frame = 0; frame < NUM_FRAMES; frame++)
+    {
+        auto start = clock::now();
+        for (entt::entity e : entities)
+        {
+            engine.entities.get<Position3d>(e).vec += vec3(step(random), step(random), step(random));
+            index.markMoved(e);
+        }
+        auto moved = clock::now();
+        engine.update(1. / 60.);
+        auto updated = clock::now();
+        for (int i = 0; i < NUM_QUERIES_PER_FRAME; i++)
+        {
+            found.clear();
+            index.getInRadius(vec3(inWorld(random), inWorld(random), inWorld(random)), 20.f, found);
+            numFound += found.size();
+        }
+        auto queried = clock::now();
+
+        moveTime += moved - start;
+        updateTime += updated - moved;
+        queryTime += queried - updated;
+    }
+
+    for (entt::entity e : entities)
+    {
+        if (!isFound(index, e, engine.entities.get<Position3d>(e).vec))
+        {
+            check(false, "moved entity is found at its position");
+            break;
+        }
+    }
+
+    auto microsPerFrame = [&] (clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / NUM_FRAMES;
+    };
+    std::cout << NUM_ENTITIES << " entities moving every frame:" << std::endl;
+    std::cout << "moving and marking: " << microsPerFrame(moveTime) << "us per frame" << std::endl;
+    std::cout << "engine update (incl. spatial index): " << microsPerFrame(updateTime) << "us per frame" << std::endl;
+    std::cout << NUM_QUERIES_PER_FRAME << " radius queries: " << microsPerFrame(queryTime) << "us per frame ("
+        << numFound / (NUM_FRAMES * NUM_QUERIES_PER_FRAME) << " entities found per query)" << std::endl;
+}
+
+int main()
+{
+    EntityEngine engine;
+    engine.initialize();
+
+    testComponentUtilsPositions(engine);
+    benchmark(engine);
+
+    if (numFailures > 0)
+    {
+        std::cerr << numFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}